@@ -0,0 +1,53 @@
+/**
+ * \file
+ * Command codes and replies of the binary PC-master protocol, shared
+ * by the PC library, the simulator and the master firmware.
+ *
+ * Each command is a byte with the command code in the bottom four bits
+ * and the device ID (0 for the master, 1-9 for the slaves) in the top
+ * four, followed by its data.
+ */
+
+#ifndef __COMMANDS_H
+#define __COMMANDS_H
+
+#define CMD_WRITE 2 //!< register changes
+#define CMD_READ 3  //!< read registers in read set
+#define CMD_SETREADSET 4  //!< change the read set
+#define CMD_MULTIREAD 5  //!< read sets from several devices in one go
+#define CMD_WRITEREAD 6  //!< register changes followed by a read set read
+#define CMD_FRAMING 7  //!< switch framing on or off
+#define CMD_PING 8  //!< check the master is running and healthy
+#define CMD_MULTIWRITE 9  //!< register changes on several devices in one go
+#define CMD_ESTOP 10  //!< stop all the motors at once
+
+/// bytes of the master's memory for read set definitions, shared
+/// between all the devices: each definition takes a byte per register,
+/// and devices with identical read sets share one. The library's
+/// standard read sets take 49 bytes in eight definitions (three sets
+/// each for the two kinds of board and two for the master), which
+/// leaves room for a custom set of a dozen or so registers on every
+/// board. It must be less than 256.
+#define READSETAREA 192
+/// number of different read set definitions the master can hold, however
+/// small they are
+#define READSETENTRIES 24
+
+/// reply to CMD_SETREADSET if the set couldn't be stored because
+/// it was too large or not a valid set
+#define READSET_FAILED 0xff
+/// reply to CMD_SETREADSET if the set couldn't be stored because
+/// there is no room for it in READSETAREA, or all READSETENTRIES
+/// definitions are in use
+#define READSET_POOLFULL 0xfe
+
+/// first byte of the reply to CMD_PING
+#define PING_MAGIC 0xb1
+/// version of the reply to CMD_PING, its second byte
+#define PING_VERSION 1
+/// ping health flag: a slave has had an exception
+#define PING_EXCEPTION 1
+/// ping health flag: the master has only just started
+#define PING_STARTING 2
+
+#endif /* __COMMANDS_H */
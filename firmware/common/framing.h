@@ -0,0 +1,197 @@
+/**
+ * \file
+ * Framing for the binary PC-master protocol, shared by the PC library,
+ * the simulator and the master firmware.
+ *
+ * Once framing has been switched on with CMD_FRAMING, every message in
+ * both directions is sent as a frame: a version byte, a sequence number,
+ * the message itself and a CRC-16 of all of those. The frame is byte
+ * stuffed in the manner of SLIP so that FRAME_END only ever appears at
+ * the start and end of a frame. A receiver which loses a byte, or sees
+ * garbage, resynchronises at the next FRAME_END; the CRC catches
+ * anything which gets through, and the sequence number (which the
+ * master copies from the request into the reply) lets the PC discard
+ * replies to requests it has given up on.
+ *
+ * Byte stuffing is used rather than COBS because it can be encoded a
+ * byte at a time as the reply is sent - COBS needs up to 254 bytes
+ * of the reply in hand first, and the master hasn't the memory.
+ */
+
+#ifndef __FRAMING_H
+#define __FRAMING_H
+
+#include <stdint.h>
+
+/// the version of the framing, sent as the first byte of every frame
+#define FRAME_VERSION 1
+
+/// frame delimiter
+#define FRAME_END 0xc0
+/// escape character
+#define FRAME_ESC 0xdb
+/// sent after FRAME_ESC to stand for FRAME_END
+#define FRAME_ESCEND 0xdc
+/// sent after FRAME_ESC to stand for FRAME_ESC
+#define FRAME_ESCESC 0xdd
+
+/// number of bytes in a frame other than the message: version, sequence
+/// number and two bytes of CRC
+#define FRAME_OVERHEAD 4
+
+/// initial value of the CRC
+#define FRAME_CRCINIT 0xffff
+
+/// add a byte to a CRC-16/CCITT (polynomial 0x1021)
+inline uint16_t frameCRC(uint16_t crc,uint8_t c){
+    crc ^= (uint16_t)c<<8;
+    for(uint8_t i=0;i<8;i++){
+        if(crc & 0x8000)
+            crc = (crc<<1)^0x1021;
+        else
+            crc <<= 1;
+    }
+    return crc;
+}
+
+/// encodes a frame a byte at a time, passing the encoded bytes to
+/// emit(). Call begin(), then put() the message, then end().
+
+class FrameWriter {
+    /// the CRC so far
+    uint16_t crc;
+
+    /// emit a byte, escaping it if required
+    void stuff(uint8_t c){
+        if(c==FRAME_END){
+            emit(FRAME_ESC);
+            emit(FRAME_ESCEND);
+        } else if(c==FRAME_ESC){
+            emit(FRAME_ESC);
+            emit(FRAME_ESCESC);
+        } else
+            emit(c);
+    }
+
+protected:
+    /// override this to send an encoded byte
+    virtual void emit(uint8_t c)=0;
+
+public:
+    /// start a frame with a given sequence number. The frame
+    /// starts with a delimiter to flush any garbage at the other end.
+    void begin(uint8_t seq){
+        emit(FRAME_END);
+        crc = FRAME_CRCINIT;
+        put(FRAME_VERSION);
+        put(seq);
+    }
+
+    /// add a byte of the message
+    void put(uint8_t c){
+        crc = frameCRC(crc,c);
+        stuff(c);
+    }
+
+    /// add a block of the message
+    void put(const uint8_t *p,int n){
+        while(n--)
+            put(*p++);
+    }
+
+    /// finish the frame, sending the CRC and the delimiter
+    void end(){
+        uint16_t c = crc;
+        stuff(c&0xff);
+        stuff(c>>8);
+        emit(FRAME_END);
+    }
+};
+
+/// decodes frames a byte at a time into a buffer, checking them.
+
+class FrameReader {
+    uint8_t *buf; //!< the buffer
+    int cap; //!< size of the buffer
+    int ct; //!< bytes in the frame so far
+    int len; //!< length of the message in the last good frame
+    bool esc; //!< true if the last byte was an escape
+    bool bad; //!< true if the frame so far is bad
+
+public:
+    /// set up a reader, given the buffer to decode into and its size,
+    /// which limits the size of frame which can be read.
+    FrameReader(uint8_t *b,int c){
+        buf=b;
+        cap=c;
+        len=0;
+        reset();
+    }
+
+    /// discard any partial frame
+    void reset(){
+        ct=0;
+        esc=false;
+        bad=false;
+    }
+
+    /// feed a byte in. Returns 1 when a good frame has been completed,
+    /// -1 when a bad one has, and 0 otherwise. After a good frame,
+    /// the message is available from getMessage() until the next byte
+    /// is fed in.
+    int feed(uint8_t c){
+        if(c==FRAME_END){
+            int n=ct;
+            bool b=bad;
+            reset();
+            if(!n)return 0; // nothing between delimiters
+            if(b || n<FRAME_OVERHEAD || buf[0]!=FRAME_VERSION)
+                return -1;
+            uint16_t crc = FRAME_CRCINIT;
+            for(int i=0;i<n-2;i++)
+                crc = frameCRC(crc,buf[i]);
+            if(crc != (buf[n-2] | (buf[n-1]<<8)))
+                return -1;
+            len = n-FRAME_OVERHEAD;
+            return 1;
+        }
+        if(bad)return 0; // skip to the end of a bad frame
+        if(esc){
+            esc=false;
+            if(c==FRAME_ESCEND)
+                c=FRAME_END;
+            else if(c==FRAME_ESCESC)
+                c=FRAME_ESC;
+            else {
+                bad=true;
+                return 0;
+            }
+        } else if(c==FRAME_ESC){
+            esc=true;
+            return 0;
+        }
+        if(ct==cap){
+            bad=true; // too long
+            return 0;
+        }
+        buf[ct++]=c;
+        return 0;
+    }
+
+    /// the sequence number of the last good frame
+    uint8_t getSeq(){
+        return buf[1];
+    }
+
+    /// the message in the last good frame
+    uint8_t *getMessage(){
+        return buf+2;
+    }
+
+    /// the length of the message in the last good frame
+    int getLength(){
+        return len;
+    }
+};
+
+#endif /* __FRAMING_H */
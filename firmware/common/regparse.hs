@@ -197,6 +197,29 @@ outputBlockH cbs b@(Block name blocks _) = (outputRegs base outputNumberedRegH $
                                     
                                     decl = ifCommon "" ("extern MAYBEPROGMEM Register registerTable_"++name++"[];")
 
+-- output a REGTYPE line for a register, given the (number,register) pair and the table name.
+-- These give the PC library compile-time descriptors for the registers (see pc/regtypes.h).
+
+outputNumberedRegType name (x,n) = "REGTYPE(" ++ name
+                                 ++ ", " ++ (mName x)
+                                 ++ ", " ++ (show $ mBytes x)
+                                 ++ ", " ++ (if mWritable x then "true" else "false")
+                                 ++ ", " ++ (show $ mMin x)
+                                 ++ ", " ++ (show $ mMax x)
+                                 ++ ") \t// (" ++ (show n) ++ ")  " ++ (mDesc x)
+
+-- output the register types of a block, given the common block and the block itself.
+-- The common block's registers come first under their own names, unless this block
+-- is nocommon, so that they are numbered as they are in the register table. The
+-- common block itself gets a table with an empty name, so its types are just Reg<n>.
+
+outputBlockTypes :: Block -> Block -> String
+outputBlockTypes cb b@(Block name blocks nocom) = "REGTABLE(" ++ name ++ ")\n" ++
+                            (outputRegs 0 (outputNumberedRegType name) regs) ++ "\n"
+                                where
+                                    common = if nocom || isCommonBlock b then [] else map (prefix "") (mRegs cb)
+                                    regs = common ++ map (prefix name) blocks
+
 outputBlockLatex :: Int -> Block -> String
 outputBlockLatex cbs b@(Block name blocks _) =
     "\\begin{tabular}{|p{0.2in}|p{2.7in}|p{0.1in}|p{0.1in}|p{1in}|p{1.5in}|}\\hline\n" ++
@@ -271,6 +294,11 @@ main = do
                                     filter (\x -> not $ isCommonBlock x)
                                     (prependCommonToBlocks . appendTerminatorToBlocks $ lst))
                                     
+                            -- write the compile-time register types to regsautotypes.h
+
+                            let commonBlock = head $ filter (isCommonBlock) lst
+                            writeFile "regsautotypes.h" $ autopreamble ++ (outputBlockList (outputBlockTypes commonBlock) lst)
+
                             writeFile "regs.tex" $ outputBlockList (outputBlockLatex commonBlockSize) lst
                                     
 
@@ -0,0 +1,129 @@
+/**
+ * \file
+ * Compile-time register descriptors for the PC library (see
+ * pc/regtypes.h), in the form regparse.hs writes them. This copy was
+ * written by hand from regDefinitions; running regparse.hs replaces
+ * it, along with regsauto.h and regsauto.cpp. regtypes.h checks it
+ * against those, so if they drift apart the library won't compile
+ * (for a missing or extra register) or Rover::init() will throw (for
+ * a changed size, writability or range).
+ */
+
+REGTABLE()
+REGTYPE(, REG_RESET, 1, true, -1.0, -1.0) 	// (0)  reset bits - beware race conditions
+REGTYPE(, REG_TIMER, 2, false, -1.0, -1.0) 	// (1)  millis since start
+REGTYPE(, REG_INTERVALI2C, 2, false, -1.0, -1.0) 	// (2)  interval between I2C ticks
+REGTYPE(, REG_STATUS, 2, false, -1.0, -1.0) 	// (3)  see status flags in regs.h
+REGTYPE(, REG_DEBUGLED, 1, true, -1.0, -1.0) 	// (4)  debugging LEDs, turns on for some time
+REGTYPE(, REG_EXCEPTIONDATA, 2, true, -1.0, -1.0) 	// (5)  LSB: type, MSB: id. Write causes REMOTE exception
+REGTYPE(, REG_DISABLEDEXCEPTIONS, 2, true, -1.0, -1.0) 	// (6)  bitfield of disabled exceptions
+REGTYPE(, REG_PING, 1, true, -1.0, -1.0) 	// (7)  debugging
+REGTYPE(, REG_DEBUG, 2, true, -1.0, -1.0) 	// (8)  debugging
+
+REGTABLE(DS)
+REGTYPE(DS, REG_RESET, 1, true, -1.0, -1.0) 	// (0)  reset bits - beware race conditions
+REGTYPE(DS, REG_TIMER, 2, false, -1.0, -1.0) 	// (1)  millis since start
+REGTYPE(DS, REG_INTERVALI2C, 2, false, -1.0, -1.0) 	// (2)  interval between I2C ticks
+REGTYPE(DS, REG_STATUS, 2, false, -1.0, -1.0) 	// (3)  see status flags in regs.h
+REGTYPE(DS, REG_DEBUGLED, 1, true, -1.0, -1.0) 	// (4)  debugging LEDs, turns on for some time
+REGTYPE(DS, REG_EXCEPTIONDATA, 2, true, -1.0, -1.0) 	// (5)  LSB: type, MSB: id. Write causes REMOTE exception
+REGTYPE(DS, REG_DISABLEDEXCEPTIONS, 2, true, -1.0, -1.0) 	// (6)  bitfield of disabled exceptions
+REGTYPE(DS, REG_PING, 1, true, -1.0, -1.0) 	// (7)  debugging
+REGTYPE(DS, REG_DEBUG, 2, true, -1.0, -1.0) 	// (8)  debugging
+REGTYPE(DS, REGDS_DRIVE_REQSPEED, 2, true, -4000.0, 4000.0) 	// (9)  required speed
+REGTYPE(DS, REGDS_DRIVE_PGAIN, 2, true, 0.0, 10.0) 	// (10)  P-gain
+REGTYPE(DS, REGDS_DRIVE_IGAIN, 2, true, 0.0, 10.0) 	// (11)  I-gain
+REGTYPE(DS, REGDS_DRIVE_DGAIN, 2, true, -10.0, 10.0) 	// (12)  D-gain
+REGTYPE(DS, REGDS_DRIVE_INTEGRALCAP, 2, true, 0.0, 1000.0) 	// (13)  integral error cap
+REGTYPE(DS, REGDS_DRIVE_INTEGRALDECAY, 2, true, 0.0, 1.0) 	// (14)  integral decay
+REGTYPE(DS, REGDS_DRIVE_OVERCURRENTTHRESH, 2, true, 0.0, 1000.0) 	// (15)  overcurrent threshold
+REGTYPE(DS, REGDS_DRIVE_ACTUALSPEED, 2, false, -4000.0, 4000.0) 	// (16)  actual speed from encoder
+REGTYPE(DS, REGDS_DRIVE_ERROR, 2, false, -1000.0, 1000.0) 	// (17)  required minus actual speed
+REGTYPE(DS, REGDS_DRIVE_ERRORINTEGRAL, 2, false, -1000.0, 1000.0) 	// (18)  error integral magnitude
+REGTYPE(DS, REGDS_DRIVE_ERRORDERIV, 2, false, -200.0, 200.0) 	// (19)  error derivative
+REGTYPE(DS, REGDS_DRIVE_CONTROL, 2, false, -255.0, 255.0) 	// (20)  value being sent to motor
+REGTYPE(DS, REGDS_DRIVE_INTERVALCTRL, 2, false, 0.0, 1000.0) 	// (21)  time between control runs (ms)
+REGTYPE(DS, REGDS_DRIVE_CURRENT, 2, false, -1.0, -1.0) 	// (22)  raw current reading
+REGTYPE(DS, REGDS_DRIVE_ODO, 2, false, -1.0, -1.0) 	// (23)  encoder ticks
+REGTYPE(DS, REGDS_DRIVE_STALLCHECK, 1, true, 0.0, 255.0) 	// (24)  stall check control signal level
+REGTYPE(DS, REGDS_DRIVE_DEADZONE, 1, true, 0.0, 50.0) 	// (25)  if below this value, error is set to zero
+REGTYPE(DS, REGDS_STEER_REQPOS, 2, true, -200.0, 200.0) 	// (26)  required position
+REGTYPE(DS, REGDS_STEER_PGAIN, 2, true, 0.0, 100.0) 	// (27)  P-gain
+REGTYPE(DS, REGDS_STEER_IGAIN, 2, true, 0.0, 10.0) 	// (28)  I-gain
+REGTYPE(DS, REGDS_STEER_DGAIN, 2, true, -10.0, 10.0) 	// (29)  D-gain
+REGTYPE(DS, REGDS_STEER_INTEGRALCAP, 2, true, 0.0, 1000.0) 	// (30)  integral error cap
+REGTYPE(DS, REGDS_STEER_INTEGRALDECAY, 2, true, 0.0, 1.0) 	// (31)  integral decay
+REGTYPE(DS, REGDS_STEER_OVERCURRENTTHRESH, 2, true, 0.0, 1000.0) 	// (32)  overcurrent threshold
+REGTYPE(DS, REGDS_STEER_ACTUALPOS, 2, false, -200.0, 200.0) 	// (33)  actual position from pot
+REGTYPE(DS, REGDS_STEER_ERROR, 2, false, -200.0, 200.0) 	// (34)  required minus actual position
+REGTYPE(DS, REGDS_STEER_ERRORINTEGRAL, 2, false, -1000.0, 1000.0) 	// (35)  error integral magnitude
+REGTYPE(DS, REGDS_STEER_ERRORDERIV, 2, false, -200.0, 200.0) 	// (36)  error derivative
+REGTYPE(DS, REGDS_STEER_CONTROL, 2, false, -255.0, 255.0) 	// (37)  value being sent to motor
+REGTYPE(DS, REGDS_STEER_INTERVALCTRL, 2, false, 0.0, 1000.0) 	// (38)  time between control runs (ms)
+REGTYPE(DS, REGDS_STEER_CURRENT, 2, false, -1.0, -1.0) 	// (39)  raw current reading
+REGTYPE(DS, REGDS_STEER_STALLCHECK, 1, true, 0.0, 255.0) 	// (40)  stall check control signal level
+REGTYPE(DS, REGDS_STEER_DEADZONE, 1, true, 0.0, 50.0) 	// (41)  if below this value, error is set to zero
+REGTYPE(DS, REGDS_STEER_CALIBMIN, 1, true, -120.0, 120.0) 	// (42)  minimum angle, mapped onto pot value 0
+REGTYPE(DS, REGDS_STEER_CALIBMAX, 1, true, -120.0, 120.0) 	// (43)  maximum angle, mapped onto pot value 1024
+REGTYPE(DS, REGDS_CHASSIS, 2, false, 0.0, 1024.0) 	// (44)  chassis pot reading
+
+REGTABLE(LL)
+REGTYPE(LL, REG_RESET, 1, true, -1.0, -1.0) 	// (0)  reset bits - beware race conditions
+REGTYPE(LL, REG_TIMER, 2, false, -1.0, -1.0) 	// (1)  millis since start
+REGTYPE(LL, REG_INTERVALI2C, 2, false, -1.0, -1.0) 	// (2)  interval between I2C ticks
+REGTYPE(LL, REG_STATUS, 2, false, -1.0, -1.0) 	// (3)  see status flags in regs.h
+REGTYPE(LL, REG_DEBUGLED, 1, true, -1.0, -1.0) 	// (4)  debugging LEDs, turns on for some time
+REGTYPE(LL, REG_EXCEPTIONDATA, 2, true, -1.0, -1.0) 	// (5)  LSB: type, MSB: id. Write causes REMOTE exception
+REGTYPE(LL, REG_DISABLEDEXCEPTIONS, 2, true, -1.0, -1.0) 	// (6)  bitfield of disabled exceptions
+REGTYPE(LL, REG_PING, 1, true, -1.0, -1.0) 	// (7)  debugging
+REGTYPE(LL, REG_DEBUG, 2, true, -1.0, -1.0) 	// (8)  debugging
+REGTYPE(LL, REGLL_ONE_REQPOS, 2, true, -200.0, 200.0) 	// (9)  required position
+REGTYPE(LL, REGLL_ONE_PGAIN, 2, true, 0.0, 100.0) 	// (10)  P-gain
+REGTYPE(LL, REGLL_ONE_IGAIN, 2, true, 0.0, 10.0) 	// (11)  I-gain
+REGTYPE(LL, REGLL_ONE_DGAIN, 2, true, -10.0, 10.0) 	// (12)  D-gain
+REGTYPE(LL, REGLL_ONE_INTEGRALCAP, 2, true, 0.0, 1000.0) 	// (13)  integral error cap
+REGTYPE(LL, REGLL_ONE_INTEGRALDECAY, 2, true, 0.0, 1.0) 	// (14)  integral decay
+REGTYPE(LL, REGLL_ONE_OVERCURRENTTHRESH, 2, true, 0.0, 1000.0) 	// (15)  overcurrent threshold
+REGTYPE(LL, REGLL_ONE_ACTUALPOS, 2, false, -200.0, 200.0) 	// (16)  actual position from pot
+REGTYPE(LL, REGLL_ONE_ERROR, 2, false, -200.0, 200.0) 	// (17)  required minus actual position
+REGTYPE(LL, REGLL_ONE_ERRORINTEGRAL, 2, false, -1000.0, 1000.0) 	// (18)  error integral magnitude
+REGTYPE(LL, REGLL_ONE_ERRORDERIV, 2, false, -200.0, 200.0) 	// (19)  error derivative
+REGTYPE(LL, REGLL_ONE_CONTROL, 2, false, -255.0, 255.0) 	// (20)  value being sent to motor
+REGTYPE(LL, REGLL_ONE_INTERVALCTRL, 2, false, 0.0, 1000.0) 	// (21)  time between control runs (ms)
+REGTYPE(LL, REGLL_ONE_CURRENT, 2, false, -1.0, -1.0) 	// (22)  raw current reading
+REGTYPE(LL, REGLL_ONE_CALIBMIN, 1, true, -120.0, 120.0) 	// (23)  minimum angle, mapped onto pot value 0
+REGTYPE(LL, REGLL_ONE_CALIBMAX, 1, true, -120.0, 120.0) 	// (24)  maximum angle, mapped onto pot value 1024
+REGTYPE(LL, REGLL_ONE_STALLCHECK, 1, true, 0.0, 255.0) 	// (25)  stall check control signal level
+REGTYPE(LL, REGLL_ONE_DEADZONE, 1, true, 0.0, 50.0) 	// (26)  if below this value, error is set to zero
+REGTYPE(LL, REGLL_TWO_REQPOS, 2, true, -200.0, 200.0) 	// (27)  required position
+REGTYPE(LL, REGLL_TWO_PGAIN, 2, true, 0.0, 100.0) 	// (28)  P-gain
+REGTYPE(LL, REGLL_TWO_IGAIN, 2, true, 0.0, 10.0) 	// (29)  I-gain
+REGTYPE(LL, REGLL_TWO_DGAIN, 2, true, -10.0, 10.0) 	// (30)  D-gain
+REGTYPE(LL, REGLL_TWO_INTEGRALCAP, 2, true, 0.0, 1000.0) 	// (31)  integral error cap
+REGTYPE(LL, REGLL_TWO_INTEGRALDECAY, 2, true, 0.0, 1.0) 	// (32)  integral decay
+REGTYPE(LL, REGLL_TWO_OVERCURRENTTHRESH, 2, true, 0.0, 1000.0) 	// (33)  overcurrent threshold
+REGTYPE(LL, REGLL_TWO_ACTUALPOS, 2, false, -200.0, 200.0) 	// (34)  actual position from pot
+REGTYPE(LL, REGLL_TWO_ERROR, 2, false, -200.0, 200.0) 	// (35)  required minus actual position
+REGTYPE(LL, REGLL_TWO_ERRORINTEGRAL, 2, false, -1000.0, 1000.0) 	// (36)  error integral magnitude
+REGTYPE(LL, REGLL_TWO_ERRORDERIV, 2, false, -200.0, 200.0) 	// (37)  error derivative
+REGTYPE(LL, REGLL_TWO_CONTROL, 2, false, -255.0, 255.0) 	// (38)  value being sent to motor
+REGTYPE(LL, REGLL_TWO_INTERVALCTRL, 2, false, 0.0, 1000.0) 	// (39)  time between control runs (ms)
+REGTYPE(LL, REGLL_TWO_CURRENT, 2, false, -1.0, -1.0) 	// (40)  raw current reading
+REGTYPE(LL, REGLL_TWO_CALIBMIN, 1, true, -120.0, 120.0) 	// (41)  minimum angle, mapped onto pot value 0
+REGTYPE(LL, REGLL_TWO_CALIBMAX, 1, true, -120.0, 120.0) 	// (42)  maximum angle, mapped onto pot value 1024
+REGTYPE(LL, REGLL_TWO_STALLCHECK, 1, true, 0.0, 255.0) 	// (43)  stall check control signal level
+REGTYPE(LL, REGLL_TWO_DEADZONE, 1, true, 0.0, 50.0) 	// (44)  if below this value, error is set to zero
+
+REGTABLE(MASTER)
+REGTYPE(MASTER, REGMASTER_RESET, 1, true, -1.0, -1.0) 	// (0)  set to clear exception state
+REGTYPE(MASTER, REGMASTER_TEMPAMBIENT, 2, false, -20.0, 100.0) 	// (1)  temperature sensor
+REGTYPE(MASTER, REGMASTER_TEMP1, 2, false, -20.0, 100.0) 	// (2)  temperature sensor
+REGTYPE(MASTER, REGMASTER_TEMP2, 2, false, -20.0, 100.0) 	// (3)  temperature sensor
+REGTYPE(MASTER, REGMASTER_TEMP3, 2, false, -20.0, 100.0) 	// (4)  temperature sensor
+REGTYPE(MASTER, REGMASTER_TEMP4, 2, false, -20.0, 100.0) 	// (5)  temperature sensor
+REGTYPE(MASTER, REGMASTER_TEMP5, 2, false, -20.0, 100.0) 	// (6)  temperature sensor
+REGTYPE(MASTER, REGMASTER_TEMP6, 2, false, -20.0, 100.0) 	// (7)  temperature sensor
+REGTYPE(MASTER, REGMASTER_TEMP7, 2, false, -20.0, 100.0) 	// (8)  temperature sensor
+REGTYPE(MASTER, REGMASTER_TEMP8, 2, false, -20.0, 100.0) 	// (9)  temperature sensor
+REGTYPE(MASTER, REGMASTER_TEMP9, 2, false, -20.0, 100.0) 	// (10)  temperature sensor
+REGTYPE(MASTER, REGMASTER_EXCEPTIONDATA, 2, false, -1.0, -1.0) 	// (11)  LSB: type, MSB: motor|slave
@@ -0,0 +1 @@
+../../common/commands.h
\ No newline at end of file
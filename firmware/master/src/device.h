@@ -9,11 +9,25 @@
 #define __DEVICE_H
 
 #include "../../common/regs.h"
+#include "../../common/commands.h"
 
 
 #define E_NOSUCHREG 1
 #define E_READONLY 2
 
+// READSETAREA and READSETENTRIES, which limit the read set definitions
+// which can be stored, are in commands.h since the PC needs to know them too.
+
+/// a device's read set slot when it has no read set
+#define NOREADSET 0xff
+
+/// a read set definition, whose registers are in Device::readSetArea
+struct ReadSetEntry {
+    uint8_t offset; //!< index of its first register in the area
+    uint8_t ct; //!< number of registers
+    uint8_t refs; //!< number of read sets using it; zero means free
+};
+
 class Device {
 protected:
     /// static copy of register definition
@@ -40,16 +54,45 @@ protected:
         memcpy_P(&reg,table+n,sizeof(Register));
     }
         
-    /// read set used by protocol - these are
-    /// SHARED BY ALL DEVICES
-    static uint8_t readSet[READSETS][READSETSIZE];
-    static uint8_t readSetCt[READSETS];
+    /// read set definitions, in a pool shared by all devices so
+    /// that devices with the same read set (such as all the DS
+    /// boards) only store it once. The registers of the definitions
+    /// are packed together at the start of the area, so a small set
+    /// only takes a few bytes; the rest of the area is free.
+    static uint8_t readSetArea[READSETAREA];
+    /// the definitions in the pool
+    static ReadSetEntry readSetPool[READSETENTRIES];
+    /// bytes of the area in use
+    static uint8_t readSetAreaUsed;
+    
+    /// the pool entry used by each of this device's read sets,
+    /// or NOREADSET
+    uint8_t readSetSlot[READSETS];
+    
+    /// stop using a read set's pool entry, and if nothing else uses
+    /// it, close up the gap its registers leave in the area
+    void releaseReadSet(uint8_t s){
+        uint8_t i = readSetSlot[s];
+        if(i==NOREADSET)return;
+        readSetSlot[s]=NOREADSET;
+        ReadSetEntry *e = readSetPool+i;
+        if(--e->refs)return;
+        uint8_t end = e->offset+e->ct;
+        memmove(readSetArea+e->offset,readSetArea+end,readSetAreaUsed-end);
+        readSetAreaUsed -= e->ct;
+        for(uint8_t j=0;j<READSETENTRIES;j++){
+            if(readSetPool[j].refs && readSetPool[j].offset>=end)
+                readSetPool[j].offset -= e->ct;
+        }
+    }
     
 public:
     uint8_t numRegs; //!< highest register number
     
     Device(MAYBEPROGMEM Register *r){
         table = r;
+        for(uint8_t i=0;i<READSETS;i++)
+            readSetSlot[i]=NOREADSET;
         // count registers - the terminator is a silly register size
         numRegs=0;
         for(;;){
@@ -59,20 +102,49 @@ public:
         }
     }
     
-    /// initialise the read set
-    static void clearReadSet(uint8_t s){
-        readSetCt[s]=0;
-    }
-    
-    /// add a register to the read set
-    static void addReadSet(uint8_t s,uint8_t r){
-        readSet[s][readSetCt[s]++]=r;
+    /// set one of this device's read sets, sharing the pool entry
+    /// of an identical read set if there is one. Returns zero, or
+    /// READSET_FAILED if the set is too large or READSET_POOLFULL if
+    /// there is no room in the pool, in which case the read set is
+    /// left empty. An empty set doesn't use the pool.
+    uint8_t setReadSet(uint8_t s,const uint8_t *regs,uint8_t ct){
+        if(s>=READSETS)return READSET_FAILED;
+        releaseReadSet(s);
+        if(ct>READSETSIZE)return READSET_FAILED;
+        if(!ct)return 0;
+        uint8_t freeSlot=NOREADSET;
+        for(uint8_t i=0;i<READSETENTRIES;i++){
+            ReadSetEntry *e = readSetPool+i;
+            if(!e->refs){
+                if(freeSlot==NOREADSET)freeSlot=i;
+            } else if(e->ct==ct && !memcmp(readSetArea+e->offset,regs,ct)){
+                e->refs++;
+                readSetSlot[s]=i;
+                return 0;
+            }
+        }
+        if(freeSlot==NOREADSET || readSetAreaUsed+ct>READSETAREA)
+            return READSET_POOLFULL;
+        ReadSetEntry *e = readSetPool+freeSlot;
+        e->offset = readSetAreaUsed;
+        e->ct = ct;
+        e->refs = 1;
+        memcpy(readSetArea+readSetAreaUsed,regs,ct);
+        readSetAreaUsed += ct;
+        readSetSlot[s]=freeSlot;
+        return 0;
     }
     
-    /// get s read set and its count
-    static const uint8_t *getReadSet(uint8_t s,uint8_t *ct){
-        *ct = readSetCt[s];
-        return readSet[s];
+    /// get one of this device's read sets and its count - an
+    /// unset read set is empty
+    const uint8_t *getReadSet(uint8_t s,uint8_t *ct){
+        uint8_t i = s<READSETS ? readSetSlot[s] : NOREADSET;
+        if(i==NOREADSET){
+            *ct=0;
+            return NULL;
+        }
+        *ct = readSetPool[i].ct;
+        return readSetArea+readSetPool[i].offset;
     }
     
     /// get the size of a register from the register
@@ -0,0 +1 @@
+../../common/framing.h
\ No newline at end of file
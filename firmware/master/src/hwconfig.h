@@ -13,6 +13,12 @@
 
 #define MASTER	1
 
+/// baud rate of the serial link to the PC, which must match the rate
+/// the PC connects at. At 16MHz, 250000, 500000 and 1000000 are exact;
+/// 115200 is 2% out, and faster standard rates are worse.
+
+#define SERIALBAUD 115200
+
 
 
 #endif /* __REGCONFIG_H */
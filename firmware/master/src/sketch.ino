@@ -14,6 +14,8 @@
 #include "i2c.h"
 #include "master.h"
 #include "rcRover.h"
+#include "framing.h"
+#include "commands.h"
 
 #ifndef cbi
 /// handy macro for clearing register bits (turning off pullups)
@@ -42,8 +44,9 @@ State state;
 RoverRCReceiver rc;
 
 
-uint8_t Device::readSet[READSETS][READSETSIZE];
-uint8_t Device::readSetCt[READSETS];
+uint8_t Device::readSetArea[READSETAREA];
+ReadSetEntry Device::readSetPool[READSETENTRIES];
+uint8_t Device::readSetAreaUsed;
 
 
 /// an array of slave devices, one for each I2C device. Some are DS devices
@@ -107,6 +110,10 @@ void halt(int n){
 class BinarySerialReader {
     int ct;
     uint8_t buf[256];
+    /// when the last byte of an unframed message arrived
+    unsigned long lastByteTime;
+    /// decodes frames into buf when framing is on
+    FrameReader frameReader;
     
 protected:
     /// takes command block sans first (count) character and parses it.
@@ -114,17 +121,50 @@ protected:
     /// command byte)
     virtual void process(int ct,uint8_t *p) = 0;
     
+    /// true if messages are framed (see framing.h) rather than
+    /// preceded by a count
+    bool framed;
+    /// sequence number of the frame being processed
+    uint8_t seq;
+    
+    /// switch framing on or off, discarding any partial message
+    void setFramed(bool f){
+        framed=f;
+        ct=0;
+        frameReader.reset();
+    }
+    
 public:
     /// initialise, zeroing the byte count - meaning we're waiting
     /// for length byte
-    BinarySerialReader(){
+    BinarySerialReader() : frameReader(buf,sizeof(buf)) {
         ct=0;
+        lastByteTime=0;
+        framed=false;
     }
     /// build up a buffer - once the length of the buffer is equal to
-    /// the first byte read, process it.
+    /// the first byte read, process it. If we are framed, process
+    /// each good frame as it completes; bad frames are dropped
+    /// and the PC will time out and carry on.
     void poll(){
         if(Serial.available()){
-            buf[ct++]=Serial.read();
+            uint8_t c = Serial.read();
+            if(framed){
+                if(frameReader.feed(c)>0 && frameReader.getLength() &&
+                   !rc.ready()){
+                    seq = frameReader.getSeq();
+                    process(frameReader.getLength()-1,
+                            frameReader.getMessage());
+                }
+                return;
+            }
+            // a partial message left by a PC which has gone away
+            // would put us out of step with the next one
+            unsigned long t = millis();
+            if(ct && t-lastByteTime > 50)
+                ct=0;
+            lastByteTime = t;
+            buf[ct++]=c;
             if(buf[0]==ct){
                 // send the buffer without the size byte,
                 // and the payload length (message size minus
@@ -144,12 +184,65 @@ int freeRam () {
   return (int) &v - (__brkval == 0 ? (int) &__heap_start : (int) __brkval); 
 }
 
+/// writes replies to the PC, either raw or as frames once
+/// framing has been switched on
+
+class ReplyWriter : public FrameWriter {
+protected:
+    virtual void emit(uint8_t c){
+        Serial.write(c);
+    }
+public:
+    /// true if replies are framed
+    bool framed;
+    
+    ReplyWriter(){
+        framed=false;
+    }
+    
+    void write(uint8_t c){
+        if(framed)
+            put(c);
+        else
+            Serial.write(c);
+    }
+    void write(const uint8_t *p,int n){
+        while(n--)
+            write(*p++);
+    }
+};
+
+ReplyWriter reply;
+
+extern int globalException;
+
 /// an implementation of BinarySerialReader which processes read and write messages
 /// and reads and writes SlaveDevice registers appropriately
 
 class MySerialReader : public BinarySerialReader {
+    /// framing to switch to once the reply has been sent: -1 for
+    /// no change, otherwise 0 or 1
+    int8_t newFraming;
+    
     /// process a set of register writes
     void dowrite(Device *s, uint8_t *p){
+        applywrites(s,p);
+        reply.write(0); // just to say it's done
+    }
+    
+    /// process a set of register writes followed by a read; the
+    /// read set index comes first, then the writes as for dowrite().
+    /// The response is the write status byte followed by the read.
+    void dowriteread(Device *s, uint8_t *p){
+        uint8_t set = *p++;
+        applywrites(s,p);
+        reply.write(0);
+        doread(s,&set);
+    }
+    
+    /// perform the register writes in a write command payload,
+    /// returning a pointer to the byte after them
+    uint8_t *applywrites(Device *s, uint8_t *p){
         int writes = *p++; // get the number of writes
         for(int i=0;i<writes;i++){ // for each write
             int r = *p++; // get the register number
@@ -162,7 +255,20 @@ class MySerialReader : public BinarySerialReader {
             s->writeRegister(r,v);
         }
         wdt_reset();
-        Serial.write((uint8_t)0); // just to say it's done
+        return p;
+    }
+    
+    /// process register writes on several devices: each device ID
+    /// is followed by writes as for dowrite(), and they are all
+    /// done before the single status byte is sent, so that the
+    /// slaves get their new values as close together as we can manage.
+    void domultiwrite(uint8_t *p,int ct){
+        uint8_t *end = p+ct;
+        while(p<end){
+            Device *s = getDeviceByAddr(*p++);
+            p = applywrites(s,p);
+        }
+        reply.write(0);
     }
     
     /// process a set of register reads
@@ -174,7 +280,7 @@ class MySerialReader : public BinarySerialReader {
         
         // get the read set itself
         uint8_t readSetCt;
-        const uint8_t *readSet = Device::getReadSet(set,&readSetCt);
+        const uint8_t *readSet = s->getReadSet(set,&readSetCt);
         
         for(int i=0;i<readSetCt;i++){ // for each read
             uint16_t v;
@@ -186,18 +292,79 @@ class MySerialReader : public BinarySerialReader {
                 buf[ct++]=v>>8; // store the top byte
         }
         wdt_reset();
-        Serial.write(buf,ct); // write the buffer
+        reply.write(buf,ct); // write the buffer
+    }
+    
+    /// process reads of several devices at once - each byte has the
+    /// device ID in the top four bits and the read set in the bottom
+    /// four, and the responses are sent one after another.
+    void domultiread(uint8_t *p,int ct){
+        for(int i=0;i<ct;i++){
+            uint8_t set = p[i]&0xf;
+            doread(getDeviceByAddr(p[i]>>4),&set);
+        }
     }
     
-    void doreadset(uint8_t *p,int ct){
+    /// set one of a device's read sets - each device has its own.
+    /// The response is the number of registers in the set, or
+    /// READSET_FAILED or READSET_POOLFULL if it couldn't be stored.
+    void doreadset(Device *s,uint8_t *p,int ct){
         uint8_t set = *p++;
         ct--; // subtracting 1 because of the readset index
-        Device::clearReadSet(set);
-        for(int i=0;i<ct;i++){
-            Device::addReadSet(set,*p++);
+        uint8_t err = s->setReadSet(set,p,ct);
+        wdt_reset();
+        reply.write(err ? err : ct);
+    }
+    
+    /// reply to a ping, so the PC can check we're running and healthy
+    /// without resetting us: PING_MAGIC, the version of this reply,
+    /// and health flags - PING_EXCEPTION if a slave has had an
+    /// exception, PING_STARTING if we've only just started and aren't
+    /// polling the slaves yet.
+    void doping(){
+        uint8_t health=0;
+        if(globalException)
+            health |= PING_EXCEPTION;
+        if(millis()<5000)
+            health |= PING_STARTING;
+        reply.write(PING_MAGIC);
+        reply.write(PING_VERSION);
+        reply.write(health);
+    }
+    
+    /// stop every motor as quickly as we can: write the exception
+    /// register of all the slaves at once with a general call, which
+    /// each takes as an exception on another slave and so stops its
+    /// motors. Each slave is then written in turn, in case any doesn't
+    /// answer general calls, before the response (1 byte, zero).
+    void doestop(){
+        uint8_t buf[3];
+        buf[0] = REG_EXCEPTIONDATA;
+        buf[1] = 100; // any value will do
+        buf[2] = 0;
+        Wire.beginTransmission(0); // the general call address
+        Wire.write(buf,3);
+        Wire.endTransmission();
+        for(int i=0;i<NUMSLAVES;i++){
+            wdt_reset();
+            slaves[i].writeRegister(REG_EXCEPTIONDATA,100);
         }
         wdt_reset();
-        Serial.write(ct);
+        reply.write(0);
+    }
+    
+    /// switch framing on (if the PC asks for the version we know) or
+    /// off (if it asks for version zero). The reply, sent in the old
+    /// mode, is the version now in use or zero.
+    void doframing(uint8_t *p,int ct){
+        uint8_t v = ct ? *p : 0;
+        if(v==FRAME_VERSION){
+            reply.write(v);
+            newFraming=1;
+        } else {
+            reply.write(0);
+            newFraming=0;
+        }
     }
     
 protected:
@@ -210,18 +377,46 @@ protected:
         // now get the device from the addr
         Device *s = getDeviceByAddr(id);
         
+        newFraming = -1;
+        if(framed)
+            reply.begin(seq); // the reply carries the request's sequence
+        
         switch(*p++&0xf){ // get the command and increment the pointer
-        case 2: //write command
+        case CMD_WRITE: //write command
             dowrite(s,p);
             break;
-        case 3: //read command
+        case CMD_READ: //read command
             doread(s,p);
             break;
-        case 4:// read set command
-            doreadset(p,ct);
+        case CMD_SETREADSET: // read set command
+            doreadset(s,p,ct);
+            break;
+        case CMD_MULTIREAD: // multiple read command
+            domultiread(p,ct);
+            break;
+        case CMD_WRITEREAD: // write then read command
+            dowriteread(s,p);
+            break;
+        case CMD_FRAMING: // framing command
+            doframing(p,ct);
+            break;
+        case CMD_PING: // ping command
+            doping();
+            break;
+        case CMD_MULTIWRITE: // multiple write command
+            domultiwrite(p,ct);
+            break;
+        case CMD_ESTOP: // emergency stop command
+            doestop();
             break;
         default:break;
         }
+        if(framed)
+            reply.end();
+        if(newFraming>=0){
+            setFramed(newFraming!=0);
+            reply.framed = framed;
+        }
         lastmsgtime = millis();
                 
     }
@@ -266,7 +461,7 @@ MyExceptionListener exceptionListener;
 
 void setup()
 {
-    Serial.begin(115200); // start the serial IO
+    Serial.begin(SERIALBAUD); // start the serial IO
     Serial.println("Starting");
     
     Wire.begin(); // join I2C bus as the master
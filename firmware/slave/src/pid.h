@@ -12,7 +12,9 @@
 
 #include "motor.h"
 
-/// PID controller wrapping a motor controller.
+/// PID controller wrapping a motor controller. The PC's simulator
+/// has a copy of this arithmetic (SimPID in pc/motorsim.h), so keep
+/// the two in step.
 class PIDController : public MotorController {
     /// previous actual value
     float prevActual;
@@ -77,6 +77,15 @@ void I2CSlave::poll(){
     // of them in NUMREGS polls
     static int i=0;
     
+    // a write to the exception register is how we are told to stop,
+    // so it doesn't wait its turn
+    if(regChanged[REG_EXCEPTIONDATA]){
+        for(I2CSlaveListener *s=headListener;s;s=s->next){
+            s->changeEvent(REG_EXCEPTIONDATA,regVals[REG_EXCEPTIONDATA]);
+        }
+        regChanged[REG_EXCEPTIONDATA]=0;
+    }
+    
     // inform any listeners of changes since last time.
     if(regChanged[i]){
         for(I2CSlaveListener *s=headListener;s;s=s->next){
@@ -118,6 +127,9 @@ void I2CSlave::init(int addr,const Register *r){
     }
     
     Wire.begin(addr);
+    // also answer the general call address, which the master uses
+    // to tell all the slaves to stop at once
+    TWAR |= 1;
 /*    
     cbi(PORTC,4); // disable internal pullups
     cbi(PORTC,5);
@@ -0,0 +1 @@
+../firmware/common/commands.h
\ No newline at end of file
@@ -0,0 +1,23 @@
+/**
+ * \file
+ * Serial port code which can't go in comms.h, because the kernel's
+ * termios2 definitions clash with the C library's termios.h.
+ */
+
+#include <asm/termbits.h>
+#include <asm/ioctls.h>
+#include <sys/ioctl.h>
+
+/// set the port to any baud rate, not just one of the Bxxxx constants.
+/// Returns -ve on failure.
+int setArbitraryBaud(int fd,int baudRate){
+    struct termios2 t;
+    if(ioctl(fd,TCGETS2,&t)<0)
+        return -1;
+    // BOTHER means "use the speeds in c_ispeed and c_ospeed"
+    t.c_cflag &= ~(CBAUD | (CBAUD<<IBSHIFT));
+    t.c_cflag |= BOTHER | (BOTHER<<IBSHIFT);
+    t.c_ispeed = baudRate;
+    t.c_ospeed = baudRate;
+    return ioctl(fd,TCSETS2,&t);
+}
@@ -19,26 +19,161 @@
 #include <sys/select.h>
 #include <unistd.h>
 #include <stdarg.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <poll.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <atomic>
 
 #include "status.h"
 
+/// the baud rate the master uses unless its SERIALBAUD is changed
+#define DEFAULTBAUD 115200
+
+/// set a port to any baud rate using termios2 (in comms.cpp)
+int setArbitraryBaud(int fd,int baudRate);
+
 /// simulated serial device, in case you want to test stuff. Needs to be backed
 /// by a real simulator object to fake the comms.
 
 class Simulator {
 public:
+    virtual ~Simulator(){}
     /// returns how many chars read, ct is max amount
     virtual int read(char *buf,int ct) = 0;
     /// return -ve on error (which should be never in a simulator)
     virtual int write(const char *s,int ct)=0;
     virtual void update()=0; //!< update any simulation
     virtual void poll()=0; //!< poll sim for commands
+    /// update any simulation without pausing (update() may sleep
+    /// to stop an in-process simulation running away)
+    virtual void tick(){
+        update();
+    }
+    /// the simulated master has been reset, so forget any
+    /// protocol state
+    virtual void reset(){}
 };
 
 
+/// a lock-free ring buffer of bytes with a single producer thread and
+/// a single consumer thread, used to pass encoded messages to and from
+/// the I/O thread. The producer and consumer can each get at the ring's
+/// memory directly, so the I/O thread can read and write the serial
+/// port straight into and out of it.
+
+class SPSCRing {
+    uint8_t *buf; //!< the data
+    unsigned int mask; //!< capacity-1; capacity is a power of two
+    std::atomic<unsigned int> head; //!< total bytes written, producer-owned
+    std::atomic<unsigned int> tail; //!< total bytes read, consumer-owned
+    
+public:
+    /// create a ring of the given capacity, which must be a power of 2
+    SPSCRing(unsigned int cap) : head(0),tail(0) {
+        buf = (uint8_t *)malloc(cap);
+        mask = cap-1;
+    }
+    ~SPSCRing(){
+        free(buf);
+    }
+    
+    /// discard everything - only safe when neither end is in use
+    void clear(){
+        tail.store(head.load());
+    }
+    
+    /// bytes waiting to be read (exact for the consumer, a lower
+    /// bound for anyone else)
+    int available(){
+        return head.load(std::memory_order_acquire)-
+              tail.load(std::memory_order_relaxed);
+    }
+    
+    /// producer: get a pointer to the contiguous free space, returning
+    /// its size. Follow with commitWrite().
+    int writeSpace(uint8_t **p){
+        unsigned int h = head.load(std::memory_order_relaxed);
+        unsigned int t = tail.load(std::memory_order_acquire);
+        unsigned int space = (mask+1)-(h-t);
+        unsigned int toEnd = (mask+1)-(h&mask);
+        *p = buf+(h&mask);
+        return space<toEnd ? space : toEnd;
+    }
+    
+    /// producer: publish n bytes written into the space from writeSpace()
+    void commitWrite(int n){
+        head.store(head.load(std::memory_order_relaxed)+n,
+                   std::memory_order_release);
+    }
+    
+    /// consumer: get a pointer to the contiguous data waiting,
+    /// returning its size. Follow with commitRead().
+    int readSpace(const uint8_t **p){
+        unsigned int t = tail.load(std::memory_order_relaxed);
+        unsigned int h = head.load(std::memory_order_acquire);
+        unsigned int avail = h-t;
+        unsigned int toEnd = (mask+1)-(t&mask);
+        *p = buf+(t&mask);
+        return avail<toEnd ? avail : toEnd;
+    }
+    
+    /// consumer: release n bytes read from the space from readSpace()
+    void commitRead(int n){
+        tail.store(tail.load(std::memory_order_relaxed)+n,
+                   std::memory_order_release);
+    }
+    
+    /// producer: copy in as much as will fit, returning the count
+    int write(const uint8_t *p,int n){
+        int done=0;
+        while(done<n){
+            uint8_t *q;
+            int sp = writeSpace(&q);
+            if(!sp)break;
+            if(sp>n-done)sp=n-done;
+            memcpy(q,p+done,sp);
+            commitWrite(sp);
+            done+=sp;
+        }
+        return done;
+    }
+    
+    /// consumer: copy out up to n bytes, returning the count
+    int read(uint8_t *p,int n){
+        int done=0;
+        while(done<n){
+            const uint8_t *q;
+            int sp = readSpace(&q);
+            if(!sp)break;
+            if(sp>n-done)sp=n-done;
+            memcpy(p+done,q,sp);
+            commitRead(sp);
+            done+=sp;
+        }
+        return done;
+    }
+};
+
+/// size of the I/O thread's rings, which must be a power of two
+#define IORINGSIZE 4096
+
+/// size of the receive buffer used when there is no I/O thread
+#define RXBUFSIZE 1024
+
+static_assert(IORINGSIZE>=RXBUFSIZE,"the I/O ring must hold a full receive buffer");
+
 /// serial communications class. Can handle both binary and text comms.
 /// The protocol, however, always starts up in text mode and waits for
 /// the string "Ready" on a line by itself (this is done in connect())
+///
+/// Optionally, once connected, the port can be handed over to an I/O
+/// thread with startIOThread(). After that, write() just queues the
+/// data for the thread and returns, and read() takes data the thread
+/// has already read, so callers only wait on the port when they
+/// actually need a reply.
 
 
 class SerialComms : public StatusObservable {
@@ -47,6 +182,116 @@ class SerialComms : public StatusObservable {
     FILE *log;
     Simulator *sim; //!< null if not simulated, or else a pointer to a serial simulator
     
+    /// received data, read from the port in bulk and handed out
+    /// by peek() and consume(). The port is read RXBUFSIZE bytes at a
+    /// time, but the buffer must also take everything left in the
+    /// I/O thread's ring when it stops.
+    uint8_t rxBuf[IORINGSIZE];
+    int rxPos; //!< index of the next byte to hand out
+    int rxLen; //!< bytes in rxBuf
+    
+    SPSCRing txRing; //!< data waiting for the I/O thread to write
+    SPSCRing rxRing; //!< data the I/O thread has read
+    int txEvent; //!< eventfd signalled when there's data in txRing
+    int rxEvent; //!< eventfd signalled when there's data in rxRing
+    pthread_t ioThread; //!< the I/O thread
+    bool ioThreadActive; //!< true if the I/O thread owns the port
+    std::atomic<bool> ioRunning; //!< cleared to stop the I/O thread
+    std::atomic<int> ioError; //!< errno of a failure in the I/O thread
+    
+    /// signal an eventfd
+    static void signalEvent(int e){
+        uint64_t v=1;
+        if(::write(e,&v,sizeof(v))<0){} // can only fail if it's saturated
+    }
+    
+    /// clear an eventfd
+    static void drainEvent(int e){
+        uint64_t v;
+        if(::read(e,&v,sizeof(v))<0){} // nonblocking, so may not be set
+    }
+    
+    static void *ioThreadFunc(void *p){
+        ((SerialComms *)p)->ioLoop();
+        return NULL;
+    }
+    
+    /// the I/O thread: move data between the port and the rings
+    /// until told to stop or something goes wrong.
+    void ioLoop(){
+        while(ioRunning.load()){
+            uint8_t *wp;
+            const uint8_t *rp;
+            int rxSpace = rxRing.writeSpace(&wp);
+            int txWaiting = txRing.readSpace(&rp);
+            
+            pollfd fds[2];
+            fds[0].fd = fd;
+            fds[0].events = (rxSpace?POLLIN:0) | (txWaiting?POLLOUT:0);
+            fds[1].fd = txEvent;
+            fds[1].events = POLLIN;
+            // the timeout is just so we notice being stopped
+            int rv = ::poll(fds,2,100);
+            if(rv<0){
+                if(errno==EINTR)continue;
+                ioError.store(errno);
+                break;
+            }
+            if(fds[1].revents & POLLIN)
+                drainEvent(txEvent);
+            if(fds[0].revents & (POLLERR|POLLHUP|POLLNVAL)){
+                ioError.store(EIO);
+                signalEvent(rxEvent); // wake the reader to see it
+                break;
+            }
+            if(fds[0].revents & POLLIN){
+                int n = ::read(fd,wp,rxSpace);
+                if(n>0){
+                    rxRing.commitWrite(n);
+                    signalEvent(rxEvent);
+                } else if(n<0 && errno!=EAGAIN && errno!=EINTR){
+                    ioError.store(errno);
+                    signalEvent(rxEvent);
+                    break;
+                }
+            }
+            // write anything waiting, including anything which arrived
+            // while we were polling
+            txWaiting = txRing.readSpace(&rp);
+            if(txWaiting){
+                int n = ::write(fd,rp,txWaiting);
+                if(n>0)
+                    txRing.commitRead(n);
+                else if(n<0 && errno!=EAGAIN && errno!=EINTR){
+                    ioError.store(errno);
+                    signalEvent(rxEvent);
+                    break;
+                }
+            }
+        }
+    }
+    
+    /// milliseconds from now until a deadline, or zero if it has passed
+    static int msUntil(const timespec &d){
+        timespec now;
+        clock_gettime(CLOCK_MONOTONIC,&now);
+        long ms = (d.tv_sec-now.tv_sec)*1000L +
+              (d.tv_nsec-now.tv_nsec)/1000000L;
+        return ms<0 ? 0 : (int)ms;
+    }
+    
+    /// check for a failure in the I/O thread, setting the error status
+    /// if there was one
+    bool checkIOError(){
+        int e = ioError.load();
+        if(e){
+            setStatus(ERROR);
+            notifyMessage("I/O thread failed: %s",strerror(e));
+            return true;
+        }
+        return false;
+    }
+    
     static int getBaudEnum(int baudRate){
         switch(baudRate){
         case 9600:
@@ -59,6 +304,16 @@ class SerialComms : public StatusObservable {
             return B57600;
         case 115200:
             return B115200;
+        case 230400:
+            return B230400;
+        case 460800:
+            return B460800;
+        case 500000:
+            return B500000;
+        case 921600:
+            return B921600;
+        case 1000000:
+            return B1000000;
         default:
             return -1;
         }
@@ -101,6 +356,7 @@ public:
     /// connect to a simulation rather than a port.
     void simConnect(Simulator *s){
         sim = s;
+        rxPos=rxLen=0;
     }
     
     
@@ -109,8 +365,11 @@ public:
     /// status flags to indicate success. Waits for the other end to
     /// reply with "Ready" on a line by itself - after that you're free
     /// to use text or binary.
+    /// If reset is false, the Arduino is not reset and we don't wait
+    /// for "Ready": the master is assumed to be running already,
+    /// and the caller should check it is (see SlaveProtocol::ping()).
     
-    void connect(const char *dev, int baudRate){
+    void connect(const char *dev, int baudRate,bool reset=true){
         int br;
         struct timespec qqq={0,10000000};
         
@@ -127,14 +386,16 @@ public:
             goto error;
         }
         
-        // drop DTR to reset the Arduino! Ugh.
-        int st;
-        ioctl(fd, TIOCMGET, &st);
-        st &= ~TIOCM_DTR;
-        ioctl(fd, TIOCMSET, &st);
-        nanosleep(&qqq,NULL);
-        st |= TIOCM_DTR;
-        ioctl(fd, TIOCMSET, &st);
+        if(reset){
+            // drop DTR to reset the Arduino! Ugh.
+            int st;
+            ioctl(fd, TIOCMGET, &st);
+            st &= ~TIOCM_DTR;
+            ioctl(fd, TIOCMSET, &st);
+            nanosleep(&qqq,NULL);
+            st |= TIOCM_DTR;
+            ioctl(fd, TIOCMSET, &st);
+        }
         
         if(fcntl(fd,F_SETFL,0)<0){
             perror("cannot fcntl: ");
@@ -180,7 +441,11 @@ public:
         // no output processing, force 8 bit input
         //
         options.c_cflag &= ~(CSIZE | PARENB);
-        options.c_cflag |= CS8|CREAD|CLOCAL|HUPCL;
+        options.c_cflag |= CS8|CREAD|CLOCAL;
+        // Don't drop DTR on close, which would reset the Arduino when
+        // the port is next opened - we reset it explicitly above
+        // if we want to, and this lets the next connection skip it.
+        options.c_cflag &= ~HUPCL;
         
         // Raw mode.
         // One input byte is enough to return from read()
@@ -194,11 +459,11 @@ public:
         // Communication speed (simple version, using the predefined
         // constants)
         //
+        // rates without a constant (such as 250000, which the
+        // Arduino can do exactly) are set with termios2 below
         br = getBaudEnum(baudRate);
-        if(br<0){
-            notifyMessage("unsupported baud rate: %d\n",baudRate);
-            goto error;
-        }
+        if(br<0)
+            br = B38400;
         
         if(cfsetispeed(&options, br) < 0 || cfsetospeed(&options, br) < 0) {
             notifyMessage("cannot set baud rate: ",strerror(errno));
@@ -207,10 +472,28 @@ public:
         //
         // Finally, apply the configuration
         //
-        if(tcsetattr(fd, TCSAFLUSH, &options) < 0){
+        // (flushing without a reset would make the simulator's
+        // PtyLink think we had reset it, so we discard input
+        // by hand below instead)
+        if(tcsetattr(fd, reset?TCSAFLUSH:TCSANOW, &options) < 0){
             notifyMessage("cannot set attrs: ",strerror(errno));
             goto error;
         }
+        if(getBaudEnum(baudRate)<0 && setArbitraryBaud(fd,baudRate)<0){
+            notifyMessage("unsupported baud rate: %d: %s",baudRate,
+                          strerror(errno));
+            goto error;
+        }
+        
+        if(!reset){
+            // no reset, so no "Ready" and no need to wait; just
+            // throw away anything left from an earlier connection
+            discardInput();
+            setStatus(CONNECTED);
+            notifyMessage("core connected without reset");
+            setTimeout(1,0);
+            return;
+        }
         
         setStatus(CONNECTING);
         notifyMessage("core connected");
@@ -259,9 +542,78 @@ error:
         timeout.tv_usec = usec;
     }
     
+    /// get the timeout
+    timeval getTimeout(){
+        return timeout;
+    }
+    
+    
+    /// hand the port over to a dedicated I/O thread, which will
+    /// read and write it through lock-free rings. Returns false if
+    /// there's no port (or we're simulated, when there's no need.)
+    bool startIOThread(){
+        if(ioThreadActive)return true;
+        if(sim || fd<0)return false;
+        txRing.clear();
+        rxRing.clear();
+        // anything read but not yet used goes to the thread's ring,
+        // which is where peek() will look for it
+        rxRing.write(rxBuf+rxPos,rxLen-rxPos);
+        rxPos=rxLen=0;
+        ioError.store(0);
+        txEvent = eventfd(0,EFD_NONBLOCK);
+        rxEvent = eventfd(0,EFD_NONBLOCK);
+        if(txEvent<0 || rxEvent<0){
+            notifyMessage("cannot create eventfd: %s",strerror(errno));
+            closeEvents();
+            return false;
+        }
+        // the thread never blocks on the port itself
+        fcntl(fd,F_SETFL,O_NONBLOCK);
+        ioRunning.store(true);
+        if(pthread_create(&ioThread,NULL,ioThreadFunc,this)){
+            notifyMessage("cannot create I/O thread");
+            fcntl(fd,F_SETFL,0);
+            closeEvents();
+            return false;
+        }
+        ioThreadActive=true;
+        return true;
+    }
+    
+    /// stop the I/O thread, after which the port is used directly
+    /// again. Anything still queued for writing is discarded.
+    void stopIOThread(){
+        if(!ioThreadActive)return;
+        ioRunning.store(false);
+        signalEvent(txEvent);
+        pthread_join(ioThread,NULL);
+        ioThreadActive=false;
+        // keep everything the thread had read but we hadn't, or the
+        // replies to come will be out of step
+        rxPos=0;
+        rxLen=rxRing.read(rxBuf,IORINGSIZE);
+        closeEvents();
+        if(fd>=0)fcntl(fd,F_SETFL,0);
+    }
+    
+    /// true if the I/O thread owns the port
+    bool isIOThreadRunning(){
+        return ioThreadActive;
+    }
+    
+private:
+    void closeEvents(){
+        if(txEvent>=0)close(txEvent);
+        if(rxEvent>=0)close(rxEvent);
+        txEvent=rxEvent=-1;
+    }
     
+public:
     /// disconnect and clear status
     void disconnect(){
+        stopIOThread();
+        rxPos=rxLen=0;
         if(sim){
             sim = NULL;
         }
@@ -276,10 +628,15 @@ error:
         }
     }        
     
-    SerialComms() {
+    SerialComms() : txRing(IORINGSIZE),rxRing(IORINGSIZE) {
         log=NULL;
         fd=-1;
         sim=NULL;
+        txEvent=rxEvent=-1;
+        rxPos=rxLen=0;
+        ioThreadActive=false;
+        ioRunning.store(false);
+        ioError.store(0);
     }
     
     ~SerialComms(){
@@ -292,7 +649,19 @@ error:
             sim->write(s,ct);
             return 0;
         }
-        if(isReady()){
+        if(isReady() && ioThreadActive){
+            // queue it for the I/O thread, waiting if the ring is full
+            int done=0;
+            while(done<ct){
+                if(checkIOError())return -1;
+                int n = txRing.write((const uint8_t *)s+done,ct-done);
+                if(n)
+                    signalEvent(txEvent);
+                else
+                    sched_yield();
+                done+=n;
+            }
+        } else if(isReady()){
             int rv = ::write(fd,s,ct);
             if(rv!=ct){
                 notifyMessage("not enough bytes in write (%d!=%d)",rv,ct);
@@ -311,49 +680,147 @@ error:
         clrStatus(TIMEOUT);
     }
     
+    /// throw away everything which has been received but not read,
+    /// without waiting for more - after a timeout, say, when anything
+    /// which has arrived is a reply we have given up on.
+    void discardInput(){
+        rxPos=rxLen=0;
+        if(sim){
+            while(sim->read((char *)rxBuf,RXBUFSIZE)>0){}
+        } else if(ioThreadActive){
+            rxRing.commitRead(rxRing.available());
+            drainEvent(rxEvent);
+        } else if(fd>=0){
+            for(;;){
+                pollfd pfd;
+                pfd.fd = fd;
+                pfd.events = POLLIN;
+                if(::poll(&pfd,1,0)<=0 || ::read(fd,rxBuf,RXBUFSIZE)<=0)
+                    break;
+            }
+        }
+    }
+    
     /// is the comms module in a timeout?
     bool isTimeout(){
         return 
               (getStatus()&TIMEOUT) != 0;
     }
     
-    /// raw read - returns -1 on timeout, and sets the TIMEOUT status. Also returns -1 if called
-    /// when disconnected, and if an error occurs. Does not check for connected status, just for valid fd.
+    /// get the time by which a read starting now must finish
+    timespec getDeadline(){
+        timespec t;
+        clock_gettime(CLOCK_MONOTONIC,&t);
+        t.tv_sec += timeout.tv_sec;
+        t.tv_nsec += timeout.tv_usec*1000L;
+        if(t.tv_nsec>=1000000000L){
+            t.tv_sec++;
+            t.tv_nsec-=1000000000L;
+        }
+        return t;
+    }
     
-    int read(char *buf,int ct){
+    /// wait until there is received data or the deadline passes,
+    /// and return a pointer to the data and how much there is. The
+    /// data is left in place until consume() is called, so lines and
+    /// frames can be taken from it without copying. Returns -ve and
+    /// sets the TIMEOUT status on timeout; also returns -ve if called
+    /// when disconnected, and if an error occurs.
+    int peek(const uint8_t **p,const timespec &deadline){
+        // don't clear timeout - if a timeout occurred we'll be out of sync.            
+        //            clrStatus(TIMEOUT); 
+        clrStatus(ERROR);
+        
+        if(rxPos<rxLen){ // data left over from the last fill
+            *p = rxBuf+rxPos;
+            return rxLen-rxPos;
+        }
+        rxPos=rxLen=0;
+        
         if(sim){
-            return sim->read(buf,ct);
+            // the simulator replies as soon as it is written to,
+            // so if there's nothing now there never will be.
+            rxLen = sim->read((char *)rxBuf,RXBUFSIZE);
+            if(!rxLen){
+                setStatus(TIMEOUT);
+                notifyMessage("timeout in read");
+                return -2;
+            }
+            *p = rxBuf;
+            return rxLen;
         }
-        if(fd>=0){
-            fd_set set;
-            FD_ZERO(&set);
-            FD_SET(fd,&set);
-            
-            // don't clear timeout - if a timeout occurred we'll be out of sync.            
-            //            clrStatus(TIMEOUT); 
-            clrStatus(ERROR);
-            
-            timeval to = timeout; // have to copy this!
-            int rv = select(fd+1,&set,NULL,NULL,&to);
-            
+        
+        for(;;){
+            pollfd pfd;
+            if(ioThreadActive){
+                int n = rxRing.readSpace(p);
+                if(n)return n;
+                if(checkIOError())return -3;
+                // wait for the I/O thread to say there's more
+                pfd.fd = rxEvent;
+            } else if(fd>=0){
+                pfd.fd = fd;
+            } else {
+                setStatus(ERROR);
+                return -1;
+            }
+            pfd.events = POLLIN;
+            int rv = ::poll(&pfd,1,msUntil(deadline));
             if(!rv){
                 setStatus(TIMEOUT);
                 notifyMessage("timeout in read");
                 return -2;
-            } else if(rv<0) {
+            } else if(rv<0){
+                if(errno==EINTR)continue;
                 setStatus(ERROR);
-                notifyMessage("-ve value from select in read");
+                notifyMessage("-ve value from poll in read");
+                return -3;
+            }
+            if(ioThreadActive){
+                drainEvent(rxEvent);
+                continue;
+            }
+            // take everything the kernel has, in one go
+            int n = ::read(fd,rxBuf,RXBUFSIZE);
+            if(n>0){
+                rxLen = n;
+                *p = rxBuf;
+                return n;
+            }
+            if(n==0 || (errno!=EINTR && errno!=EAGAIN)){
+                setStatus(ERROR);
+                notifyMessage("error in read");
                 return -3;
             }
-            else 
-                return ::read(fd,buf,ct);
-        }
-        else {
-            setStatus(ERROR);
-            return -1;
         }
     }
     
+    /// peek with a deadline of the timeout from now
+    int peek(const uint8_t **p){
+        return peek(p,getDeadline());
+    }
+    
+    /// discard n bytes of the data returned by peek()
+    void consume(int n){
+        if(rxPos<rxLen)
+            rxPos+=n;
+        else if(ioThreadActive)
+            rxRing.commitRead(n);
+    }
+    
+    /// raw read - returns -1 on timeout, and sets the TIMEOUT status. Also returns -1 if called
+    /// when disconnected, and if an error occurs. Does not check for connected status, just for valid fd.
+    
+    int read(char *buf,int ct){
+        const uint8_t *p;
+        int n = peek(&p);
+        if(n<0)return n;
+        if(n>ct)n=ct;
+        memcpy(buf,p,n);
+        consume(n);
+        return n;
+    }
+    
     /// return true if we are able to read and write
     bool isReady(){
         return sim || ( fd>=0 && !isError() && !(getStatus()&CONNECTING));
@@ -381,25 +848,32 @@ error:
     /// used to establish connected status.
     int readLine(char *buf,int maxlen){
         int n=0;
-        char c;
         
         if(fd>=0){
-            
-            while(n<maxlen){
-                int ct = read(&c,1);
+            timespec deadline = getDeadline();
+            bool done=false;
+            while(!done && n<maxlen){
+                const uint8_t *p;
+                int ct = peek(&p,deadline);
                 if(ct<0){
                     // if a timeout occurs, return -1 and reset the count
                     n=0;
                     return -1;
                 }
-                if(ct>0){
+                // take as much of the line as we have
+                int i;
+                for(i=0;i<ct && n<maxlen;i++){
+                    char c = p[i];
                     if(c==10){
                         buf[n++]=0;
+                        done=true;
+                        i++;
                         break;
                     } else if(c!=13){
                         buf[n++]=c;
                     }
                 }
+                consume(i);
             }
             if(log)fprintf(log,"read line *%s*\n",buf);
             return n;
@@ -19,18 +19,21 @@ class DriveMotor : public Motor{
     MotorParams params;
 public:
     /// constructor, specifying the slave we're talking to
-    DriveMotor(SlaveDevice *s):Motor(s){}
+    DriveMotor(SlaveDevice *s):Motor(s){
+        // the slave zeroes this in an exception
+        s->setVolatile(REGDS_DRIVE_REQSPEED);
+    }
     
     virtual void sendParams(){
         slave->startWrites();
-        slave->writeFloat(REGDS_DRIVE_PGAIN,params.pGain);
-        slave->writeFloat(REGDS_DRIVE_IGAIN,params.iGain);
-        slave->writeFloat(REGDS_DRIVE_DGAIN,params.dGain);
-        slave->writeFloat(REGDS_DRIVE_INTEGRALCAP,params.iCap);
-        slave->writeFloat(REGDS_DRIVE_INTEGRALDECAY,params.iDecay);
-        slave->writeFloat(REGDS_DRIVE_OVERCURRENTTHRESH,params.overCurrentThresh);
-        slave->writeFloat(REGDS_DRIVE_STALLCHECK,params.stallCheck);
-        slave->writeFloat(REGDS_DRIVE_DEADZONE,params.deadZone);
+        slave->write<RegDS<REGDS_DRIVE_PGAIN>>(params.pGain);
+        slave->write<RegDS<REGDS_DRIVE_IGAIN>>(params.iGain);
+        slave->write<RegDS<REGDS_DRIVE_DGAIN>>(params.dGain);
+        slave->write<RegDS<REGDS_DRIVE_INTEGRALCAP>>(params.iCap);
+        slave->write<RegDS<REGDS_DRIVE_INTEGRALDECAY>>(params.iDecay);
+        slave->write<RegDS<REGDS_DRIVE_OVERCURRENTTHRESH>>(params.overCurrentThresh);
+        slave->write<RegDS<REGDS_DRIVE_STALLCHECK>>(params.stallCheck);
+        slave->write<RegDS<REGDS_DRIVE_DEADZONE>>(params.deadZone);
         slave->endWrites();
     }
     
@@ -38,7 +41,7 @@ public:
     /// kind of reset recently, or this'll overwrite it.
     virtual void resetOdometer(){
         slave->startWrites();
-        slave->writeInt(REG_RESET,RESET_ODO);
+        slave->writeInt<RegDS<REG_RESET>>(RESET_ODO);
         slave->endWrites();
     }
         
@@ -48,11 +51,9 @@ public:
         return &params;
     }
     
-    /// send a new speed request
-    virtual void setRequired(float speed){
-        slave->startWrites();
-        slave->writeFloat(REGDS_DRIVE_REQSPEED,speed);
-        slave->endWrites();
+    /// add a new speed request to the current block of writes
+    virtual void writeRequired(float speed){
+        slave->write<RegDS<REGDS_DRIVE_REQSPEED>>(speed);
         required = speed;
     }
 };
@@ -0,0 +1,173 @@
+/**
+ * \file
+ * Measures how long an emergency stop takes against the simulator,
+ * served on a pseudo-terminal and paced at a baud rate so that the
+ * serial timings are realistic. The rover's acquisition thread runs
+ * throughout, as it would in a control program, and each stop is
+ * made at a random point in its cycle. The single emergency stop
+ * command is compared with the old way of stopping, which reset and
+ * sent every motor's parameters and required value in turn.
+ *
+ * Three times are shown for each stop: until every simulated slave
+ * is in an exception, until the master's acknowledgement has been
+ * read, and until an update shows every slave stopped. A stop is
+ * written while the update in progress is still reading its reply, so
+ * the slaves stop well before the acknowledgement, which comes after
+ * that reply.
+ *
+ * With -o the simulated master behaves like firmware which predates
+ * the emergency stop, framing and multiple write commands, so the
+ * library's fallback is measured instead. Either way, the exit status
+ * is non-zero unless every stop left all the slaves in an exception.
+ *
+ * Usage: estopbench [-o] [baud [runs]]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "rover.h"
+
+/// wait for an update which shows every slave in an exception,
+/// returning the time it was published or zero if none arrives
+/// within a second.
+static double waitForStopped(Rover *r,double since){
+    RoverSnapshot s;
+    uint32_t count = r->getSnapshotCount();
+    while(getMonotonicTime()-since < 1){
+        if(r->getSnapshotCount()!=count){
+            count = r->getSnapshotCount();
+            double t = getMonotonicTime();
+            r->getSnapshot(s);
+            bool stopped=true;
+            for(int i=0;i<9;i++){
+                if(!(s.status[i] & ST_EXCEPTION))
+                    stopped=false;
+            }
+            // the reads must have been made after the stop was sent
+            if(stopped && s.telemetry.received[DRIVE][0]>since)
+                return t;
+        }
+        usleep(100);
+    }
+    return 0;
+}
+
+/// get the rover moving again, and wait a random fraction of the
+/// acquisition period so that we stop at different points in it
+static void restart(Rover *r,double period){
+    r->lock();
+    r->resetExceptions();
+    // one at a time, since an old master can't do a multiple write
+    for(int i=1;i<=6;i++)
+        r->getDrive(i)->setRequired(100);
+    r->unlock();
+    usleep(50000+rand()%(int)(period*1e6));
+}
+
+/// the old emergency stop: a pause for any data, then each motor's
+/// parameters reset and its required value zeroed, one at a time
+static void legacyStop(Rover *r){
+    r->lock();
+    usleep(180000L);
+    r->setDeferWrites(false);
+    for(int i=1;i<=6;i++){
+        for(int t=0;t<3;t++){
+            MotorParams *p = r->getMotor(i,t)->getParams();
+            p->reset();
+            p->overCurrentThresh = 200;
+            r->getMotor(i,t)->sendParams();
+            r->getMotor(i,t)->setRequired(0);
+        }
+    }
+    r->unlock();
+}
+
+int main(int argc,char *argv[]){
+    bool old = argc>1 && !strcmp(argv[1],"-o");
+    if(old){
+        argc--;
+        argv++;
+    }
+    int baud = argc>1 ? atoi(argv[1]) : DEFAULTBAUD;
+    int runs = argc>2 ? atoi(argv[2]) : 50;
+    double period = 0.01;
+
+    RoverSimulator *sim = new RoverSimulator();
+    if(old){
+        sim->setCommandKnown(CMD_ESTOP,false);
+        sim->setCommandKnown(CMD_FRAMING,false);
+        sim->setCommandKnown(CMD_MULTIWRITE,false);
+    }
+    PtyLink link(sim);
+    link.setBaudRate(baud);
+    const char *dev = link.start();
+    if(!dev){
+        perror("cannot create pseudo-terminal");
+        return 1;
+    }
+
+    Rover r;
+    if(!r.init(dev,7,baud)){
+        fprintf(stderr,"cannot connect to the simulator\n");
+        return 1;
+    }
+    r.calibrate();
+    r.startAcquisition(period);
+
+    // times from the stop being asked for until every simulated slave
+    // is in an exception, until the master has acknowledged it, and
+    // until an update shows every slave stopped
+    LoopHistogram stopped,acked,confirmed,legacy;
+    stopped.setRange(0.05);
+    acked.setRange(0.05);
+    confirmed.setRange(0.05);
+    legacy.setRange(1);
+    int failures=0;
+
+    for(int i=0;i<runs;i++){
+        restart(&r,period);
+        double t0 = getMonotonicTime();
+        try {
+            r.emergencyStop();
+        } catch(RoverException &e){
+            fprintf(stderr,"emergency stop failed: %s\n",e.what());
+            failures++;
+            continue;
+        }
+        acked.add(getMonotonicTime()-t0);
+        // the master replies once it has stopped the slaves
+        if(sim->getAllStoppedTime()>t0)
+            stopped.add(sim->getAllStoppedTime()-t0);
+        else
+            failures++;
+        double t = waitForStopped(&r,t0);
+        if(t)
+            confirmed.add(t-t0);
+        else
+            failures++;
+    }
+
+    // the old way is slow, so fewer runs
+    for(int i=0;i<runs/10+1;i++){
+        restart(&r,period);
+        double t0 = getMonotonicTime();
+        try {
+            legacyStop(&r);
+        } catch(RoverException &e){
+            fprintf(stderr,"old stop failed: %s\n",e.what());
+            failures++;
+            continue;
+        }
+        legacy.add(getMonotonicTime()-t0);
+    }
+
+    r.stopAcquisition();
+
+    printf("%d baud, acquisition every %.0f ms, %s master, %d failures\n",
+           baud,period*1e3,old?"old":"current",failures);
+    stopped.printSummary(stdout,"stopped");
+    acked.printSummary(stdout,"acked");
+    confirmed.printSummary(stdout,"seen");
+    legacy.printSummary(stdout,"old");
+    return failures ? 1 : 0;
+}
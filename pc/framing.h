@@ -0,0 +1 @@
+../firmware/common/framing.h
\ No newline at end of file
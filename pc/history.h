@@ -0,0 +1,201 @@
+/**
+ * \file
+ * Recent history of the motor data, kept in a ring buffer for each
+ * field of each motor so that trends can be queried without every
+ * user keeping its own copies.
+ */
+
+#ifndef __HISTORY_H
+#define __HISTORY_H
+
+#include <float.h>
+#include "motordata.h"
+
+/// how many samples of each field of each motor are kept - at 30
+/// updates a second this is over half a minute
+#define HISTORYSIZE 1024
+
+/// fields whose history is kept, for TelemetryHistory::get()
+#define HIST_ACTUAL 0 //!< actual speed or position
+#define HIST_CURRENT 1 //!< motor current
+#define HIST_ERROR 2 //!< PID error
+#define HIST_CONTROL 3 //!< PID control output
+/// number of fields whose history is kept
+#define HISTFIELDS 4
+
+/// statistics over the samples in a window
+struct HistoryStats {
+    int n; //!< number of samples in the window
+    float min; //!< the smallest value
+    float max; //!< the largest value
+    float mean; //!< the mean value
+    float variance; //!< the (population) variance of the values
+};
+
+/// a fixed size ring buffer of timestamped values - when it is full,
+/// each new value replaces the oldest. The times and values are kept
+/// in separate arrays so that the queries run through them in order.
+
+class SampleRing {
+    /// monotonic time of each sample
+    double times[HISTORYSIZE];
+    /// value of each sample
+    float vals[HISTORYSIZE];
+    /// index at which the next sample goes
+    int head;
+    /// number of samples held
+    int ct;
+
+    /// the index of the nth newest sample
+    int idx(int n) const {
+        return (head-1-n+HISTORYSIZE)%HISTORYSIZE;
+    }
+
+public:
+    SampleRing(){
+        clear();
+    }
+
+    /// forget all the samples
+    void clear(){
+        head=ct=0;
+    }
+
+    /// add a sample. Samples must be added in time order; one which
+    /// is no newer than the last (the same data seen by a later
+    /// update, for instance) is ignored.
+    void add(double t,float v){
+        if(ct && t<=times[idx(0)])
+            return;
+        times[head]=t;
+        vals[head]=v;
+        head = (head+1)%HISTORYSIZE;
+        if(ct<HISTORYSIZE)ct++;
+    }
+
+    /// the number of samples held
+    int size() const {
+        return ct;
+    }
+
+    /// the number of samples taken since a given monotonic time
+    int countSince(double since) const {
+        int n=0;
+        while(n<ct && times[idx(n)]>=since)
+            n++;
+        return n;
+    }
+
+    /// get statistics for the samples taken since a given monotonic
+    /// time; if there are none, n is zero and the rest is undefined.
+    void getStats(double since,HistoryStats &s) const {
+        int n = countSince(since);
+        s.n = n;
+        if(!n)return;
+        // the samples are in at most two runs in the arrays
+        int start = (head-n+HISTORYSIZE)%HISTORYSIZE;
+        int run1 = n<HISTORYSIZE-start ? n : HISTORYSIZE-start;
+        float mn=FLT_MAX,mx=-FLT_MAX;
+        double sum=0,sumsq=0;
+        for(int i=start;i<start+run1;i++){
+            float v = vals[i];
+            if(v<mn)mn=v;
+            if(v>mx)mx=v;
+            sum+=v;
+            sumsq+=(double)v*v;
+        }
+        for(int i=0;i<n-run1;i++){
+            float v = vals[i];
+            if(v<mn)mn=v;
+            if(v>mx)mx=v;
+            sum+=v;
+            sumsq+=(double)v*v;
+        }
+        double mean = sum/n;
+        double var = sumsq/n-mean*mean;
+        s.min=mn;
+        s.max=mx;
+        s.mean=(float)mean;
+        s.variance = var<0 ? 0 : (float)var; // rounding
+    }
+
+    /// copy up to the last n samples, oldest first, returning how
+    /// many were copied. The times may be NULL.
+    int getLast(int n,float *v,double *t=NULL) const {
+        if(n>ct)n=ct;
+        for(int i=0;i<n;i++){
+            int j = idx(n-1-i);
+            v[i]=vals[j];
+            if(t)t[i]=times[j];
+        }
+        return n;
+    }
+
+    /// get the nth newest value (0 is the newest), which must exist
+    float getValue(int n) const {
+        return vals[idx(n)];
+    }
+
+    /// get the time of the nth newest value
+    double getTime(int n) const {
+        return times[idx(n)];
+    }
+};
+
+/// the history of each field of every motor, filled in by
+/// Rover::update().
+
+class TelemetryHistory {
+    /// the rings, indexed by wheel (0-5), motor type and field
+    SampleRing rings[6][3][HISTFIELDS];
+
+public:
+    /// the data class each field is read in
+    static int getFieldClass(int field){
+        static const int classes[HISTFIELDS]={
+            DATA_ACTUAL,DATA_CURRENT,DATA_PID,DATA_PID
+        };
+        return classes[field];
+    }
+
+    /// get the ring for a field of a motor
+    /// @param w wheel number 1-6
+    /// @param t type (DRIVE, STEER or LIFT)
+    /// @param f field (HIST_ACTUAL etc.)
+    SampleRing *get(int w,int t,int f){
+        return &rings[w-1][t][f];
+    }
+
+    /// record the fields of a motor's data which have just been read
+    /// @param w wheel number 1-6
+    /// @param t motor type
+    /// @param mask the classes of data which were read
+    /// @param d the motor's data
+    /// @param samples when each class was read, from its board
+    void record(int w,int t,int mask,const MotorData &d,
+                const SampleTime *samples){
+        for(int f=0;f<HISTFIELDS;f++){
+            int c = getFieldClass(f);
+            if(!(mask & (1<<c)) || !samples[c].isValid())
+                continue;
+            float v;
+            switch(f){
+            case HIST_ACTUAL:v=d.actual();break;
+            case HIST_CURRENT:v=d.current();break;
+            case HIST_ERROR:v=d.error();break;
+            default:v=d.control();break;
+            }
+            rings[w-1][t][f].add(samples[c].received,v);
+        }
+    }
+
+    /// forget everything
+    void clear(){
+        for(int w=0;w<6;w++)
+            for(int t=0;t<3;t++)
+                for(int f=0;f<HISTFIELDS;f++)
+                    rings[w][t][f].clear();
+    }
+};
+
+#endif /* __HISTORY_H */
@@ -25,30 +25,44 @@ private:
     /// the parameter block
     PosMotorParams params;
     
+    /// would a position collide with the adjacent wheels' lifts?
     bool isAdjacencyViolated(float req);
     
+    /// send the parameters, given the offset of this motor's
+    /// registers from those of motor one
+    template <int O> void sendParamsAt(){
+        slave->startWrites();
+        slave->write<RegLL<O+REGLL_ONE_PGAIN>>(params.pGain);
+        slave->write<RegLL<O+REGLL_ONE_IGAIN>>(params.iGain);
+        slave->write<RegLL<O+REGLL_ONE_DGAIN>>(params.dGain);
+        slave->write<RegLL<O+REGLL_ONE_INTEGRALCAP>>(params.iCap);
+        slave->write<RegLL<O+REGLL_ONE_INTEGRALDECAY>>(params.iDecay);
+        slave->write<RegLL<O+REGLL_ONE_OVERCURRENTTHRESH>>(params.overCurrentThresh);
+        slave->write<RegLL<O+REGLL_ONE_CALIBMIN>>(params.calibMin);
+        slave->write<RegLL<O+REGLL_ONE_CALIBMAX>>(params.calibMax);
+        slave->write<RegLL<O+REGLL_ONE_STALLCHECK>>(params.stallCheck);
+        slave->write<RegLL<O+REGLL_ONE_DEADZONE>>(params.deadZone);
+        slave->endWrites();
+    }
+    
 public:
     /// constructor, specifying the slave we're talking to
     /// and which of the two lift motors
     LiftMotor(SlaveDevice *s,int m) : Motor(s){
         motor = m;
+        wheelNumber = 0;
+        rover = NULL;
         // calculate the offset, if any
         regOffset = m * (REGLL_TWO_REQPOS-REGLL_ONE_REQPOS);
+        // the slave sets this to the actual position in an exception
+        s->setVolatile(regOffset+REGLL_ONE_REQPOS);
     }
     
     virtual void sendParams(){
-        slave->startWrites();
-        slave->writeFloat(regOffset+REGLL_ONE_PGAIN,params.pGain);
-        slave->writeFloat(regOffset+REGLL_ONE_IGAIN,params.iGain);
-        slave->writeFloat(regOffset+REGLL_ONE_DGAIN,params.dGain);
-        slave->writeFloat(regOffset+REGLL_ONE_INTEGRALCAP,params.iCap);
-        slave->writeFloat(regOffset+REGLL_ONE_INTEGRALDECAY,params.iDecay);
-        slave->writeFloat(regOffset+REGLL_ONE_OVERCURRENTTHRESH,params.overCurrentThresh);
-        slave->writeFloat(regOffset+REGLL_ONE_CALIBMIN,params.calibMin);
-        slave->writeFloat(regOffset+REGLL_ONE_CALIBMAX,params.calibMax);
-        slave->writeFloat(regOffset+REGLL_ONE_STALLCHECK,params.stallCheck);
-        slave->writeFloat(regOffset+REGLL_ONE_DEADZONE,params.deadZone);
-        slave->endWrites();
+        if(motor)
+            sendParamsAt<REGLL_TWO_REQPOS-REGLL_ONE_REQPOS>();
+        else
+            sendParamsAt<0>();
     }
         
     /// return the current parameter block for modification
@@ -62,25 +76,39 @@ public:
         return &params;
     }
     
-    /// send a new position request
-    virtual void setRequired(float pos){
+    /// check a position request is within the calibrated range,
+    /// without checking the adjacent wheels
+    void checkRange(float pos){
         if(pos>(params.calibMax-10) || pos<(params.calibMin+10))
             throw ConstraintException("required position out of range");
+    }
+    
+    /// check a position request is within the calibrated range and
+    /// won't collide with the adjacent wheels' lifts
+    virtual void checkRequired(float pos){
+        checkRange(pos);
         if(isAdjacencyViolated(pos))
             throw ConstraintException("lift motor collision possibility");
-           
-        
-        slave->startWrites();
-        slave->writeFloat(regOffset+REGLL_ONE_REQPOS,pos);
-        slave->endWrites();
+    }
+    
+    /// add a new position request to the current block of writes
+    virtual void writeRequired(float pos){
+        if(motor)
+            slave->write<RegLL<REGLL_TWO_REQPOS>>(pos);
+        else
+            slave->write<RegLL<REGLL_ONE_REQPOS>>(pos);
         required = pos;
     }
     
     /// the wheel number - originally the code didn't need to know
     /// this, but the lift wheel constraints make it necessary. It's
-    /// set from the rover code once everything else has been initialised.
+    /// set by the rover which owns the motor.
     
     int wheelNumber;
+    
+    /// the rover which owns the motor, whose other lift motors
+    /// the constraint checks look at
+    class Rover *rover;
 };
     
 
@@ -8,6 +8,7 @@
 
 #include "slave.h"
 #include "regsauto.h"
+#include "readsets.h"
 
 /// the master data block (i.e. data on the arduino)
 
@@ -39,42 +40,82 @@ public:
     int exceptionSlave;
     /// the motor ID (0/1) of the first exception reported to the master
     int exceptionMotor;
+    /// the whole exception register
+    int exceptionData;
+    
+    /// when each class of data was last read (only DATA_ACTUAL
+    /// and DATA_TEMP are ever read). The master has no timer
+    /// register, so there's no slave clock sample.
+    SampleTime samples[DATACLASSES];
+    
+    /// how old a class of data was at a given monotonic time (by
+    /// default, now) in seconds - zero for a class the master doesn't
+    /// have
+    double getAge(int dataClass,double now=getMonotonicTime()){
+        if(dataClass!=DATA_ACTUAL && dataClass!=DATA_TEMP)
+            return 0;
+        return samples[dataClass].getAge(now);
+    }
     
     MasterData(SlaveDevice *s){
         slave = s;
     }
     
+    /// the read sets
+    READSET(ActualSet,READSET_MASTER_ACTUAL,MasterData)
+    READSET(TempSet,READSET_MASTER_TEMP,MasterData)
+    
+    /// send the read sets: the exception data is read with the
+    /// other boards' actual values, and the temperatures (which
+    /// the master only updates every couple of seconds) by themselves.
     void init(){
-        slave->setReadSet(READSET_MASTER,
-                          REGMASTER_TEMPAMBIENT,
-                          REGMASTER_TEMP1,
-                          REGMASTER_TEMP2,
-                          REGMASTER_TEMP3,
-                          REGMASTER_TEMP4,
-                          REGMASTER_TEMP5,
-                          REGMASTER_TEMP6,
-                          REGMASTER_TEMP7,
-                          REGMASTER_TEMP8,
-                          REGMASTER_TEMP9,
-                          REGMASTER_EXCEPTIONDATA,
-                          -1);
+        useReadSet<ActualSet>(slave,DATA_ACTUAL,this);
+        useReadSet<TempSet>(slave,DATA_TEMP,this);
+    }
+    
+    /// read the given classes of data (as a mask, with bit n
+    /// set for class n) and decode them
+    void update(int mask=DATA_ALL){
+        if(mask & (1<<DATA_ACTUAL))
+            slave->readRegs(DATA_ACTUAL);
+        if(mask & (1<<DATA_TEMP))
+            slave->readRegs(DATA_TEMP);
+        decode(mask);
     }
     
-    void update(){
-        slave->readRegs(READSET_MASTER);
-        
-        // here, we read the registers in the order in which they are
-        // given in the read set
-        
-        int rct=0;
-        for(int i=0;i<10;i++){
-            temps[i] = slave->getRegFloat(rct++);
+    /// start pipelined reads of the given classes, which will decode
+    /// the values when the replies arrive.
+    void updatePipelined(int mask=DATA_ALL){
+        if(mask & (1<<DATA_ACTUAL))
+            slave->readRegsPipelined(DATA_ACTUAL,[this](SlaveDevice *){decode(1<<DATA_ACTUAL);});
+        if(mask & (1<<DATA_TEMP))
+            slave->readRegsPipelined(DATA_TEMP,[this](SlaveDevice *){decode(1<<DATA_TEMP);});
+    }
+    
+    /// add our reads of the given classes to a multiple read, after
+    /// which decode() should be called.
+    void addReads(MultiRead &mr,int mask=DATA_ALL){
+        if(mask & (1<<DATA_ACTUAL))
+            mr.add(slave,DATA_ACTUAL);
+        if(mask & (1<<DATA_TEMP))
+            mr.add(slave,DATA_TEMP);
+    }
+    
+    /// finish decoding the given classes, whose values the read
+    /// set decoders have already put into our structure
+    void decode(int mask=DATA_ALL){
+        const int hasClasses = (1<<DATA_ACTUAL)|(1<<DATA_TEMP);
+        for(int c=0;c<DATACLASSES;c++){
+            if(mask & hasClasses & (1<<c)){
+                samples[c].received = slave->getReadTime(c);
+                samples[c].latency = slave->getReadLatency(c);
+            }
+        }
+        if(mask & (1<<DATA_ACTUAL)){
+            exceptionType = exceptionData & 0xff;
+            exceptionSlave = (exceptionData >> 8)&0xf;
+            exceptionMotor = (exceptionData >> 12);
         }
-        int e = slave->getRegInt(rct++);
-                                 
-        exceptionType = e & 0xff;
-        exceptionSlave = (e >> 8)&0xf;
-        exceptionMotor = (e >> 12);
     }
 };
 
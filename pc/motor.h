@@ -74,6 +74,8 @@ public:
         required = 0;
     }
     
+    virtual ~Motor(){}
+    
     /// return the base parameter data; if you want the specific
     /// subclass, use getPosParams() or getSpeedParams() (which doesn't
     /// exist yet)
@@ -87,8 +89,26 @@ public:
         return required;
     }
     
+    /// the slave device the motor is on
+    SlaveDevice *getSlave(){
+        return slave;
+    }
+    
+    /// check a required value is allowed, throwing a
+    /// ConstraintException if not
+    virtual void checkRequired(float req){}
+    
+    /// add a write of the required value to the slave's
+    /// current block of writes, without sending it
+    virtual void writeRequired(float req)=0;
+    
     /// set the required value
-    virtual void setRequired(float req)=0;
+    void setRequired(float req){
+        checkRequired(req);
+        slave->startWrites();
+        writeRequired(req);
+        slave->endWrites();
+    }
 };
     
         
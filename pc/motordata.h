@@ -11,244 +11,311 @@
 
 #include "slave.h"
 #include "regsauto.h"
+#include "readsets.h"
+#include "telemetry.h"
 
 
-/// general class which deals with reading data from both types of board - it's
-/// subclassed by the specific board class. It also deals with firing
-/// off the actual read command.
+/// stuff that's in all motors: a view of one motor's values in a
+/// telemetry store, given its type and wheel index (wheel number
+/// minus one) there. It holds no values of its own, so it always
+/// shows what the store holds now, and is cheap to pass around.
 
-struct MotorDriverData {
-    int timer; 			//!< the current time on this slave
-    int interval;		//!< the control interval for this slave
-    int status;			//!< the status of the slave
-    int exceptionID;		//!< the ID field of the exception register
-    int exceptionType;		//!< the type field of the exception register
+struct MotorData {
+    MotorData(const RoverTelemetry *t,int type,int w){
+        tel = t;
+        this->type = type;
+        wheel = w;
+    }
     
-protected:
-    void readData(SlaveDevice *slave, int set){
-        rct=0; // set the counter
-        
-        slave->readRegs(set); // do the read
-        
-        // here, we read the registers in the order in which they are
-        // given in the read set
-        
-        timer = slave->getRegInt(rct++);
-        interval = slave->getRegInt(rct++);
-        status = slave->getRegInt(rct++);
-        int exceptionData = slave->getRegInt(rct++);
-        
-        // these are the last exception to occur - not valid
-        // if status bit not set.
-        exceptionID = exceptionData>>8;
-        exceptionType = exceptionData&0xff;
-        
-/*        printf("Driver: %d data: %x id: %x type: %x\n",
-               slave->getAddr(),
-               exceptionData,
-               exceptionID,
-               exceptionType);
-*/               
-        
-        // there will be more reads in each subclass
+    float error() const {return tel->error[type][wheel];}
+    float errorIntegral() const {return tel->errorIntegral[type][wheel];}
+    float errorDeriv() const {return tel->errorDeriv[type][wheel];}
+    float control() const {return tel->control[type][wheel];}
+    float intervalCtrl() const {return tel->intervalCtrl[type][wheel];}
+    float current() const {return tel->current[type][wheel];}
+    /// either speed or position
+    float actual() const {return tel->actual[type][wheel];}
+    /// the exception type if the motor is in exception, or zero
+    int exceptionType() const {return tel->exceptionType[type][wheel];}
+    
+    /// when the actual value (and exception) was read
+    SampleTime sample() const {
+        SampleTime s;
+        s.received = tel->received[type][wheel];
+        s.latency = tel->latency[type][wheel];
+        s.slaveTimer = tel->slaveTimer[type][wheel];
+        return s;
     }
     
-    /// used to handle updating indices
-    /// automatically
-    int rct;
-};
-
-/// stuff that's in all motors
-
-struct MotorData {
-    float error;
-    float errorIntegral;
-    float errorDeriv;
-    float control;
-    float intervalCtrl;
-    float current;
-    float actual; // either speed or position
-    int exceptionType; // if the motor is in exception
+protected:
+    const RoverTelemetry *tel; //!< the store we look at
+    int type; //!< our motor type, DRIVE, STEER or LIFT
+    int wheel; //!< our wheel number minus one
 };
 
 /// the data for each steer motor (currently just a MotorData, really)
 struct SteerMotorData : public MotorData {
+    SteerMotorData(const RoverTelemetry *t,int w) : MotorData(t,STEER,w){}
 };
 
 /// the data for each drive motor
 struct DriveMotorData : public MotorData {
-    uint32_t odometer;
+    DriveMotorData(const RoverTelemetry *t,int w) : MotorData(t,DRIVE,w){}
+    uint32_t odometer() const {return tel->odometer[wheel];}
 };
 
 /// the data for each lift motor - it's the same as a steer motor, but
 /// having a different type makes the calls typesafe.
 struct LiftMotorData : public MotorData {
+    LiftMotorData(const RoverTelemetry *t,int w) : MotorData(t,LIFT,w){}
+};
+
+/// general class which deals with reading data from both types of board - it's
+/// subclassed by the specific board class. It also deals with firing
+/// off the actual read commands. Data is read in classes (DATA_ACTUAL
+/// and so on), each with its own read set, so that update() can read
+/// only the classes which are due; each method takes a mask of
+/// the classes to read, with bit n set for class n.
+
+struct MotorDriverData {
+    int timer; 			//!< the current time on this slave
+    int interval;		//!< the control interval for this slave
+    int status;			//!< the status of the slave
+    int exceptionID;		//!< the ID field of the exception register
+    int exceptionType;		//!< the type field of the exception register
+    int exceptionData;		//!< the whole exception register
+    
+    /// when each class of data was last read. The slave's
+    /// timer is read with the actual values, so only that class
+    /// has a slave clock sample.
+    SampleTime samples[DATACLASSES];
+    
+    /// how old a class of data was at a given monotonic time (by
+    /// default, now) in seconds - zero for a class this board doesn't
+    /// have
+    double getAge(int dataClass,double now=getMonotonicTime()){
+        if(!(hasClasses & (1<<dataClass)))
+            return 0;
+        return samples[dataClass].getAge(now);
+    }
+    
+    /// set up for a slave, decoding into a rover's telemetry store
+    /// given the index (wheel number minus one) of the wheel of our
+    /// first motor - or into our own store if there's no rover.
+    MotorDriverData(SlaveDevice *s,RoverTelemetry *t=NULL,int w=0){
+        slave = s;
+        ownTelemetry = t ? NULL : new RoverTelemetry();
+        tel = t ? t : ownTelemetry;
+        wheel = w;
+    }
+    
+    /// get the telemetry store we decode into
+    RoverTelemetry *getTelemetry(){
+        return tel;
+    }
+    
+    virtual ~MotorDriverData(){
+        delete ownTelemetry;
+    }
+    
+    /// read the given classes, one read set after another, and
+    /// decode them.
+    void update(int mask=DATA_ALL){
+        for(int c=0;c<DATACLASSES;c++){
+            if(mask & hasClasses & (1<<c))
+                slave->readRegs(c);
+        }
+        decode(mask);
+    }
+    
+    /// start pipelined reads of the given classes, which will decode
+    /// the values when the replies arrive.
+    void updatePipelined(int mask=DATA_ALL){
+        for(int c=0;c<DATACLASSES;c++){
+            if(mask & hasClasses & (1<<c))
+                slave->readRegsPipelined(c,[this,c](SlaveDevice *){decode(1<<c);});
+        }
+    }
+    
+    /// add our reads of the given classes to a multiple read, after
+    /// which decode() should be called.
+    void addReads(MultiRead &mr,int mask=DATA_ALL){
+        for(int c=0;c<DATACLASSES;c++){
+            if(mask & hasClasses & (1<<c))
+                mr.add(slave,c);
+        }
+    }
+    
+    /// finish decoding the given classes, which have been read
+    /// into our structure by the read set decoders.
+    virtual void decode(int mask=DATA_ALL)=0;
+    
+protected:
+    SlaveDevice *slave; //!< the slave device we're communicating with
+    /// the classes of data this board has
+    int hasClasses;
+    
+    /// the store the read set decoders put our motors' values into
+    RoverTelemetry *tel;
+    /// the index in the store of the wheel of our first motor; a
+    /// lift board's second motor is the next wheel
+    int wheel;
+    /// our own store if we don't belong to a rover, or NULL
+    RoverTelemetry *ownTelemetry;
+    
+    /// record in the store when a motor's actual value was read,
+    /// given its type and wheel index in the store
+    void stampMotor(int type,int w){
+        const SampleTime &s = samples[DATA_ACTUAL];
+        tel->received[type][w] = s.received;
+        tel->latency[type][w] = s.latency;
+        tel->slaveTimer[type][w] = s.slaveTimer;
+    }
+    
+    /// work out the common values from those the read set decoders
+    /// have put into our structure, either from readRegs() or a
+    /// MultiRead, and record when they were read.
+    void decodeData(int mask){
+        for(int c=0;c<DATACLASSES;c++){
+            if(mask & hasClasses & (1<<c)){
+                samples[c].received = slave->getReadTime(c);
+                samples[c].latency = slave->getReadLatency(c);
+            }
+        }
+        if(mask & (1<<DATA_ACTUAL)){
+            samples[DATA_ACTUAL].slaveTimer = timer;
+            // these are the last exception to occur - not valid
+            // if status bit not set.
+            exceptionID = exceptionData>>8;
+            exceptionType = exceptionData&0xff;
+        }
+        // there will be more in each subclass
+    }
 };
 
 /// this class encapsulates reading data from a drive/steer motor
 /// board
 class DriveSteerMotorDriverData : public MotorDriverData {
-    SlaveDevice *slave; //!< the slave device we're communicating with
 public:
     
-    SteerMotorData steer; //!< data about the steer motor
-    DriveMotorData drive; //!< data about the drive motor
     float chassis;     //!< chassis inclinometer reading (may be invalid)
     
-    /// initialise the system, saying which slave we're on
-    DriveSteerMotorDriverData(SlaveDevice *s){
-        slave = s;
+    /// initialise the system, saying which slave we're on and where
+    /// to decode to (see MotorDriverData)
+    DriveSteerMotorDriverData(SlaveDevice *s,RoverTelemetry *t=NULL,int w=0) :
+        MotorDriverData(s,t,w){
+        hasClasses = (1<<DATA_ACTUAL)|(1<<DATA_CURRENT)|(1<<DATA_PID);
+    }
+    
+    /// get the data about the steer motor
+    SteerMotorData getSteer() const {
+        return SteerMotorData(tel,wheel);
     }
     
+    /// get the data about the drive motor
+    DriveMotorData getDrive() const {
+        return DriveMotorData(tel,wheel);
+    }
+    
+    /// the read sets, one for each class of data
+    READSET(ActualSet,READSET_DS_ACTUAL,DriveSteerMotorDriverData)
+    READSET(CurrentSet,READSET_DS_CURRENT,DriveSteerMotorDriverData)
+    READSET(PIDSet,READSET_DS_PID,DriveSteerMotorDriverData)
+    
     /// initialise - sends the IDs of registers we want to read to the 
-    /// board
+    /// board, one read set for each class of data, and attaches their
+    /// decoders
     
     void init(){
-//        printf("   setting readset on device %d\n",slave->getAddr());
-        slave->setReadSet(READSET_DRIVESTEER, // this block must agree with MotorDriverData
-                           REG_TIMER,
-                           REG_INTERVALI2C,
-                           REG_STATUS,
-                           REG_EXCEPTIONDATA,
-                           // now our stuff
-                           REGDS_CHASSIS,
-                           
-                           REGDS_DRIVE_ACTUALSPEED,
-                           REGDS_DRIVE_ERROR,
-                           REGDS_DRIVE_ERRORINTEGRAL,
-                           REGDS_DRIVE_ERRORDERIV,
-                           REGDS_DRIVE_CONTROL,
-                           REGDS_DRIVE_INTERVALCTRL,
-                           REGDS_DRIVE_CURRENT,
-                           REGDS_DRIVE_ODO,
-                           
-                           REGDS_STEER_ACTUALPOS,
-                           REGDS_STEER_ERROR,
-                           REGDS_STEER_ERRORINTEGRAL,
-                           REGDS_STEER_ERRORDERIV,
-                           REGDS_STEER_CONTROL,
-                           REGDS_STEER_INTERVALCTRL,
-                           REGDS_STEER_CURRENT,
-                           -1);
+        useReadSet<ActualSet>(slave,DATA_ACTUAL,this);
+        useReadSet<CurrentSet>(slave,DATA_CURRENT,this);
+        useReadSet<PIDSet>(slave,DATA_PID,this);
     }
     
-    /// update - first calls readData in the superclass, which will
-    /// actually do the read, and then copies the values into our structure.
-    
-    void update(){
-        readData(slave,READSET_DRIVESTEER); // does read, and updates the first few things
-        
-        // must agree with block above
-        
-        chassis = slave->getRegFloat(rct++);
-        
-        drive.actual = slave->getRegFloat(rct++);
-        drive.error = slave->getRegFloat(rct++);
-        drive.errorIntegral = slave->getRegFloat(rct++);
-        drive.errorDeriv = slave->getRegFloat(rct++);
-        drive.control = slave->getRegFloat(rct++);
-        drive.intervalCtrl = slave->getRegFloat(rct++);
-        drive.current = slave->getRegFloat(rct++);
-        drive.odometer = slave->getRegInt(rct++);
-        
-        steer.actual = slave->getRegFloat(rct++);
-        steer.error = slave->getRegFloat(rct++);
-        steer.errorIntegral = slave->getRegFloat(rct++);
-        steer.errorDeriv = slave->getRegFloat(rct++);
-        steer.control = slave->getRegFloat(rct++);
-        steer.intervalCtrl = slave->getRegFloat(rct++);
-        steer.current = slave->getRegFloat(rct++);
+    /// finish decoding the given classes, whose values the read set
+    /// decoders have already put into our structure - first calls
+    /// decodeData in the superclass, which updates the common things.
+    virtual void decode(int mask=DATA_ALL){
+        decodeData(mask);
         
-        // route the exception type, if any, to the appropriate motor
-        if(status & ST_EXCEPTION){
-            switch(exceptionID){
-            case 0:
-                drive.exceptionType = exceptionType;break;
-            case 1:
-                steer.exceptionType = exceptionType;break;
-            default:
-                drive.exceptionType = steer.exceptionType = exceptionType;
+        if(mask & (1<<DATA_ACTUAL)){
+            int *dex = &tel->exceptionType[DRIVE][wheel];
+            int *sex = &tel->exceptionType[STEER][wheel];
+            // route the exception type, if any, to the appropriate motor
+            if(status & ST_EXCEPTION){
+                switch(exceptionID){
+                case 0:
+                    *dex = exceptionType;break;
+                case 1:
+                    *sex = exceptionType;break;
+                default:
+                    *dex = *sex = exceptionType;
+                }
             }
+            else *dex = *sex = 0;
+            stampMotor(DRIVE,wheel);
+            stampMotor(STEER,wheel);
         }
-        else drive.exceptionType = steer.exceptionType = 0;
     }
 };
 
-/// this class encapsulates reading data from a drive/steer motor
-/// board
+/// this class encapsulates reading data from a lift/lift motor
+/// board. The registers of lift motor two follow those of lift
+/// motor one in the same order.
 class LiftMotorDriverData : public MotorDriverData {
-    SlaveDevice *slave; //!< the slave device we're communicating with
 public:
     
-    /// our lift motor data structures
-    LiftMotorData data[2];
+    /// initialise the system, saying which slave we're on and where
+    /// to decode to (see MotorDriverData)
+    LiftMotorDriverData(SlaveDevice *s,RoverTelemetry *t=NULL,int w=0) :
+        MotorDriverData(s,t,w){
+        hasClasses = (1<<DATA_ACTUAL)|(1<<DATA_CURRENT)|(1<<DATA_PID);
+    }
     
-    /// initialise the system, saying which slave we're on
-    LiftMotorDriverData(SlaveDevice *s){
-        slave = s;
+    /// get the data about one of our lift motors
+    /// @param n motor number 0-1
+    LiftMotorData getLift(int n) const {
+        return LiftMotorData(tel,wheel+n);
     }
     
+    /// the read sets, one for each class of data
+    READSET(ActualSet,READSET_LL_ACTUAL,LiftMotorDriverData)
+    READSET(CurrentSet,READSET_LL_CURRENT,LiftMotorDriverData)
+    READSET(PIDSet,READSET_LL_PID,LiftMotorDriverData)
+    
     /// initialise - sends the IDs of registers we want to read to the 
-    /// board
+    /// board, one read set for each class of data, and attaches their
+    /// decoders
     
     void init(){
-//        printf("   setting readset on device %d\n",slave->getAddr());
-        slave->setReadSet(READSET_LIFT, // this block must agree with MotorDriverData
-                           REG_TIMER,
-                           REG_INTERVALI2C,
-                           REG_STATUS,
-                           REG_EXCEPTIONDATA,
-                           // now our stuff
-                           REGLL_ONE_ACTUALPOS,
-                           REGLL_ONE_ERROR,
-                           REGLL_ONE_ERRORINTEGRAL,
-                           REGLL_ONE_ERRORDERIV,
-                           REGLL_ONE_CONTROL,
-                           REGLL_ONE_INTERVALCTRL,
-                           REGLL_ONE_CURRENT,
-                           
-                           REGLL_TWO_ACTUALPOS,
-                           REGLL_TWO_ERROR,
-                           REGLL_TWO_ERRORINTEGRAL,
-                           REGLL_TWO_ERRORDERIV,
-                           REGLL_TWO_CONTROL,
-                           REGLL_TWO_INTERVALCTRL,
-                           REGLL_TWO_CURRENT,
-                           -1);
+        useReadSet<ActualSet>(slave,DATA_ACTUAL,this);
+        useReadSet<CurrentSet>(slave,DATA_CURRENT,this);
+        useReadSet<PIDSet>(slave,DATA_PID,this);
     }
-public:
 
-    /// update - first calls readData in the superclass, which will
-    /// actually do the read, and then copies the values into our structure.
-    
-    void update(){
-        readData(slave,READSET_LIFT); // does read, and updates the first few things
-        for(int i=0;i<2;i++){
-            data[i].actual = slave->getRegFloat(rct++);
-            data[i].error = slave->getRegFloat(rct++);
-            data[i].errorIntegral = slave->getRegFloat(rct++);
-            data[i].errorDeriv = slave->getRegFloat(rct++);
-            data[i].control = slave->getRegFloat(rct++);
-            data[i].intervalCtrl = slave->getRegFloat(rct++);
-            data[i].current = slave->getRegFloat(rct++);
-        }
-        // route the exception type, if any, to the appropriate motor
-        if(status & ST_EXCEPTION){
-            switch(exceptionID){
-            case 0:
-            case 1:
-                data[exceptionID].exceptionType = exceptionType;
-                break;
-            default:
-                data[0].exceptionType = exceptionType;
-                data[1].exceptionType = exceptionType;
-            }
-            
-        }else {
-            data[0].exceptionType = 0;
-            data[1].exceptionType = 0;
+    /// finish decoding the given classes, whose values the read set
+    /// decoders have already put into our structure - first calls
+    /// decodeData in the superclass, which updates the common things.
+    virtual void decode(int mask=DATA_ALL){
+        decodeData(mask);
+        
+        if(mask & (1<<DATA_ACTUAL)){
+            int *ex = &tel->exceptionType[LIFT][wheel];
+            // route the exception type, if any, to the appropriate motor
+            if(status & ST_EXCEPTION){
+                switch(exceptionID){
+                case 0:
+                case 1:
+                    ex[exceptionID] = exceptionType;
+                    break;
+                default:
+                    ex[0] = ex[1] = exceptionType;
+                }
+            }else
+                ex[0] = ex[1] = 0;
+            stampMotor(LIFT,wheel);
+            stampMotor(LIFT,wheel+1);
         }
-            
     }
 };
 
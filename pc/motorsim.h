@@ -1,64 +1,344 @@
 /**
  * @file
- * Abstract class for all simulated motors.
+ * Simulated motors. Each is a DC motor and gearbox driven through an
+ * H-bridge, with the sensors and the PID controller a slave board
+ * would run on it: a quadrature encoder and speed controller for
+ * the drive motors, a potentiometer and position controller for the
+ * steer and lift motors.
  */
 
 #ifndef __MOTORSIM_H
 #define __MOTORSIM_H
 
+#include <math.h>
 
-/// this class runs all simulated motors - it's extremely simple,
-/// using Brown smoothing (aka exponential weighted moving average,
-/// or a IIR (RC) filter.)
+/// how long each step of the motor simulation is, in seconds
+#define SIMSTEP 0.001
+
+/// how often the simulated slaves read their ADCs (currents and
+/// potentiometers), and so how often the position controllers run
+#define SIMADCINTERVAL 0.004
+
+/// how often the simulated encoders are read, and so how often the
+/// speed controllers run; the firmware waits for more than 150ms.
+#define SIMENCODERINTERVAL 0.15
+
+/// the largest duty cycle value, as MAXDUTY in the slave firmware
+#define SIMMAXDUTY 255
+
+/// The physical constants of a simulated motor, its gearbox and its
+/// load, in SI units.
+
+struct MotorPhysics {
+    float supply; //!< voltage across the motor at full duty
+    float resistance; //!< winding resistance (ohms)
+    /// torque per amp (Nm/A), which is also the back-EMF per unit
+    /// speed (V s/rad)
+    float torqueConst;
+    float inertia; //!< at the motor shaft, including the load (kg m^2)
+    float viscous; //!< viscous friction at the motor shaft (Nm s/rad)
+    float coulomb; //!< dry friction at the motor shaft (Nm)
+    float gearRatio; //!< motor turns per output turn
+    /// end stops of the output shaft in degrees either side of
+    /// zero, or zero if it turns freely
+    float limit;
+    float countsPerAmp; //!< current sensor ADC counts per amp
+};
+
+/// The PID arithmetic of the slave firmware (PIDController in
+/// firmware/slave/src/pid.h), with the interval passed in rather than
+/// read from the clock. Keep the two in step.
+
+struct SimPID {
+    float required; //!< required value
+    float actual; //!< actual value
+    float pGain; //!< proportional gain
+    float iGain; //!< integral gain
+    float dGain; //!< differential gain
+    float error; //!< error value
+    float errorIntegral; //!< integral of error for the I-term
+    /// derivative of the *position* for the D-term, as in the firmware
+    float errorDerivative;
+    float integralCap; //!< the value at which the error integral is clamped
+    float integralDecay; //!< the error integral's decay term
+    float deadZone; //!< below this, the error is assumed to be zero
+    int milliInterval; //!< time between the last two runs (ms)
+    float prevActual; //!< previous actual value
+
+    SimPID(){
+        pGain=iGain=dGain=0;
+        prevActual=actual=0;
+        error=errorIntegral=errorDerivative=0;
+        integralCap=integralDecay=0;
+        milliInterval=0;
+        required=0;
+        deadZone=0;
+    }
+
+    /// work out the error terms, given the interval since the last
+    /// run in seconds
+    void calculate(double interval){
+        milliInterval = (int)(interval*1000.0);
+
+        error = required - actual;
+        // dead zone
+        if((error<0 && error>-deadZone) ||
+           (error>0 && error<deadZone))error=0;
+
+        errorIntegral += error;
+        errorIntegral *= integralDecay;
+
+        if(errorIntegral>integralCap)
+            errorIntegral=integralCap;
+        if(errorIntegral<-integralCap)
+            errorIntegral=-integralCap;
+
+        errorDerivative = -(actual-prevActual);
+        prevActual = actual;
+    }
+
+    /// the PID correction
+    float correction(){
+        return pGain*error+iGain*errorIntegral+dGain*errorDerivative;
+    }
+};
+
+/// A simulated motor: the motor and its load are integrated in fixed
+/// steps of SIMSTEP, and the sensors and controller run at the rates
+/// the slave does. Subclasses provide the sensor and controller. The
+/// winding's inductance is ignored, so the current follows the voltage
+/// and back-EMF at once; the electrical time constant is far shorter
+/// than a step.
 
 class MotorSim {
-    /// the actual motor speed or position
-    float actual;
-    
-    /// the smoothing factor for this motor
-    float smoothing;
-    
-    /// the simulated current flow
-    float current;
+protected:
+    MotorPhysics phys; //!< the physical constants
+    double omega; //!< motor shaft speed (rad/s)
+    double angle; //!< output shaft angle (rad)
+    float amps; //!< current through the winding
+    /// duty cycle sent to the motor, with the sign giving direction
+    int duty;
+    /// true if the bridge is driving the motor, false if it has
+    /// been stopped by an exception, leaving it to coast
+    bool driven;
+    /// the filtered current, as MotorController::setCurrent()
+    float filteredCurrent;
+    /// time since the last ADC read
+    double sinceADC;
+
+    /// send a control value to the motor, as MotorController::setSpeed();
+    /// like it, this takes an int so the fraction is lost
+    void setSpeed(int speed){
+        duty = speed;
+        if(duty>SIMMAXDUTY)duty=SIMMAXDUTY;
+        if(duty<-SIMMAXDUTY)duty=-SIMMAXDUTY;
+        control = duty<0 ? -duty : duty;
+        driven = true;
+    }
+
+    /// clamp a float control value to a range an int can hold before
+    /// truncating it, which the AVR compiler does without complaint
+    static int toInt(float c){
+        if(c>32767)return 32767;
+        if(c<-32767)return -32767;
+        return (int)c;
+    }
+
+    /// read the current sensor, filtering the value with different
+    /// rising and falling rates as the firmware does
+    void readCurrent(){
+        float c = fabsf(amps)*phys.countsPerAmp;
+        if(c>1023)c=1023;
+        c = (float)(int)c; // a 10-bit ADC reading
+        float param = c>filteredCurrent ? 0.1f : 0.01f;
+        filteredCurrent = (1.0f-param)*filteredCurrent + c*param;
+    }
+
+    /// integrate the motor and its load over a step
+    void integrate(double dt){
+        float volts = driven ? phys.supply*duty/(float)SIMMAXDUTY : 0;
+        // an open circuit passes no current; otherwise it's set by
+        // the voltage less the back-EMF
+        amps = driven ? (volts - phys.torqueConst*omega)/phys.resistance : 0;
+        double torque = phys.torqueConst*amps - phys.viscous*omega;
+
+        // dry friction holds a stopped motor until the torque overcomes
+        // it, and can slow a moving one to a stop but not reverse it
+        if(omega==0){
+            if(fabs(torque)<=phys.coulomb)
+                torque=0;
+            else
+                torque -= torque>0 ? phys.coulomb : -phys.coulomb;
+            omega += torque*dt/phys.inertia;
+        } else {
+            double w = omega + (torque - (omega>0 ? phys.coulomb : -phys.coulomb))*dt/phys.inertia;
+            omega = (w>0) != (omega>0) ? 0 : w;
+        }
+        angle += omega*dt/phys.gearRatio;
+
+        if(phys.limit>0){
+            double lim = phys.limit*M_PI/180.0;
+            if(angle>lim || angle<-lim){
+                angle = angle>0 ? lim : -lim;
+                omega = 0;
+            }
+        }
+    }
+
+    /// run the sensors and controller; called after each step with the
+    /// step length and whether the slave is in an exception
+    virtual void runController(double dt,bool exception) = 0;
 
 public:
-    /// the required motor speed or position
-    float required;
-    
-    float getActual(){
-        return actual;
-    }
-    
-    /// pass in a smoothing factor - the higher this is, 
-    /// the more of the input is used so the quicker the
-    /// motor responds. Between 0 and 1.
-    MotorSim(float _smoothing){
-        smoothing = _smoothing;
-        actual=0;
-        required=0;
-        current=0;
+    /// the PID controller, whose gains etc. should be set from the
+    /// slave's registers and whose state is reported in them
+    SimPID pid;
+    /// the magnitude of the control value sent to the motor
+    int control;
+
+    MotorSim(const MotorPhysics &p){
+        phys = p;
+        omega = angle = 0;
+        amps = 0;
+        duty = 0;
+        control = 0;
+        driven = true;
+        filteredCurrent = 0;
+        sinceADC = 0;
     }
-    
+
     virtual ~MotorSim(){}
-    
-    void update(){
-        actual = required*smoothing + actual*(1.0f-smoothing);
-        float c = fabs(required*RoverSimulator::getSimCurrentFactor());
-        // and cap it
-        c = (1-powf(1.02f,-c))*50.0f;
-        
-        // make this work with hysteresis
-        current = 0.1f*c + 0.9f*current;
-        
-    }
-    
-    /// set the simulated current flow
+
+    /// change the viscous friction on the motor, modelling a change
+    /// in its load
+    void setViscous(float v){
+        phys.viscous = v;
+    }
+
+    /// run one step of SIMSTEP, given whether the slave is in an
+    /// exception, in which case the motor stops and coasts
+    void update(bool exception){
+        if(exception)
+            driven = false;
+        integrate(SIMSTEP);
+        runController(SIMSTEP,exception);
+    }
+
+    /// the actual value as the slave last measured it
+    float getActual(){
+        return pid.actual;
+    }
+
+    /// the filtered current as the slave reports it
     virtual float getSimCurrent(){
-        return current;
+        return (float)(int)filteredCurrent;
+    }
+};
+
+/// a drive motor with a quadrature encoder and a speed controller, as
+/// SpeedMotorController in the slave firmware; speeds are in encoder
+/// ticks per second.
+
+class SpeedMotorSim : public MotorSim {
+    /// encoder ticks per output turn (rising edges on channel A)
+    float ticksPerTurn;
+    /// the encoder position as a number of ticks at the last read
+    double prevTicks;
+    /// ticks counted since the odometry was reset
+    double odoTicks;
+    /// time since the last encoder read
+    double sinceEncoder;
+    /// accumulated control value
+    float ctl;
+
+    virtual void runController(double dt,bool exception){
+        sinceADC += dt;
+        if(sinceADC>=SIMADCINTERVAL){
+            sinceADC -= SIMADCINTERVAL;
+            readCurrent();
+        }
+
+        sinceEncoder += dt;
+        if(sinceEncoder>SIMENCODERINTERVAL){
+            double ticks = floor(angle*ticksPerTurn/(2.0*M_PI));
+            double ct = fabs(ticks-prevTicks);
+            odoTicks += ct;
+            float freq = (float)(ct/sinceEncoder);
+            pid.actual = ticks<prevTicks ? -freq : freq;
+            prevTicks = ticks;
+
+            if(exception)
+                pid.required=0;
+            pid.calculate(sinceEncoder);
+            sinceEncoder = 0;
+
+            ctl += pid.correction();
+            if(pid.required<0.001f && pid.required>-0.001f)
+                ctl *= 0.96f; // MOTOR_SPEED_DECAY
+            if(!exception)
+                setSpeed(toInt(ctl));
+        }
+    }
+
+public:
+    SpeedMotorSim(const MotorPhysics &p,float tpt) : MotorSim(p){
+        ticksPerTurn = tpt;
+        prevTicks = 0;
+        odoTicks = 0;
+        sinceEncoder = 0;
+        ctl = 0;
+    }
+
+    /// the odometry as the slave reports it, shifted down by 8 bits
+    uint16_t getOdometry(){
+        return (uint16_t)(((uint32_t)odoTicks)>>8);
+    }
+
+    void resetOdometry(){
+        odoTicks = 0;
     }
-        
 };
 
+/// a steer or lift motor with a potentiometer and a position
+/// controller, as PositionMotorController in the slave firmware.
+/// The potentiometer is assumed to be calibrated correctly, so that
+/// its reading maps back onto the output shaft's angle in degrees to
+/// within the resolution of the ADC.
+
+class PositionMotorSim : public MotorSim {
+    virtual void runController(double dt,bool exception){
+        sinceADC += dt;
+        if(sinceADC<SIMADCINTERVAL)
+            return;
+        double interval = sinceADC;
+        sinceADC -= SIMADCINTERVAL;
 
+        readCurrent();
+
+        // read the pot, and map the reading with the calibration
+        float range = calibMax-calibMin;
+        int p = 0;
+        if(range!=0){
+            float v = (angle*180.0/M_PI-calibMin)*1024.0f/range;
+            p = v<0 ? 0 : (v>1023 ? 1023 : (int)v);
+        }
+        pid.actual = (float)p*range/1024.0f + calibMin;
+
+        if(exception)
+            pid.required = pid.actual;
+        pid.calculate(interval);
+        if(!exception)
+            setSpeed(toInt(pid.correction()));
+    }
+
+public:
+    float calibMin; //!< the angle which maps onto 0 on the pot
+    float calibMax; //!< the angle which maps onto 1024 on the pot
+
+    PositionMotorSim(const MotorPhysics &p) : MotorSim(p){
+        calibMin = -512;
+        calibMax = 512;
+    }
+};
 
 #endif /* __MOTORSIM_H */
@@ -0,0 +1,28 @@
+/**
+ * \file
+ * Serves the rover simulator on a pseudo-terminal, so that other
+ * programs can talk to it through their real serial code as if it were
+ * the rover. Run it (optionally with a baud rate to pace the bytes at)
+ * and give the device name it prints to Rover::init().
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "rover.h"
+
+int main(int argc,char *argv[]){
+    PtyLink link(new RoverSimulator());
+    if(argc>1)
+        link.setBaudRate(atoi(argv[1]));
+    
+    const char *dev = link.start();
+    if(!dev){
+        perror("cannot create pseudo-terminal");
+        return 1;
+    }
+    printf("%s\n",dev);
+    fflush(stdout);
+    
+    for(;;)
+        pause();
+}
@@ -19,12 +19,35 @@ const StatusFlag SerialComms::CONNECTING;
 const StatusFlag SerialComms::PROTOCOL_ERROR;
 const StatusFlag SerialComms::ERRORFLAGS;
 
+/// check the wheel, type and field of a history query
+static void checkHistory(int w,int t,int f){
+    if(w<1 || w>6 || t<0 || t>2 || f<0 || f>=HISTFIELDS)
+        throw py::index_error("no such history");
+}
+
+/// turn a wheel number (1-6) into a snapshot array index
+static int checkWheel(int w){
+    if(w<1 || w>6)
+        throw py::index_error("bad wheel number");
+    return w-1;
+}
 
 PYBIND11_MODULE(blodwen, m) {
     m.doc() = "Blodwen Rover python wrapper";
     m.attr("DRIVE") = DRIVE;
     m.attr("STEER") = STEER;
     m.attr("LIFT") = LIFT;
+    m.attr("DATA_ACTUAL") = DATA_ACTUAL;
+    m.attr("DATA_CURRENT") = DATA_CURRENT;
+    m.attr("DATA_PID") = DATA_PID;
+    m.attr("DATA_TEMP") = DATA_TEMP;
+    m.attr("HIST_ACTUAL") = HIST_ACTUAL;
+    m.attr("HIST_CURRENT") = HIST_CURRENT;
+    m.attr("HIST_ERROR") = HIST_ERROR;
+    m.attr("HIST_CONTROL") = HIST_CONTROL;
+    m.attr("TRAJ_STEP") = TRAJ_STEP;
+    m.attr("TRAJ_LINEAR") = TRAJ_LINEAR;
+    m.attr("TRAJ_SPLINE") = TRAJ_SPLINE;
 
     // TODO: not really needed by the wrapper...
 //    py::class_<Simulator>(m, "Simulator");
@@ -63,7 +86,10 @@ PYBIND11_MODULE(blodwen, m) {
         .def_readwrite("exceptionSlave", &MasterData::exceptionSlave)
         .def_readwrite("exceptionMotor", &MasterData::exceptionMotor)
         .def("init", &MasterData::init)
-        .def("update", &MasterData::update)
+        .def("update", &MasterData::update, "mask"_a=DATA_ALL)
+        .def("getAge", [](MasterData &d,int c){
+            return d.getAge(c);
+        }, "dataClass"_a)
         ;
 
     py::class_<MotorParams>(m, "MotorParams")
@@ -85,6 +111,9 @@ PYBIND11_MODULE(blodwen, m) {
         ;
 
     py::class_<MotorDriverData>(m, "MotorDriverData")
+        .def("getAge", [](MotorDriverData &d,int c){
+            return d.getAge(c);
+        }, "dataClass"_a)
         .def_readwrite("timer", &MotorDriverData::timer)
         .def_readwrite("interval", &MotorDriverData::interval)
         .def_readwrite("status", &MotorDriverData::status)
@@ -97,32 +126,181 @@ PYBIND11_MODULE(blodwen, m) {
         .def_readwrite("drive", &DriveSteerMotorDriverData::drive)
         .def_readwrite("chassis", &DriveSteerMotorDriverData::chassis)
         .def("init", &DriveSteerMotorDriverData::init)
-        .def("update", &DriveSteerMotorDriverData::update)
+        .def("update", &DriveSteerMotorDriverData::update, "mask"_a=DATA_ALL)
         ;
 
     py::class_<LiftMotorDriverData, MotorDriverData>(m, "LiftMotorDriverData")
         .def(py::init<SlaveDevice *>())
 //        .def_readwrite("data", &LiftMotorDriverData::data) // FIXME: pybind doesn't play well with c-style arrays
         .def("init", &LiftMotorDriverData::init)
-        .def("update", &LiftMotorDriverData::update)
+        .def("update", &LiftMotorDriverData::update, "mask"_a=DATA_ALL)
         ;
 
+    py::class_<SampleTime>(m, "SampleTime")
+        .def_readonly("received", &SampleTime::received)
+        .def_readonly("latency", &SampleTime::latency)
+        .def_readonly("slaveTimer", &SampleTime::slaveTimer)
+        .def("isValid", &SampleTime::isValid)
+        .def("getAge", (double (SampleTime::*)() const)&SampleTime::getAge)
+        ;
+    m.def("getMonotonicTime", &getMonotonicTime);
+    m.def("setVirtualClock", &setVirtualClock, "on"_a);
+    m.def("isVirtualClock", &isVirtualClock);
+    m.def("advanceVirtualClock", &advanceVirtualClock, "secs"_a);
+    m.def("sleepFor", &sleepFor, "secs"_a);
+
+    // objects given a clock with setClock() keep it alive
+    py::class_<Clock>(m, "Clock")
+        .def(py::init())
+        .def("setVirtual", &Clock::setVirtual, "on"_a)
+        .def("isVirtual", &Clock::isVirtual)
+        .def("advanceTo", &Clock::advanceTo, "t"_a)
+        .def("advance", &Clock::advance, "secs"_a)
+        .def("now", &Clock::now)
+        .def("sleepFor", &Clock::sleepFor, "secs"_a,
+             py::call_guard<py::gil_scoped_release>())
+        ;
+    m.def("getDefaultClock", &getDefaultClock, py::return_value_policy::reference);
+
+    py::class_<LoopHistogram>(m, "LoopHistogram")
+        .def("getCount", &LoopHistogram::getCount)
+        .def("getMin", &LoopHistogram::getMin)
+        .def("getMax", &LoopHistogram::getMax)
+        .def("getMean", &LoopHistogram::getMean)
+        .def("getPercentile", &LoopHistogram::getPercentile, "p"_a)
+        .def("getBinWidth", &LoopHistogram::getBinWidth)
+        .def("getBins", [](const LoopHistogram &h){
+            // the last bin is for times beyond the range
+            py::list l;
+            for(int i=0;i<=LOOPHISTBINS;i++)
+                l.append(h.getBin(i));
+            return l;
+        })
+        ;
+
+    py::class_<PeriodicLoop>(m, "PeriodicLoop")
+        .def(py::init())
+        .def("setPeriod", &PeriodicLoop::setPeriod, "p"_a)
+        .def("setClock", &PeriodicLoop::setClock, "c"_a, py::keep_alive<1,2>())
+        .def("getClock", &PeriodicLoop::getClock, py::return_value_policy::reference)
+        .def("getPeriod", &PeriodicLoop::getPeriod)
+        .def("start", &PeriodicLoop::start)
+        .def("wait", &PeriodicLoop::wait, py::call_guard<py::gil_scoped_release>())
+        .def("clearStats", &PeriodicLoop::clearStats)
+        .def("getPeriods", &PeriodicLoop::getPeriods, py::return_value_policy::reference_internal)
+        .def("getWork", &PeriodicLoop::getWork, py::return_value_policy::reference_internal)
+        .def("getLatency", &PeriodicLoop::getLatency, py::return_value_policy::reference_internal)
+        .def("getOverruns", &PeriodicLoop::getOverruns)
+        .def("getMissed", &PeriodicLoop::getMissed)
+        ;
+
+    py::class_<TrajectoryQueue>(m, "TrajectoryQueue")
+        .def("add", [](TrajectoryQueue &q,int w,int t,double time,float v,int interp){
+            if(w<1 || w>6 || t<0 || t>2)
+                throw py::index_error("no such motor");
+            return q.add(w,t,time,v,interp);
+        }, "w"_a, "t"_a, "time"_a, "v"_a, "interp"_a=TRAJ_LINEAR)
+        .def("clear", &TrajectoryQueue::clear)
+        .def("start", [](TrajectoryQueue &q){q.start();})
+        .def("start", [](TrajectoryQueue &q,double now){q.start(now);}, "now"_a)
+        .def("stop", &TrajectoryQueue::stop)
+        .def("isRunning", &TrajectoryQueue::isRunning)
+        .def("isFinished", &TrajectoryQueue::isFinished)
+        .def("setTolerance", &TrajectoryQueue::setTolerance, "t"_a)
+        .def("getReachedCount", &TrajectoryQueue::getReachedCount)
+        .def("getMissCount", &TrajectoryQueue::getMissCount)
+        .def("getMaxLateness", &TrajectoryQueue::getMaxLateness)
+        ;
+
+    py::class_<HistoryStats>(m, "HistoryStats")
+        .def_readonly("n", &HistoryStats::n)
+        .def_readonly("min", &HistoryStats::min)
+        .def_readonly("max", &HistoryStats::max)
+        .def_readonly("mean", &HistoryStats::mean)
+        .def_readonly("variance", &HistoryStats::variance)
+        ;
+
+    // the motor data objects are views of a telemetry store, so the
+    // functions returning them keep their rover or snapshot alive
     py::class_<MotorData>(m, "MotorData")
-        .def_readwrite("error", &MotorData::error)
-        .def_readwrite("errorIntegral", &MotorData::errorIntegral)
-        .def_readwrite("errorDeriv", &MotorData::errorDeriv)
-        .def_readwrite("control", &MotorData::control)
-        .def_readwrite("intervalCtrl", &MotorData::intervalCtrl)
-        .def_readwrite("current", &MotorData::current)
-        .def_readwrite("actual", &MotorData::actual)
-        .def_readwrite("exceptionType", &MotorData::exceptionType)
+        .def_property_readonly("error", &MotorData::error)
+        .def_property_readonly("errorIntegral", &MotorData::errorIntegral)
+        .def_property_readonly("errorDeriv", &MotorData::errorDeriv)
+        .def_property_readonly("control", &MotorData::control)
+        .def_property_readonly("intervalCtrl", &MotorData::intervalCtrl)
+        .def_property_readonly("current", &MotorData::current)
+        .def_property_readonly("actual", &MotorData::actual)
+        .def_property_readonly("exceptionType", &MotorData::exceptionType)
+        .def_property_readonly("sample", &MotorData::sample)
         ;
     py::class_<SteerMotorData, MotorData>(m, "SteerMotorData"); // OK
     py::class_<DriveMotorData, MotorData>(m, "DriveMotorData")
-        .def_readwrite("odometer", &DriveMotorData::odometer)
+        .def_property_readonly("odometer", &DriveMotorData::odometer)
         ;
     py::class_<LiftMotorData, MotorData>(m, "LiftMotorData"); // OK
 
+    // each field comes out as the raw bytes of its array, in native
+    // byte order, which numpy.frombuffer() will turn into an array
+    // without a copy per element: floats are [type][wheel-1].
+#define TELEMETRY_FIELD(f) \
+    .def_property_readonly(#f, [](const RoverTelemetry &t){ \
+        return py::bytes((const char *)t.f,sizeof(t.f)); \
+    })
+    py::class_<RoverTelemetry>(m, "RoverTelemetry")
+        TELEMETRY_FIELD(actual)
+        TELEMETRY_FIELD(current)
+        TELEMETRY_FIELD(error)
+        TELEMETRY_FIELD(errorIntegral)
+        TELEMETRY_FIELD(errorDeriv)
+        TELEMETRY_FIELD(control)
+        TELEMETRY_FIELD(intervalCtrl)
+        TELEMETRY_FIELD(exceptionType)
+        TELEMETRY_FIELD(received)
+        TELEMETRY_FIELD(latency)
+        TELEMETRY_FIELD(slaveTimer)
+        TELEMETRY_FIELD(odometer)
+        ;
+#undef TELEMETRY_FIELD
+
+    // the arrays are copied out, with wheels numbered from 1 as elsewhere
+    py::class_<RoverSnapshot>(m, "RoverSnapshot")
+        .def_readonly("sweep", &RoverSnapshot::sweep)
+        .def("getDriveData", [](const RoverSnapshot &s,int w){
+            return s.getDriveData(checkWheel(w)+1);
+        }, "n"_a, py::keep_alive<0,1>())
+        .def("getSteerData", [](const RoverSnapshot &s,int w){
+            return s.getSteerData(checkWheel(w)+1);
+        }, "n"_a, py::keep_alive<0,1>())
+        .def("getLiftData", [](const RoverSnapshot &s,int w){
+            return s.getLiftData(checkWheel(w)+1);
+        }, "n"_a, py::keep_alive<0,1>())
+        .def("getRequired", [](const RoverSnapshot &s,int t,int w){
+            if(t<0 || t>2)
+                throw py::index_error("bad motor type");
+            return s.required[t][checkWheel(w)];
+        }, "t"_a, "n"_a)
+        .def("getChassisValue", [](const RoverSnapshot &s,int n){
+            if(n<0 || n>2)
+                throw py::index_error("bad wheel pair");
+            return s.chassis[n];
+        }, "n"_a)
+        .def("getStatus", [](const RoverSnapshot &s,int addr){
+            if(addr<1 || addr>9)
+                throw py::index_error("bad slave address");
+            return s.status[addr-1];
+        }, "addr"_a)
+        .def("getTemp", [](const RoverSnapshot &s,int n){
+            if(n<0 || n>9)
+                throw py::index_error("bad temperature sensor");
+            return s.temps[n];
+        }, "n"_a)
+        .def_readonly("exceptionType", &RoverSnapshot::exceptionType)
+        .def_readonly("exceptionSlave", &RoverSnapshot::exceptionSlave)
+        .def_readonly("exceptionMotor", &RoverSnapshot::exceptionMotor)
+        .def_readonly("tempSample", &RoverSnapshot::tempSample)
+        .def_readonly("telemetry", &RoverSnapshot::telemetry)
+        ;
+
     py::class_<Register>(m, "Register")
         .def_readwrite("sizeAndFlags", &Register::sizeAndFlags)
         .def_readwrite("minval", &Register::minval)
@@ -143,41 +321,111 @@ PYBIND11_MODULE(blodwen, m) {
         .def("update", &WheelPair::update)
         .def("getDevice", &WheelPair::getDevice, "n"_a, py::return_value_policy::reference_internal)  // TODO: double check return (devs are not pointers...)
         .def("getMotor", &WheelPair::getMotor, "n"_a, "type"_a, py::return_value_policy::reference_internal)
-        .def("getMotorData", &WheelPair::getMotorData, "n"_a, "type"_a, py::return_value_policy::reference_internal)
-        .def("getDriveData", &WheelPair::getDriveData, "n"_a, py::return_value_policy::reference_internal)
-        .def("getSteerData", &WheelPair::getSteerData, "n"_a, py::return_value_policy::reference_internal)
-        .def("getLiftData", &WheelPair::getLiftData, "n"_a, py::return_value_policy::reference_internal)
+        .def("getMotorData", &WheelPair::getMotorData, "n"_a, "type"_a, py::keep_alive<0,1>())
+        .def("getDriveData", &WheelPair::getDriveData, "n"_a, py::keep_alive<0,1>())
+        .def("getSteerData", &WheelPair::getSteerData, "n"_a, py::keep_alive<0,1>())
+        .def("getLiftData", &WheelPair::getLiftData, "n"_a, py::keep_alive<0,1>())
         .def("getDrive", &WheelPair::getDrive, "n"_a, py::return_value_policy::reference_internal)
         .def("getSteer", &WheelPair::getSteer, "n"_a, py::return_value_policy::reference_internal)
         .def("getLift", &WheelPair::getLift, "n"_a, py::return_value_policy::reference_internal)
         ;
 
-    // Rover singleton requires some extra accommodations just to be on the safe side at teardown.
+    // Rover() gives the singleton, which is never deleted, just to be on the safe side at teardown;
+    // Rover.create() makes an independent rover, deleted with its last reference.
     // TODO: multiple "instantiations" still yields Python objects with different identities ("Rover() is not Rover())...
-    py::class_<Rover, std::unique_ptr<Rover, py::nodelete>>(m, "Rover")
+    py::class_<Rover, std::shared_ptr<Rover>>(m, "Rover")
         .def(py::init([](){
-            return std::unique_ptr<Rover, py::nodelete>(Rover::getInstance());
+            return std::shared_ptr<Rover>(Rover::getInstance(),[](Rover *){});
         }))
+        .def_static("create", [](){
+            return std::make_shared<Rover>();
+        })
         .def_readwrite("legCollisionChecksEnabled", &Rover::legCollisionChecksEnabled)
         .def("getPairIdx", &Rover::getPairIdx, "wheelNumber"_a)
         .def("getWheelIdx", &Rover::getWheelIdx, "wheelnumber"_a)
         .def("isValid", &Rover::isValid)
-        .def_readwrite("comms", &Rover::comms)
-        .def("init", &Rover::init, "port"_a, "pp"_a=7)
+        .def("setMultiRead", &Rover::setMultiRead, "f"_a)
+        .def("setFraming", &Rover::setFraming, "f"_a)
+        .def("setFastConnect", &Rover::setFastConnect, "f"_a)
+        .def("setPipelineWindow", &Rover::setPipelineWindow, "n"_a)
+        .def("setReadPeriod", &Rover::setReadPeriod, "dataClass"_a, "secs"_a)
+        .def("getReadPeriod", &Rover::getReadPeriod, "dataClass"_a)
+        .def("requestRead", &Rover::requestRead, "dataClass"_a)
+        .def("getDataAge", &Rover::getDataAge, "dataClass"_a)
+        .def("getHistoryStats", [](Rover &r,int w,int t,int f,double secs){
+            checkHistory(w,t,f);
+            HistoryStats s;
+            r.getHistoryStats(w,t,f,secs,s);
+            return s;
+        }, "w"_a, "t"_a, "f"_a, "secs"_a)
+        .def("getHistoryLast", [](Rover &r,int w,int t,int f,int n){
+            // a list of (time,value) tuples, oldest first
+            checkHistory(w,t,f);
+            if(n>HISTORYSIZE)n=HISTORYSIZE;
+            float v[HISTORYSIZE];
+            double times[HISTORYSIZE];
+            n = r.getHistoryLast(w,t,f,n,v,times);
+            py::list l;
+            for(int i=0;i<n;i++)
+                l.append(py::make_tuple(times[i],v[i]));
+            return l;
+        }, "w"_a, "t"_a, "f"_a, "n"_a)
+        .def("isStale", &Rover::isStale, "dataClass"_a, "maxAge"_a)
+        .def("getTrajectory", &Rover::getTrajectory, py::return_value_policy::reference_internal)
+        .def("streamTrajectory", [](Rover &r){r.streamTrajectory();})
+        .def("setDeferWrites", &Rover::setDeferWrites, "f"_a)
+        .def("sync", &Rover::sync)
+        .def("setRequiredAll", [](Rover &r,int t,float v){
+            r.setRequiredAll(t,v);
+        }, "t"_a, "v"_a)
+        .def("setRequiredAll", [](Rover &r,int t,py::sequence s){
+            if(py::len(s)!=6)
+                throw py::value_error("six values are required");
+            float v[6];
+            for(int i=0;i<6;i++)
+                v[i] = s[i].cast<float>();
+            r.setRequiredAll(t,v);
+        }, "t"_a, "v"_a)
+        .def_readonly("comms", &Rover::comms)
+        .def("init", &Rover::init, "port"_a, "pp"_a=7, "baud"_a=DEFAULTBAUD)
         .def_static("getMotorTypeName", &Rover::getMotorTypeName) // TODO: OK? maybe copy policy?
         .def("resetExceptions", &Rover::resetExceptions)
         .def("update", &Rover::update)
         .def("getPair", &Rover::getPair, "n"_a, py::return_value_policy::reference_internal)
         .def("getMotor", &Rover::getMotor, "w"_a, "t"_a, py::return_value_policy::reference_internal)
-        .def("getMotorData", &Rover::getMotorData, "w"_a, "t"_a, py::return_value_policy::reference_internal)
-        .def("getDriveData", &Rover::getDriveData, "n"_a, py::return_value_policy::reference_internal)
-        .def("getSteerData", &Rover::getSteerData, "n"_a, py::return_value_policy::reference_internal)
-        .def("getLiftData", &Rover::getLiftData, "n"_a, py::return_value_policy::reference_internal)
+        .def("getMotorData", &Rover::getMotorData, "w"_a, "t"_a, py::keep_alive<0,1>())
+        .def("getDriveData", &Rover::getDriveData, "n"_a, py::keep_alive<0,1>())
+        .def("getSteerData", &Rover::getSteerData, "n"_a, py::keep_alive<0,1>())
+        .def("getLiftData", &Rover::getLiftData, "n"_a, py::keep_alive<0,1>())
         .def("getDrive", &Rover::getDrive, "n"_a, py::return_value_policy::reference_internal)
         .def("getSteer", &Rover::getSteer, "n"_a, py::return_value_policy::reference_internal)
         .def("getLift", &Rover::getLift, "n"_a, py::return_value_policy::reference_internal)
         .def("getMasterData", &Rover::getMasterData, py::return_value_policy::reference_internal)
         .def("calibrate", &Rover::calibrate)
+        .def("getSnapshot", [](Rover &r){
+            RoverSnapshot s;
+            r.getSnapshot(s);
+            return s;
+        })
+        .def("getSnapshotCount", &Rover::getSnapshotCount)
+        .def("getTelemetry", [](Rover &r){
+            r.lock();
+            RoverTelemetry t = *r.getTelemetry();
+            r.unlock();
+            return t;
+        })
+        .def("startAcquisition", &Rover::startAcquisition, "interval"_a,
+             "priority"_a=0, "cpu"_a=-1)
+        .def("getAcquisitionTimer", &Rover::getAcquisitionTimer,
+             py::return_value_policy::reference_internal)
+        .def("setClock", &Rover::setClock, "c"_a, py::keep_alive<1,2>())
+        .def("getClock", &Rover::getClock, py::return_value_policy::reference)
+        .def("stopAcquisition", &Rover::stopAcquisition,
+             py::call_guard<py::gil_scoped_release>())
+        .def("isAcquiring", &Rover::isAcquiring)
+        .def("lock", &Rover::lock, py::call_guard<py::gil_scoped_release>())
+        .def("unlock", &Rover::unlock)
+        .def("emergencyStop", &Rover::emergencyStop, py::call_guard<py::gil_scoped_release>())
         ;
 
     py::class_<SlaveProtocol>(m, "SlaveProtocol")
@@ -188,6 +436,17 @@ PYBIND11_MODULE(blodwen, m) {
         .def("add", &SlaveProtocol::add, "ptr"_a, "size"_a)
         .def("addByte", &SlaveProtocol::addByte, "b"_a)
         .def("send", &SlaveProtocol::send)
+        .def("setWindow", &SlaveProtocol::setWindow, "n"_a)
+        .def("getWindow", &SlaveProtocol::getWindow)
+        .def("sync", &SlaveProtocol::sync)
+        .def("emergencyStop", &SlaveProtocol::emergencyStop)
+        .def("getPendingCount", &SlaveProtocol::getPendingCount)
+        .def("isFramed", &SlaveProtocol::isFramed)
+        .def("ping", [](SlaveProtocol &p) {
+            uint8_t health;
+            return p.ping(&health) ? (int)health : -1;
+        })
+        .def("getBadFrameCount", &SlaveProtocol::getBadFrameCount)
         .def("readBlock", &SlaveProtocol::readBlock, "ptr"_a, "size"_a)
         ;
 
@@ -197,10 +456,25 @@ PYBIND11_MODULE(blodwen, m) {
         .def("init", &SlaveDevice::init, "_p"_a, "table"_a, "id"_a, py::return_value_policy::reference)  // TODO: not entirely sure about policy
         .def("startWrites", &SlaveDevice::startWrites)
         .def("endWrites", &SlaveDevice::endWrites)
-        .def("writeInt", &SlaveDevice::writeInt, "reg"_a, "val"_a)
+        .def("endWritesPipelined", &SlaveDevice::endWritesPipelined)
+        .def("setDeferWrites", &SlaveDevice::setDeferWrites, "f"_a)
+        .def("hasHeldWrites", &SlaveDevice::hasHeldWrites)
+        .def("setVolatile", &SlaveDevice::setVolatile, "r"_a)
+        .def("invalidateShadow", &SlaveDevice::invalidateShadow)
+        .def("getSuppressedWriteCount", &SlaveDevice::getSuppressedWriteCount)
+        .def("writeInt", static_cast<void (SlaveDevice::*)(uint8_t,uint16_t)>(&SlaveDevice::writeInt), "reg"_a, "val"_a)
         .def("writeFloat", &SlaveDevice::writeFloat, "r"_a, "v"_a)
         .def("resetExceptions", &SlaveDevice::resetExceptions)
-//        .def("setReadSet", &SlaveDevice::setReadSet) // FIXME: Can't deal with va_args
+        .def("setReadSet", [](SlaveDevice &d,int set,py::sequence s){
+            int n = py::len(s);
+            if(n>READSETSIZE)
+                throw py::value_error("read set too large");
+            uint8_t r[READSETSIZE];
+            for(int i=0;i<n;i++)
+                r[i] = s[i].cast<uint8_t>();
+            d.setReadSet(set,r,n);
+        }, "set"_a, "regs"_a)
+        .def("invalidateReadSets", &SlaveDevice::invalidateReadSets)
         .def("readRegs", &SlaveDevice::readRegs, "set"_a)
         .def("getRegInt", &SlaveDevice::getRegInt, "n"_a)
         .def("getRegFloat", &SlaveDevice::getRegFloat, "n"_a)
@@ -233,7 +507,7 @@ PYBIND11_MODULE(blodwen, m) {
         .def("tickSim", &SerialComms::tickSim)
         .def("pollSim", &SerialComms::pollSim)
         .def("simConnect", &SerialComms::simConnect, "s"_a)
-        .def("connect", &SerialComms::connect, "dev"_a, "baudRate"_a)
+        .def("connect", &SerialComms::connect, "dev"_a, "baudRate"_a, "reset"_a=true)
         .def("setTimeout", &SerialComms::setTimeout, "sec"_a, "usec"_a)
         .def("disconnect", &SerialComms::disconnect)
         .def("write", &SerialComms::write, "s"_a, "ct"_a)
@@ -242,6 +516,9 @@ PYBIND11_MODULE(blodwen, m) {
         .def("read", &SerialComms::read, "buf"_a, "ct"_a)
         .def("isReady", &SerialComms::isReady)
         .def("readLine", &SerialComms::readLine, "buf"_a, "maxlen"_a)
+        .def("startIOThread", &SerialComms::startIOThread)
+        .def("stopIOThread", &SerialComms::stopIOThread)
+        .def("isIOThreadRunning", &SerialComms::isIOThreadRunning)
         ;
 
     py::register_exception<RoverException>(m, "RoverException");
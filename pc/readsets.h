@@ -0,0 +1,143 @@
+/**
+ * \file
+ * The read sets used by the board data classes. Each read set is
+ * defined once, as a list of registers and where their values go, and
+ * everything else is built from that list: the register numbers sent
+ * to the master, the layout of the reply, and a decoder which copies
+ * the reply straight into the data object in a single pass, with
+ * the mapping of each register known at compile time (see regtypes.h).
+ * The decoders are attached to the slave devices, which call them
+ * when a reply arrives.
+ */
+
+#ifndef __READSETS_H
+#define __READSETS_H
+
+#include <stddef.h>
+#include "slave.h"
+
+/// A read set list is a macro which takes a macro X and calls it
+/// for each register as X(table,register,destination), where the
+/// register number is REG<table>_<register> and its type
+/// Reg<table><REG<table>_<register>>; the table is empty for the
+/// common registers. The destination is an expression in a member of
+/// the data object: either one of its members, or a slot in the
+/// rover's telemetry store for one of its motors (see telemetry.h).
+
+// drive/steer boards
+
+#define READSET_DS_ACTUAL(X) \
+    X(, TIMER, timer) \
+    X(, STATUS, status) \
+    X(, EXCEPTIONDATA, exceptionData) \
+    X(DS, CHASSIS, chassis) \
+    X(DS, DRIVE_ACTUALSPEED, tel->actual[DRIVE][wheel]) \
+    X(DS, DRIVE_ODO, tel->odometer[wheel]) \
+    X(DS, STEER_ACTUALPOS, tel->actual[STEER][wheel])
+
+#define READSET_DS_CURRENT(X) \
+    X(DS, DRIVE_CURRENT, tel->current[DRIVE][wheel]) \
+    X(DS, STEER_CURRENT, tel->current[STEER][wheel])
+
+#define READSET_DS_PID(X) \
+    X(, INTERVALI2C, interval) \
+    X(DS, DRIVE_ERROR, tel->error[DRIVE][wheel]) \
+    X(DS, DRIVE_ERRORINTEGRAL, tel->errorIntegral[DRIVE][wheel]) \
+    X(DS, DRIVE_ERRORDERIV, tel->errorDeriv[DRIVE][wheel]) \
+    X(DS, DRIVE_CONTROL, tel->control[DRIVE][wheel]) \
+    X(DS, DRIVE_INTERVALCTRL, tel->intervalCtrl[DRIVE][wheel]) \
+    X(DS, STEER_ERROR, tel->error[STEER][wheel]) \
+    X(DS, STEER_ERRORINTEGRAL, tel->errorIntegral[STEER][wheel]) \
+    X(DS, STEER_ERRORDERIV, tel->errorDeriv[STEER][wheel]) \
+    X(DS, STEER_CONTROL, tel->control[STEER][wheel]) \
+    X(DS, STEER_INTERVALCTRL, tel->intervalCtrl[STEER][wheel])
+
+// lift/lift boards
+
+#define READSET_LL_ACTUAL(X) \
+    X(, TIMER, timer) \
+    X(, STATUS, status) \
+    X(, EXCEPTIONDATA, exceptionData) \
+    X(LL, ONE_ACTUALPOS, tel->actual[LIFT][wheel]) \
+    X(LL, TWO_ACTUALPOS, tel->actual[LIFT][wheel+1])
+
+#define READSET_LL_CURRENT(X) \
+    X(LL, ONE_CURRENT, tel->current[LIFT][wheel]) \
+    X(LL, TWO_CURRENT, tel->current[LIFT][wheel+1])
+
+#define READSET_LL_PID(X) \
+    X(, INTERVALI2C, interval) \
+    X(LL, ONE_ERROR, tel->error[LIFT][wheel]) \
+    X(LL, ONE_ERRORINTEGRAL, tel->errorIntegral[LIFT][wheel]) \
+    X(LL, ONE_ERRORDERIV, tel->errorDeriv[LIFT][wheel]) \
+    X(LL, ONE_CONTROL, tel->control[LIFT][wheel]) \
+    X(LL, ONE_INTERVALCTRL, tel->intervalCtrl[LIFT][wheel]) \
+    X(LL, TWO_ERROR, tel->error[LIFT][wheel+1]) \
+    X(LL, TWO_ERRORINTEGRAL, tel->errorIntegral[LIFT][wheel+1]) \
+    X(LL, TWO_ERRORDERIV, tel->errorDeriv[LIFT][wheel+1]) \
+    X(LL, TWO_CONTROL, tel->control[LIFT][wheel+1]) \
+    X(LL, TWO_INTERVALCTRL, tel->intervalCtrl[LIFT][wheel+1])
+
+// the master
+
+#define READSET_MASTER_ACTUAL(X) \
+    X(MASTER, EXCEPTIONDATA, exceptionData)
+
+#define READSET_MASTER_TEMP(X) \
+    X(MASTER, TEMPAMBIENT, temps[0]) \
+    X(MASTER, TEMP1, temps[1]) \
+    X(MASTER, TEMP2, temps[2]) \
+    X(MASTER, TEMP3, temps[3]) \
+    X(MASTER, TEMP4, temps[4]) \
+    X(MASTER, TEMP5, temps[5]) \
+    X(MASTER, TEMP6, temps[6]) \
+    X(MASTER, TEMP7, temps[7]) \
+    X(MASTER, TEMP8, temps[8]) \
+    X(MASTER, TEMP9, temps[9])
+
+
+// the pieces each read set is built from, one per register. The
+// table and register are only ever pasted, so they can't be expanded
+// as macros themselves.
+
+#define READSET_COUNT(t,n,d) +1
+#define READSET_REG(t,n,d) REG##t##_##n,
+#define READSET_FIELD(t,n,d) uint8_t reg_##n[Reg##t<REG##t##_##n>::size];
+#define READSET_DECODE(t,n,d) \
+    d = RegCodec<Reg##t<REG##t##_##n>>::decode(p+offsetof(Layout,reg_##n));
+
+/// define a read set in the class of the data object it decodes
+/// into, given its name, its list and the class. This is a nested
+/// struct called name, which has
+/// - Layout, the bytes of the reply in order, so sizeof(Layout) is
+///   the size of the reply;
+/// - count, the number of registers;
+/// - getRegs(), the register numbers;
+/// - decode(), which decodes a reply into a data object;
+/// and a member of the class, decode<name>(), which does the work.
+#define READSET(name,list,dest) \
+    struct name { \
+        struct Layout { list(READSET_FIELD) }; \
+        enum { count = 0 list(READSET_COUNT) }; \
+        static_assert(count<=READSETSIZE,"read set too large"); \
+        static const uint8_t *getRegs(){ \
+            static const uint8_t regs[] = { list(READSET_REG) }; \
+            return regs; \
+        } \
+        static void decode(dest *o,const uint8_t *p){ \
+            o->decode##name(p); \
+        } \
+    }; \
+    void decode##name(const uint8_t *p){ \
+        typedef name::Layout Layout; \
+        list(READSET_DECODE) \
+    }
+
+/// send a read set (defined with READSET) to a slave device, and
+/// attach its decoder for a data object.
+template <class S,class T> void useReadSet(SlaveDevice *slave,int set,T *o){
+    slave->setReadSet(set,S::getRegs(),S::count);
+    slave->setReadSetDecoder(set,[o](const uint8_t *p){S::decode(o,p);});
+}
+
+#endif /* __READSETS_H */
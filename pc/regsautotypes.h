@@ -0,0 +1 @@
+../firmware/common/regsautotypes.h
\ No newline at end of file
@@ -0,0 +1,145 @@
+/**
+ * \file
+ * Compile-time register descriptors for the PC library. Each register
+ * in each table has a type, such as RegDS<REGDS_DRIVE_ACTUALSPEED>,
+ * which knows the register's number, size, writability and mapping;
+ * the registers common to all tables also have types like
+ * Reg<REG_TIMER>. These are generated by regparse.hs into
+ * regsautotypes.h, and are used with SlaveDevice's read<>() and
+ * write<>() accessors. Because the mapping is known at compile time,
+ * decoding a value is just a multiply and an add, with no table lookup
+ * or branch; and writing to a read-only register, or writing a float
+ * to an unmapped register, won't compile.
+ */
+
+#ifndef __REGTYPES_H
+#define __REGTYPES_H
+
+#include <type_traits>
+#include "regs.h"
+#include "regsauto.h"
+
+/// the base of each register descriptor R, which gives the range
+/// as R::minval() and R::maxval(). The rest is worked out from those
+/// in the same way as Register::map() and Register::unmap().
+template <class R,int N,int Size,bool Writable> struct RegisterType {
+    enum {
+        reg=N, //!< the register number
+        size=Size, //!< width in bytes
+        writable=Writable //!< can the PC write it?
+    };
+
+    /// is the register mapped onto a float range?
+    static constexpr bool mapped(){
+        return R::minval()!=R::maxval();
+    }
+
+    /// the raw value the top of the range maps to - see the note
+    /// on -2 in Register::unmap()
+    static constexpr float steps(){
+        return (float)((1L<<(Size*8))-2);
+    }
+
+    /// multiply a raw value by this...
+    static constexpr float scale(){
+        return mapped() ? (R::maxval()-R::minval())/steps() : 1.0f;
+    }
+
+    /// ...and add this to get the float value
+    static constexpr float offset(){
+        return mapped() ? R::minval() : 0.0f;
+    }
+
+    /// the width of the range
+    static constexpr float range(){
+        return R::maxval()-R::minval();
+    }
+};
+
+/// get the raw value of a register of a given size from the bytes
+/// of a reply, least significant first
+template <int Size> inline uint16_t unpackReg(const uint8_t *p);
+template <> inline uint16_t unpackReg<1>(const uint8_t *p){
+    return p[0];
+}
+template <> inline uint16_t unpackReg<2>(const uint8_t *p){
+    return p[0]|(p[1]<<8);
+}
+
+/// decodes a register R from the bytes of a reply: a mapped register
+/// gives a float, an unmapped one its raw value.
+template <class R,bool Mapped=R::mapped()> struct RegCodec {
+    static float decode(const uint8_t *p){
+        constexpr float scale = R::scale();
+        constexpr float offset = R::offset();
+        return unpackReg<R::size>(p)*scale+offset;
+    }
+};
+template <class R> struct RegCodec<R,false> {
+    static uint16_t decode(const uint8_t *p){
+        return unpackReg<R::size>(p);
+    }
+};
+
+/// declare the descriptor template for a register table; only the
+/// registers in the table are defined, so any other number is an error
+#define REGTABLE(table) template <int N> struct Reg##table;
+
+/// define the descriptor for a register in a table
+#define REGTYPE(table,n,sz,w,mn,mx) \
+    template <> struct Reg##table<n> : \
+    RegisterType<Reg##table<n>,n,sz,w> { \
+        static constexpr float minval(){return mn;} \
+        static constexpr float maxval(){return mx;} \
+    };
+
+#include "regsautotypes.h"
+
+/// is a descriptor defined? Only the registers in a table are.
+template <class T,class=void> struct IsRegTypeDefined : std::false_type {};
+template <class T> struct IsRegTypeDefined<T,decltype(void(sizeof(T)))> :
+    std::true_type {};
+
+/// does a table T have descriptors for exactly the registers below N?
+template <template <int> class T,int N> struct HasRegTypes {
+    static constexpr bool value = IsRegTypeDefined<T<N-1>>::value &&
+          HasRegTypes<T,N-1>::value;
+};
+template <template <int> class T> struct HasRegTypes<T,0> {
+    static constexpr bool value = true;
+};
+
+// check the descriptors against the register counts in regsauto.h
+static_assert(HasRegTypes<RegDS,NUMREGS_DS>::value &&
+              !IsRegTypeDefined<RegDS<NUMREGS_DS>>::value,
+              "regsautotypes.h doesn't match regsauto.h for DS: rerun regparse.hs");
+static_assert(HasRegTypes<RegLL,NUMREGS_LL>::value &&
+              !IsRegTypeDefined<RegLL<NUMREGS_LL>>::value,
+              "regsautotypes.h doesn't match regsauto.h for LL: rerun regparse.hs");
+static_assert(HasRegTypes<RegMASTER,NUMREGS_MASTER>::value &&
+              !IsRegTypeDefined<RegMASTER<NUMREGS_MASTER>>::value,
+              "regsautotypes.h doesn't match regsauto.h for MASTER: rerun regparse.hs");
+
+/// check the size, writability and range of every descriptor against
+/// the register tables in regsauto.cpp, which can't be done at compile
+/// time. Returns NULL if they agree, or the name of the first register
+/// which doesn't. Rover::init() does this.
+inline const char *checkRegisterTypes(){
+    // the common registers come first in the DS table (and the LL)
+    const Register *registerTable_ = registerTable_DS;
+    const Register *r;
+#undef REGTABLE
+#undef REGTYPE
+#define REGTABLE(table)
+#define REGTYPE(table,n,sz,w,mn,mx) \
+    r = registerTable_##table+n; \
+    if(r->getSize()!=sz || r->writable()!=w || \
+       r->minval!=(float)mn || r->maxval!=(float)mx) \
+        return #table " " #n;
+#include "regsautotypes.h"
+#undef REGTABLE
+#undef REGTYPE
+    return NULL;
+}
+
+#endif /* __REGTYPES_H */
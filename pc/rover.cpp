@@ -10,8 +10,6 @@
 
 Rover *Rover::instance = NULL;
 
-uint8_t SlaveDevice::readSet[READSETS][READSETSIZE];
-uint8_t SlaveDevice::readSetCt[READSETS];
 
 
 inline bool isPositive(float angle){
@@ -22,27 +20,16 @@ inline bool isNegative(float angle){
     return angle<-5;
 }
 
-inline bool isLiftRequestedPositive(int wheel){
-    if(wheel<0)return false;
-    Rover *r = Rover::getInstance();
-    LiftMotor *m = r->getLift(wheel);
-    return isPositive(m->getRequired());
-}
-inline bool isLiftRequestedNegative(int wheel){
-    if(wheel<0)return false;
-    Rover *r = Rover::getInstance();
-    LiftMotor *m = r->getLift(wheel);
-    return isNegative(m->getRequired());
-}
-
-
-bool LiftMotor::isAdjacencyViolated(float req){
-    if(!Rover::getInstance()->legCollisionChecksEnabled)
+/// would a lift position on a wheel of a rover collide with the adjacent
+/// wheels, given the lift positions of all the wheels (indexed by wheel
+/// number minus one)?
+static bool isLiftAdjacencyViolated(Rover *r,int wheel,float req,const float *reqs){
+    if(!r->legCollisionChecksEnabled)
 	return false;
 
     // first, find the two adjacent wheels (or perhaps just one)
     int forw=-1,back=-1;
-    switch(wheelNumber){
+    switch(wheel){
         case 1:forw=3;break;
         case 2:forw=4;break;
         case 3:forw=5;back=1;break;
@@ -53,14 +40,101 @@ bool LiftMotor::isAdjacencyViolated(float req){
     
     //positive angles tilt the wheel towards the front
     
-    if(isPositive(req) && isLiftRequestedNegative(forw))
+    if(isPositive(req) && forw>=0 && isNegative(reqs[forw-1]))
         return true;
-    else if(isNegative(req) && isLiftRequestedPositive(back))
+    else if(isNegative(req) && back>=0 && isPositive(reqs[back-1]))
         return true;
     else
         return false;
 }
 
+bool LiftMotor::isAdjacencyViolated(float req){
+    if(!rover)
+        return false;
+    float reqs[6];
+    for(int w=1;w<=6;w++)
+        reqs[w-1] = rover->getLift(w)->getRequired();
+    return isLiftAdjacencyViolated(rover,wheelNumber,req,reqs);
+}
+
+void Rover::setRequiredAll(int type,const float *v){
+    // check everything first, so nothing is sent if anything is
+    // wrong. The lifts move together, so each is checked against
+    // the others' new positions rather than their current ones.
+    for(int w=1;w<=6;w++){
+        if(type==LIFT){
+            getLift(w)->checkRange(v[w-1]);
+            if(isLiftAdjacencyViolated(this,w,v[w-1],v))
+                throw ConstraintException("lift motor collision possibility");
+        } else
+            getMotor(w,type)->checkRequired(v[w-1]);
+    }
+    
+    MultiWrite mw(&protocol);
+    for(int w=1;w<=6;w++){
+        Motor *m = getMotor(w,type);
+        mw.add(m->getSlave());
+        m->writeRequired(v[w-1]);
+    }
+    mw.send();
+}
+
+void Rover::streamTrajectory(double t){
+    if(!valid || !trajectory->isRunning())
+        return;
+    float v[3][6];
+    int mask = trajectory->evaluate(t,v);
+
+    // the lifts are checked against each other's new positions, or
+    // their current ones if they aren't on the trajectory
+    float lifts[6];
+    for(int w=1;w<=6;w++){
+        lifts[w-1] = (mask & (1<<(LIFT*6+w-1))) ?
+              v[LIFT][w-1] : getLift(w)->getRequired();
+    }
+
+    // drop the values which haven't changed, and check the rest
+    // before sending anything
+    try {
+        for(int type=0;type<3;type++){
+            for(int w=1;w<=6;w++){
+                int bit = 1<<(type*6+w-1);
+                if(!(mask & bit))continue;
+                float req = v[type][w-1];
+                if(req==getMotor(w,type)->getRequired()){
+                    mask &= ~bit;
+                    continue;
+                }
+                if(type==LIFT){
+                    getLift(w)->checkRange(req);
+                    if(isLiftAdjacencyViolated(this,w,req,lifts))
+                        throw ConstraintException("lift motor collision possibility");
+                } else
+                    getMotor(w,type)->checkRequired(req);
+            }
+        }
+    } catch(ConstraintException &e){
+        trajectory->stop();
+        throw;
+    }
+
+    if(mask){
+        MultiWrite mw(&protocol);
+        for(int type=0;type<3;type++){
+            for(int w=1;w<=6;w++){
+                if(!(mask & (1<<(type*6+w-1))))continue;
+                Motor *m = getMotor(w,type);
+                mw.add(m->getSlave());
+                m->writeRequired(v[type][w-1]);
+            }
+        }
+        mw.send();
+    }
+
+    if(trajectory->isFinished())
+        trajectory->stop();
+}
+
 
 void Rover::calibrate(){
     
@@ -106,7 +180,7 @@ void Rover::calibrate(){
         p->iCap=0;
         p->iDecay=0;
         s->sendParams();
-        usleep(50000); // delay to set things settle
+        clock->sleepFor(0.05); // delay to set things settle
         p->pGain = 0;
         p->iGain = 2;
         p->dGain = 0;
@@ -127,7 +201,7 @@ void Rover::calibrate(){
         p->iCap=0;
         p->iDecay=0;
         l->sendParams();
-        usleep(50000); // delay to set things settle
+        clock->sleepFor(0.05); // delay to set things settle
         p->pGain = 0;
         p->iGain = 5;
         p->dGain = 0;
@@ -19,13 +19,15 @@
 #include "lift.h"
 #include "motordata.h"
 #include "master.h"
+#include "snapshot.h"
+#include "history.h"
+#include "trajectory.h"
+#include "rtloop.h"
 
 #include "sim.h"
 
-    
-static const int DRIVE = 0; //!< value for getMotor() etc.
-static const int STEER = 1; //!< value for getMotor() etc.
-static const int LIFT = 2; //!< value for getMotor() etc.
+#include <algorithm>
+
     
     
 
@@ -64,6 +66,14 @@ public:
 
           
     
+    /// set whether writes are held until the next read on all
+    /// slaves for this pair
+    void setDeferWrites(bool f){
+        devs[0].setDeferWrites(f);
+        devs[1].setDeferWrites(f);
+        devs[2].setDeferWrites(f);
+    }
+    
     /// get the chassis pot value for this wheel pair -
     /// this is undefined until update()
     float getChassisValue(){
@@ -71,10 +81,19 @@ public:
         return dsData[0]->chassis;
     }
     
-    WheelPair(){
-        dsData[0] = new DriveSteerMotorDriverData(devs+0);
-        dsData[1] = new DriveSteerMotorDriverData(devs+1);
-        llData = new LiftMotorDriverData(&devs[2]);
+    /// get the status register of a board from the last update
+    /// @param n The device index, 0-2.
+    int getStatus(int n){
+        return n==2 ? llData->status : dsData[n]->status;
+    }
+    
+    /// set up a pair whose boards decode into a rover's telemetry
+    /// store, given the pair number (0-2), or into their own if
+    /// there's no rover
+    WheelPair(RoverTelemetry *t=NULL,int pairIdx=0){
+        dsData[0] = new DriveSteerMotorDriverData(devs+0,t,pairIdx*2);
+        dsData[1] = new DriveSteerMotorDriverData(devs+1,t,pairIdx*2+1);
+        llData = new LiftMotorDriverData(&devs[2],t,pairIdx*2);
         
         driveMotors[0] = new DriveMotor(devs+0);
         driveMotors[1] = new DriveMotor(devs+1);
@@ -83,6 +102,16 @@ public:
         liftMotors[0] = new LiftMotor(devs+2,0);
         liftMotors[1] = new LiftMotor(devs+2,1);
     }
+    
+    ~WheelPair(){
+        for(int i=0;i<2;i++){
+            delete dsData[i];
+            delete driveMotors[i];
+            delete steerMotors[i];
+            delete liftMotors[i];
+        }
+        delete llData;
+    }
         
     
     /// initialise all the systems and connect, using
@@ -110,8 +139,9 @@ public:
     }
     
     /// send commands to set up the register reads for
-    /// each board - if you set a new read set directly
-    /// you MUST call this again before calling update().
+    /// each board. Read sets the master already has for a
+    /// board aren't sent again, so this is cheap if nothing
+    /// has changed.
     
     void setReadSets(){
         dsData[0]->init();
@@ -119,17 +149,51 @@ public:
         llData->init();
     }
     
-    /// update all device data
+    /// update the given classes of device data (a mask with bit n
+    /// set for class n), or all of it
     
-    void update(){
-        dsData[0]->update();
-        dsData[1]->update();
-        llData->update();
+    void update(int mask=DATA_ALL){
+        dsData[0]->update(mask);
+        dsData[1]->update(mask);
+        llData->update(mask);
+    }
+    
+    /// start pipelined reads of the given classes of device data,
+    /// which will be decoded as the replies arrive
+    void updatePipelined(int mask=DATA_ALL){
+        dsData[0]->updatePipelined(mask);
+        dsData[1]->updatePipelined(mask);
+        llData->updatePipelined(mask);
+    }
+    
+    /// add reads for the given classes of device data to a multiple read
+    void addReads(MultiRead &mr,int mask=DATA_ALL){
+        dsData[0]->addReads(mr,mask);
+        dsData[1]->addReads(mr,mask);
+        llData->addReads(mr,mask);
     }
     
-    /// access to the individual boards may be required;
-    /// if you use setReadSet() on the device, be sure
-    /// to call setReadSets() afterwards.
+    /// how old the oldest data of a class on this pair's boards was at
+    /// a given monotonic time, in seconds
+    double getAge(int dataClass,double now){
+        double a = dsData[0]->getAge(dataClass,now);
+        a = std::max(a,dsData[1]->getAge(dataClass,now));
+        return std::max(a,llData->getAge(dataClass,now));
+    }
+    
+    /// update the given classes of device data from a multiple
+    /// read which has been done
+    void decode(int mask=DATA_ALL){
+        dsData[0]->decode(mask);
+        dsData[1]->decode(mask);
+        llData->decode(mask);
+    }
+    
+    /// access to the individual boards may be required.
+    /// Each board has its own read sets, so setting one on
+    /// a board doesn't affect the others, but don't change
+    /// the ones update() uses (those below READSET_SPARE)
+    /// without calling setReadSets() afterwards.
     /// @param n The device index, 0-2.
    
     SlaveDevice *getDevice(int n){
@@ -152,10 +216,10 @@ public:
         }
     }
     
-    /// get a pointer to a given motor monitoring data block, given the type and the motor number - 
+    /// get a given motor's monitoring data, given the type and the motor number - 
     /// alternatively use getDriveData(), getSteerData() or getLiftData()
     
-    MotorData *getMotorData(int n,int type){
+    MotorData getMotorData(int n,int type){
         switch(type){
         case DRIVE:
             return getDriveData(n);
@@ -163,30 +227,39 @@ public:
             return getSteerData(n);
         case LIFT:
             return getLiftData(n);
-        default:return NULL;
+        default:
+            throw RoverException("bad motor type");
         }
     }
     
     
-    /// get a pointer to the monitoring data for a given drive motor
+    /// get the board data object which reads a given motor, which
+    /// says when each class of its data was read
+    /// @param n motor number 0-1
+    /// @param type motor type
+    MotorDriverData *getDriverData(int n,int type){
+        return type==LIFT ? (MotorDriverData *)llData : dsData[n];
+    }
+    
+    /// get the monitoring data for a given drive motor
     /// @param n drive motor number 0-1
     
-    DriveMotorData *getDriveData(int n){
-        return &(dsData[n]->drive);
+    DriveMotorData getDriveData(int n){
+        return dsData[n]->getDrive();
     }
     
-    /// get a pointer to the monitoring data for a given steer motor
+    /// get the monitoring data for a given steer motor
     /// @param n steer motor number 0-1
     
-    SteerMotorData *getSteerData(int n){
-        return &(dsData[n]->steer);
+    SteerMotorData getSteerData(int n){
+        return dsData[n]->getSteer();
     }
     
-    /// get a pointer to the monitoring data for a given lift motor
+    /// get the monitoring data for a given lift motor
     /// @param n lift motor number 0-1
     
-    LiftMotorData *getLiftData(int n){
-        return &(llData->data[n]);
+    LiftMotorData getLiftData(int n){
+        return llData->getLift(n);
     }
     
     /// get a pointer to a given drive motor
@@ -214,20 +287,75 @@ public:
 
 
 
-/// This is the top level rover class! To create one, call Rover *r =
-/// Rover::getInstance() which will create a rover if one doesn't exist, and
-/// then return the pointer. Subsequent calls will return the same pointer. 
+/// This is the top level rover class! Most programs only have one, and
+/// for them Rover *r = Rover::getInstance() will create a rover if one
+/// doesn't exist, and then return the pointer. Subsequent calls will
+/// return the same pointer. Rovers can also be created directly, and
+/// any number of them (each with its own simulator or port) can run
+/// in one process, each used by its own thread.
 
 class Rover {
-    /// it's a singleton, so the ctor should be private
-    Rover(){
+public:
+    Rover() : pair{{&telemetry,0},{&telemetry,1},{&telemetry,2}},
+              multiRead(&protocol) {
         legCollisionChecksEnabled=false;
         valid = false;
+        multiReadEnabled = true;
+        framingEnabled = true;
+        fastConnectEnabled = false;
+        deferWrites = false;
+        forcedReads = 0;
+        sweeps = 0;
+        history = new TelemetryHistory();
+        trajectory = new TrajectoryQueue();
+        clock = getDefaultClock();
+        acqActive = false;
+        acqPriority = 0;
+        acqCPU = -1;
+        // recursive, so that emergencyStop() can be called by a
+        // thread which already holds it
+        pthread_mutexattr_t attr;
+        pthread_mutexattr_init(&attr);
+        pthread_mutexattr_settype(&attr,PTHREAD_MUTEX_RECURSIVE);
+        pthread_mutex_init(&mutex,&attr);
+        pthread_mutexattr_destroy(&attr);
+        for(int i=0;i<DATACLASSES;i++){
+            readPeriod[i]=0;
+            lastRead[i]=-1e30;
+        }
+        // the master only updates a temperature every two seconds
+        readPeriod[DATA_TEMP]=2;
+        masterData = NULL;
+        ownSim = NULL;
+        pairsPresent = 0;
+        
+        // each lift motor knows its own wheel number and the
+        // rover, so we can check lift constraints
+        for(int i=1;i<=6;i++){
+            LiftMotor *lift = getLift(i);
+            lift->wheelNumber = i;
+            lift->rover = this;
+        }
     }
     
-    /// the single instance
+    /// stops the acquisition thread and disconnects
+    ~Rover(){
+        stopAcquisition();
+        comms.disconnect();
+        delete ownSim;
+        delete masterData;
+        delete history;
+        delete trajectory;
+        pthread_mutex_destroy(&mutex);
+    }
+    
+private:
+    /// the single instance returned by getInstance()
     static Rover *instance;
     
+    /// the simulator init() created, if any
+    RoverSimulator *ownSim;
+    
     /// each of these is a pair of wheels
     WheelPair pair[3];
     /// this is the protocol wrapper around the comms
@@ -247,6 +375,200 @@ class Rover {
     /// pointer to the master's data block
     MasterData *masterData;
     
+    /// the telemetry of all the motors, which the boards decode into
+    RoverTelemetry telemetry;
+    
+    /// the multiple read used to read everything in update()
+    MultiRead multiRead;
+    
+    /// if true, update() reads all devices in a single exchange
+    bool multiReadEnabled;
+    
+    /// if true, init() asks the master for framed messages
+    bool framingEnabled;
+    
+    /// if true, init() tries to use an already running master
+    bool fastConnectEnabled;
+    
+    /// true if writes are held until the next update()
+    bool deferWrites;
+    
+    /// how often update() reads each class of data, in seconds:
+    /// zero is every update, negative is never
+    double readPeriod[DATACLASSES];
+    /// when each class of data was last read
+    double lastRead[DATACLASSES];
+    /// classes to read on the next update() whether due or not
+    int forcedReads;
+    
+    /// the recent history of the motor data
+    TelemetryHistory *history;
+    
+    /// add the data just read to the history
+    /// @param mask the classes of data which were read
+    void recordHistory(int mask){
+        for(int w=1;w<=6;w++){
+            int p = getPairIdx(w-1);
+            if(!(pairsPresent & (1<<p)))
+                continue;
+            for(int t=0;t<3;t++){
+                MotorDriverData *dd = pair[p].getDriverData(getWheelIdx(w-1),t);
+                history->record(w,t,mask,getMotorData(w,t),dd->samples);
+            }
+        }
+    }
+    
+    /// the trajectories being sent by streamTrajectory()
+    TrajectoryQueue *trajectory;
+    
+    /// snapshots of the state, published after each update
+    SeqLock<RoverSnapshot> snapshots;
+    /// number of updates done
+    uint32_t sweeps;
+    
+    /// lock held around anything which talks to the rover while
+    /// the acquisition thread is running
+    pthread_mutex_t mutex;
+    /// the acquisition thread
+    pthread_t acqThread;
+    /// true if the acquisition thread is running
+    bool acqActive;
+    /// cleared to stop the acquisition thread
+    std::atomic<bool> acqRunning;
+    /// times the acquisition thread's updates
+    PeriodicLoop acqTimer;
+    /// SCHED_FIFO priority of the acquisition thread, or 0
+    int acqPriority;
+    /// the CPU the acquisition thread runs on, or -1
+    int acqCPU;
+    
+    static void *acqThreadFunc(void *p){
+        ((Rover *)p)->acqLoop();
+        return NULL;
+    }
+    
+    /// the acquisition thread's loop - updates at regular intervals,
+    /// dropping ticks rather than trying to catch up if it overruns.
+    void acqLoop(){
+        if(acqPriority || acqCPU>=0){
+            const char *err = PeriodicLoop::makeRealtime(acqPriority,acqCPU,false);
+            if(err)
+                comms.notifyMessage("acquisition thread: %s",err);
+        }
+        acqTimer.start();
+        while(acqRunning.load()){
+            lock();
+            try {
+                try {
+                    streamTrajectory();
+                } catch(StopRequestedException &e){
+                    throw;
+                } catch(RoverException &e){
+                    comms.notifyMessage("error in trajectory: %s",e.what());
+                }
+                update();
+            } catch(StopRequestedException &e){
+                // an emergency stop is waiting for the lock
+            } catch(RoverException &e){
+                comms.notifyMessage("error in acquisition: %s",e.what());
+            }
+            unlock();
+            acqTimer.wait();
+        }
+    }
+    
+    /// copy the current state into a snapshot and publish it
+    void publishSnapshot(){
+        RoverSnapshot s = RoverSnapshot();
+        s.sweep = sweeps;
+        for(int w=1;w<=6;w++){
+            for(int t=0;t<3;t++)
+                s.required[t][w-1] = getMotor(w,t)->getRequired();
+        }
+        for(int i=0;i<3;i++){
+            if(pairsPresent & (1<<i)){
+                s.chassis[i] = pair[i].getChassisValue();
+                for(int j=0;j<3;j++)
+                    s.status[i*3+j] = pair[i].getStatus(j);
+            }
+        }
+        s.telemetry = telemetry;
+        memcpy(s.temps,masterData->temps,sizeof(s.temps));
+        s.tempSample = masterData->samples[DATA_TEMP];
+        s.exceptionType = masterData->exceptionType;
+        s.exceptionSlave = masterData->exceptionSlave;
+        s.exceptionMotor = masterData->exceptionMotor;
+        snapshots.write(s);
+    }
+    
+    /// the clock everything is timed on
+    Clock *clock;
+    
+    /// monotonic time in seconds, on our clock
+    double now(){
+        return clock->now();
+    }
+    
+    /// work out which classes of data are due to be read at a given
+    /// time, as a mask
+    int getDueClasses(double t){
+        int mask = forcedReads;
+        for(int i=0;i<DATACLASSES;i++){
+            if(readPeriod[i]>=0 && t-lastRead[i]>=readPeriod[i])
+                mask |= 1<<i;
+        }
+        // held writes go out with a read, so there must be one
+        if(!mask && deferWrites)
+            mask = 1<<DATA_ACTUAL;
+        return mask;
+    }
+    
+    /// connect without resetting the master, returning true if it
+    /// is there and healthy.
+    bool fastConnect(const char *port,int baud){
+        comms.connect(port,baud,false);
+        if(!comms.isReady())
+            return false;
+        protocol.init(&comms);
+        uint8_t health;
+        comms.setTimeout(0,200000); // it's there or it isn't
+        bool ok = protocol.ping(&health);
+        comms.setTimeout(1,0);
+        if(!ok){
+            comms.notifyMessage("no reply to ping, resetting master");
+            return false;
+        }
+        if(health){
+            comms.notifyMessage("master not healthy (%x), resetting",health);
+            return false;
+        }
+        return true;
+    }
+    
+    /// stop each slave in turn with a write to its exception register,
+    /// which raises a remote exception on it, for masters which don't
+    /// know the emergency stop command. Every slave is tried even if
+    /// some fail, and the first error is thrown at the end.
+    void stopEachSlave(){
+        bool failed=false;
+        char err[256];
+        for(int i=0;i<3;i++){
+            if(!(pairsPresent & (1<<i)))continue;
+            for(int d=0;d<3;d++){
+                try {
+                    pair[i].getDevice(d)->writeIntNow(REG_EXCEPTIONDATA,100);
+                } catch(SlaveException &e){
+                    if(!failed)
+                        snprintf(err,sizeof(err),"%s",e.what());
+                    failed=true;
+                    protocol.resync();
+                }
+            }
+        }
+        if(failed)
+            throw SlaveException("emergency stop failed: %s",err);
+    }
+    
 public:
     /// are leg collision/interference checks enabled?
     bool legCollisionChecksEnabled; 
@@ -258,7 +580,314 @@ public:
         return ret;
     }
     
-    /// return the singleton instance, creating if required.
+    /// set whether update() reads all the devices in a single
+    /// exchange (the default) or one exchange per device, returning
+    /// the previous value
+    bool setMultiRead(bool f){
+        bool ret=multiReadEnabled;
+        multiReadEnabled=f;
+        return ret;
+    }
+    
+    /// set whether writes (such as those done by setRequired()) are
+    /// held rather than sent, so they go out with the device's read
+    /// in the next update() as a single write/read command. This
+    /// saves a round trip per write in a control loop. Turning it off
+    /// sends any held writes.
+    void setDeferWrites(bool f){
+        deferWrites = f;
+        for(int i=0;i<3;i++){
+            if(pairsPresent & (1<<i))pair[i].setDeferWrites(f);
+        }
+        masterDev.setDeferWrites(f);
+    }
+    
+    /// set the required values of one type of motor on all six wheels
+    /// in a single exchange with the master, which passes them on to
+    /// the slaves one after another, so the wheels start together.
+    /// Nothing is sent if any value fails the motors' checks.
+    /// @param type motor type (DRIVE, STEER or LIFT)
+    /// @param v the required values for wheels 1-6
+    void setRequiredAll(int type,const float *v);
+    
+    /// send the required values which are due from the trajectory
+    /// (see getTrajectory()), if it's running: all the values which
+    /// have changed go in a single exchange, like setRequiredAll().
+    /// The acquisition thread calls this before each update(); other
+    /// control loops should do the same. If any value fails the
+    /// motors' checks, the trajectory is stopped and nothing is sent.
+    /// The trajectory stops once its last points have been sent.
+    /// @param t the monotonic time
+    void streamTrajectory(double t);
+    
+    /// send the required values which are due now from the trajectory
+    void streamTrajectory(){
+        streamTrajectory(now());
+    }
+    
+    /// set the same required value for one type of motor on all
+    /// six wheels in a single exchange
+    void setRequiredAll(int type,float v){
+        float vals[6];
+        for(int i=0;i<6;i++)vals[i]=v;
+        setRequiredAll(type,vals);
+    }
+    
+    /// set whether framed messages (with a CRC and sequence number,
+    /// so that we can recover from corrupted or lost bytes without
+    /// reconnecting) are used. Call before init() to stop init()
+    /// asking for them; after init() this switches immediately.
+    /// Returns the previous value.
+    bool setFraming(bool f){
+        bool ret=framingEnabled;
+        framingEnabled=f;
+        if(valid){
+            if(f)
+                framingEnabled = protocol.startFraming();
+            else
+                protocol.stopFraming();
+        }
+        return ret;
+    }
+    
+    /// set whether init() should try to connect to an already running
+    /// master without resetting it (and the slaves), which is much
+    /// quicker. If the master doesn't reply to a ping, or reports a
+    /// problem, it is reset as usual. Returns the previous value.
+    bool setFastConnect(bool f){
+        bool ret=fastConnectEnabled;
+        fastConnectEnabled=f;
+        return ret;
+    }
+    
+    /// get a copy of the state as it was after the last update(),
+    /// without locking anything and without stopping update() from
+    /// publishing another. Any number of threads can do this at once.
+    void getSnapshot(RoverSnapshot &s){
+        snapshots.read(s);
+    }
+    
+    /// the number of snapshots which have been published, so a
+    /// reader can tell whether there is a new one
+    uint32_t getSnapshotCount(){
+        return snapshots.getWriteCount();
+    }
+    
+    /// start a thread which calls update() every interval seconds,
+    /// publishing a snapshot each time. While it runs, any other
+    /// thread which talks to the rover (to set required values,
+    /// say) must do so between lock() and unlock(); threads which
+    /// only read snapshots needn't. The thread can be given a
+    /// SCHED_FIFO priority and a CPU to run on (see
+    /// PeriodicLoop::makeRealtime()). On a virtual clock the thread
+    /// moves the time on itself, a period at a time, so a simulation
+    /// runs as fast as it can; it is only reproducible if nothing else
+    /// moves the clock. Returns false if the thread can't be started.
+    bool startAcquisition(double interval,int priority=0,int cpu=-1){
+        if(acqActive)return true;
+        acqTimer.setPeriod(interval);
+        acqPriority = priority;
+        acqCPU = cpu;
+        acqRunning.store(true);
+        if(pthread_create(&acqThread,NULL,acqThreadFunc,this)){
+            comms.notifyMessage("cannot create acquisition thread");
+            return false;
+        }
+        acqActive = true;
+        return true;
+    }
+    
+    /// stop the acquisition thread, waiting for it to finish
+    void stopAcquisition(){
+        if(!acqActive)return;
+        acqRunning.store(false);
+        pthread_join(acqThread,NULL);
+        acqActive = false;
+    }
+    
+    /// is the acquisition thread running?
+    bool isAcquiring(){
+        return acqActive;
+    }
+    
+    /// time everything on a clock other than the default one: the
+    /// data's timestamps, the acquisition thread, the trajectory and
+    /// the simulator init(NULL) makes. Do this before init(), since
+    /// times from different clocks can't be compared. A simulator
+    /// served some other way (by a PtyLink, say) should be given the
+    /// same clock with its own setClock().
+    void setClock(Clock *c){
+        clock = c;
+        protocol.setClock(c);
+        acqTimer.setClock(c);
+        trajectory->setClock(c);
+        if(ownSim)
+            ownSim->setClock(c);
+    }
+    
+    /// get the clock everything is timed on
+    Clock *getClock(){
+        return clock;
+    }
+    
+    /// get the acquisition thread's timer, which has statistics on
+    /// how well it has kept to its period
+    PeriodicLoop *getAcquisitionTimer(){
+        return &acqTimer;
+    }
+    
+    /// stop all the motors as quickly as possible, with a single
+    /// command which the master passes to all the slaves at once.
+    /// Held writes are left where they are, and the trajectory is
+    /// stopped. The slaves treat it as an exception, so the motors
+    /// stay stopped until resetExceptions().
+    ///
+    /// The stop needs the rover's lock, but doesn't wait for an update
+    /// in progress to finish: it asks the protocol to refuse any more
+    /// commands, so the thread holding the lock (such as the
+    /// acquisition thread) abandons what it is doing with a
+    /// StopRequestedException at its next command and lets go of the
+    /// lock. Writes it was sending with a read are lost. The stop is
+    /// then sent ahead of the replies to any pipelined commands. A
+    /// thread which holds the lock but isn't talking to the rover
+    /// still holds up the stop; the lock is recursive, so a thread
+    /// which holds it can call this.
+    ///
+    /// Masters which predate the command (which we know from their
+    /// not answering a ping or agreeing to framing when we connected)
+    /// are sent an ordinary write to each slave's exception register
+    /// instead. That is also done if the command fails.
+    void emergencyStop(){
+        protocol.requestStop();
+        lock();
+        // nobody else can talk to the rover now
+        protocol.clearStopRequest();
+        try {
+            trajectory->stop();
+            if(valid){
+                if(protocol.knowsEStop()){
+                    try {
+                        protocol.emergencyStop();
+                    } catch(SlaveException &e){
+                        comms.notifyMessage("emergency stop command failed (%s), "
+                                            "writing the slaves",e.what());
+                        protocol.resync();
+                        stopEachSlave();
+                    }
+                } else
+                    stopEachSlave();
+            }
+        } catch(...){
+            unlock();
+            throw;
+        }
+        unlock();
+    }
+    
+    /// take the lock which serialises access to the rover
+    /// when the acquisition thread is running. The same thread
+    /// can take it more than once, releasing it as many times.
+    void lock(){
+        pthread_mutex_lock(&mutex);
+    }
+    
+    /// release the lock taken by lock()
+    void unlock(){
+        pthread_mutex_unlock(&mutex);
+    }
+    
+    /// set how often update() reads a class of data (DATA_ACTUAL,
+    /// DATA_CURRENT, DATA_PID or DATA_TEMP), in seconds. Zero reads
+    /// it on every update, and a negative period never reads it. By
+    /// default everything is read on every update except the
+    /// temperatures, which are read every two seconds. Returns the
+    /// previous period.
+    double setReadPeriod(int dataClass,double secs){
+        double ret = readPeriod[dataClass];
+        readPeriod[dataClass]=secs;
+        return ret;
+    }
+    
+    /// get how often update() reads a class of data
+    double getReadPeriod(int dataClass){
+        return readPeriod[dataClass];
+    }
+    
+    /// make the next update() read a class of data, whether it's
+    /// due or not
+    void requestRead(int dataClass){
+        forcedReads |= 1<<dataClass;
+    }
+    
+    /// how old the oldest data of a class is, in seconds, over all
+    /// the boards which have it: HUGE_VAL if any of it has never been
+    /// read. The age of each block is in the SampleTime of its data,
+    /// along with the round trip time of the read.
+    double getDataAge(int dataClass){
+        double t = now();
+        double a = masterData->getAge(dataClass,t);
+        for(int i=0;i<3;i++){
+            if(pairsPresent & (1<<i))
+                a = std::max(a,pair[i].getAge(dataClass,t));
+        }
+        return a;
+    }
+    
+    /// is any data of a class older than a given number of seconds?
+    /// A control loop can use this to tell when it has fallen behind.
+    bool isStale(int dataClass,double maxAge){
+        return getDataAge(dataClass)>maxAge;
+    }
+    
+    /// get the history of the motor data, which has the last
+    /// HISTORYSIZE samples of some fields of each motor
+    TelemetryHistory *getHistory(){
+        return history;
+    }
+    
+    /// get statistics for a field of a motor over the last few seconds
+    /// of its history, returning the number of samples there were.
+    /// @param w wheel number 1-6
+    /// @param t motor type
+    /// @param f field (HIST_ACTUAL, HIST_CURRENT, HIST_ERROR or HIST_CONTROL)
+    /// @param secs the length of the window, back from now
+    /// @param s the statistics, undefined if there were no samples
+    int getHistoryStats(int w,int t,int f,double secs,HistoryStats &s){
+        history->get(w,t,f)->getStats(now()-secs,s);
+        return s.n;
+    }
+    
+    /// copy up to the last n values of a field of a motor, oldest
+    /// first, along with their times if t isn't NULL. Returns how many
+    /// were copied.
+    int getHistoryLast(int w,int type,int f,int n,float *v,double *t=NULL){
+        return history->get(w,type,f)->getLast(n,v,t);
+    }
+    
+    /// get the trajectories of the required values, to which points
+    /// can be added. While the acquisition thread is running, this
+    /// must only be used between lock() and unlock().
+    TrajectoryQueue *getTrajectory(){
+        return trajectory;
+    }
+    
+    /// set the number of commands which can be sent to the master
+    /// without waiting for their replies, when they are sent
+    /// as pipelined commands. This is used by update() when not
+    /// doing multiple reads.
+    void setPipelineWindow(int n){
+        protocol.setWindow(n);
+    }
+    
+    /// send any pipelined commands which have not yet been
+    /// acknowledged and wait for their replies
+    void sync(){
+        protocol.sync();
+    }
+    
+    /// return the singleton instance, creating if required. This is
+    /// a convenience for programs with only one rover, and is not
+    /// thread safe until it has been called once.
     static Rover *getInstance(){
         if(!instance)
             instance = new Rover();
@@ -289,38 +918,62 @@ public:
     /// initialise the entire rover.
     /// @param port the serial device to connect to - or null to collect to a standard simulator
     /// @param pp   bitmask of which wheel pair boards are present
+    /// @param baud baud rate, which must match SERIALBAUD in the master
+    /// Throws if the compile-time register descriptors don't match the
+    /// register tables.
     
-    bool init(const char *port,int pp=7){
+    bool init(const char *port,int pp=7,int baud=DEFAULTBAUD){
         
+        // the descriptors must describe the registers we talk to
+        if(const char *bad = checkRegisterTypes())
+            throw SlaveException("register descriptor for %s doesn't match "
+                                 "regsauto.cpp: rerun regparse.hs",bad);
+        bool fast=false;
         if(!port){
-            comms.simConnect(new RoverSimulator());
+            if(!ownSim){
+                ownSim = new RoverSimulator();
+                ownSim->setClock(clock);
+            }
+            comms.simConnect(ownSim);
         } else {
-            comms.connect(port,115200);
+            if(fastConnectEnabled)
+                fast = fastConnect(port,baud);
+            if(!fast)
+                comms.connect(port,baud);
         }
         if(!comms.isReady())
             return false;
         pairsPresent = pp;
         
-        // set up the protocol
-        protocol.init(&comms);
+        // set up the protocol, unless fastConnect() has
+        if(!fast)
+            protocol.init(&comms);
+        if(!framingEnabled){
+            protocol.stopFraming(); // may be left on by fastConnect()
+            if(!protocol.knowsEStop()){
+                // find out whether emergencyStop() can use the command
+                uint8_t health;
+                comms.setTimeout(0,200000);
+                protocol.ping(&health,false);
+                comms.setTimeout(1,0);
+            }
+        } else if(!protocol.startFraming())
+            comms.notifyMessage("master does not support framing");
         
         for(int i=0;i<3;i++){
             if(pairsPresent & (1<<i)){
                 pair[i].init(&protocol,i);
             }
         }
-        masterData = new MasterData(&masterDev);
+        if(!masterData)
+            masterData = new MasterData(&masterDev);
         masterDev.init(&protocol,registerTable_MASTER,0);
         masterData->init(); // sets the read set
         
-        // this load of code ensures each lift motor knows its
-        // own wheel number, so we can check lift constraints; it
-        // also allows the lift motors to reference the rover.
-        
-        for(int i=1;i<=6;i++){
-            LiftMotor *lift = getLift(i);
-            lift->wheelNumber = i;
-        }
+        // read everything on the first update
+        for(int i=0;i<DATACLASSES;i++)
+            lastRead[i]=-1e30;
+        history->clear();
         
         valid = true;
         return true;
@@ -341,14 +994,42 @@ public:
         masterDev.resetExceptions();
     }
     
-    /// update all wheel pairs
+    /// update all wheel pairs, reading only the classes of data
+    /// which are due (see setReadPeriod()). If another thread asks
+    /// for an emergency stop, the update is abandoned at the next
+    /// command with a StopRequestedException.
     
     void update(){
         if(valid){
-            if(pairsPresent & 1)pair[0].update();
-            if(pairsPresent & 2)pair[1].update();
-            if(pairsPresent & 4)pair[2].update();
-            masterData->update();
+            double t = now();
+            int mask = getDueClasses(t);
+            if(multiReadEnabled){
+                multiRead.clear();
+                for(int i=0;i<3;i++){
+                    if(pairsPresent & (1<<i))pair[i].addReads(multiRead,mask);
+                }
+                masterData->addReads(multiRead,mask);
+                multiRead.read();
+                for(int i=0;i<3;i++){
+                    if(pairsPresent & (1<<i))pair[i].decode(mask);
+                }
+                masterData->decode(mask);
+            } else {
+                // one read per device and class, pipelined if the
+                // window allows
+                if(pairsPresent & 1)pair[0].updatePipelined(mask);
+                if(pairsPresent & 2)pair[1].updatePipelined(mask);
+                if(pairsPresent & 4)pair[2].updatePipelined(mask);
+                masterData->updatePipelined(mask);
+                protocol.sync();
+            }
+            forcedReads = 0;
+            for(int i=0;i<DATACLASSES;i++){
+                if(mask & (1<<i))lastRead[i]=t;
+            }
+            recordHistory(mask);
+            sweeps++;
+            publishSnapshot();
             comms.pollSim();
             comms.tickSim();
         }
@@ -371,36 +1052,37 @@ public:
         return pair[getPairIdx(w)].getMotor(getWheelIdx(w),t);
     }
     
-    /// get a pointer to a motor's data block by wheel and type
+    /// get a motor's data by wheel and type
     /// @param n wheel number 1-6
     /// @param t type 0,1,2 (drive,steer,lift)
-    MotorData *getMotorData(int w,int t){
+    MotorData getMotorData(int w,int t){
         w--;
         return pair[getPairIdx(w)].getMotorData(getWheelIdx(w),t);
     }
     
         
     
-    /// get a pointer to the monitoring data for a given drive motor
+    /// get the monitoring data for a given drive motor, which is a
+    /// view of the telemetry store so always shows the last update
     /// @param n wheel number 1-6
     
-    DriveMotorData *getDriveData(int n){
+    DriveMotorData getDriveData(int n){
         n--;
         return pair[getPairIdx(n)].getDriveData(getWheelIdx(n));
     }
     
-    /// get a pointer to the monitoring data for a given steer motor
+    /// get the monitoring data for a given steer motor
     /// @param n wheel number 1-6
     
-    SteerMotorData *getSteerData(int n){
+    SteerMotorData getSteerData(int n){
         n--;
         return pair[getPairIdx(n)].getSteerData(getWheelIdx(n));
     }
     
-    /// get a pointer to the monitoring data for a given lift motor
+    /// get the monitoring data for a given lift motor
     /// @param n wheel number 1-6
     
-    LiftMotorData *getLiftData(int n){
+    LiftMotorData getLiftData(int n){
         n--;
         return pair[getPairIdx(n)].getLiftData(getWheelIdx(n));
     }
@@ -428,6 +1110,13 @@ public:
         return pair[getPairIdx(n)].getLift(getWheelIdx(n));
     }
     
+    /// get the telemetry of all the motors as a structure of arrays,
+    /// as of the last update(). Other threads should use the copy in
+    /// a snapshot instead.
+    const RoverTelemetry *getTelemetry(){
+        return &telemetry;
+    }
+    
     /// return a pointer to the master device's
     /// data, temperature monitoring etc.
     MasterData *getMasterData(){
@@ -0,0 +1,322 @@
+/**
+ * \file
+ * A periodic loop which wakes at fixed absolute deadlines, so that
+ * its period doesn't drift by however long the work took, and keeps
+ * histograms of how well it kept to them.
+ */
+
+#ifndef __RTLOOP_H
+#define __RTLOOP_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <atomic>
+
+#include "timing.h"
+
+/// number of bins in a LoopHistogram, not counting the overflow bin
+#define LOOPHISTBINS 100
+
+/// a histogram of times, in equal bins from zero up to a range with
+/// an extra bin for anything over it. One thread adds times; others
+/// can read the histogram while it does, seeing slightly out of date
+/// values.
+
+class LoopHistogram {
+    /// the width of each bin in seconds
+    double binWidth;
+    /// the bins, the last being for times beyond the range
+    std::atomic<uint32_t> bins[LOOPHISTBINS+1];
+    std::atomic<uint32_t> n; //!< number of times added
+    std::atomic<double> sum; //!< their total
+    std::atomic<double> mn; //!< the smallest
+    std::atomic<double> mx; //!< the largest
+
+public:
+    LoopHistogram(){
+        setRange(0.1);
+    }
+
+    /// set the largest time the bins cover, and clear the histogram
+    void setRange(double r){
+        binWidth = r/LOOPHISTBINS;
+        clear();
+    }
+
+    /// clear the histogram
+    void clear(){
+        for(int i=0;i<=LOOPHISTBINS;i++)
+            bins[i].store(0,std::memory_order_relaxed);
+        n.store(0,std::memory_order_relaxed);
+        sum.store(0,std::memory_order_relaxed);
+        mn.store(0,std::memory_order_relaxed);
+        mx.store(0,std::memory_order_relaxed);
+    }
+
+    /// add a time - only one thread may do this
+    void add(double t){
+        int b = t<0 ? 0 : (int)(t/binWidth);
+        if(b>LOOPHISTBINS)b=LOOPHISTBINS;
+        bins[b].store(bins[b].load(std::memory_order_relaxed)+1,
+                      std::memory_order_relaxed);
+        uint32_t c = n.load(std::memory_order_relaxed);
+        if(!c || t<mn.load(std::memory_order_relaxed))
+            mn.store(t,std::memory_order_relaxed);
+        if(!c || t>mx.load(std::memory_order_relaxed))
+            mx.store(t,std::memory_order_relaxed);
+        sum.store(sum.load(std::memory_order_relaxed)+t,
+                  std::memory_order_relaxed);
+        n.store(c+1,std::memory_order_relaxed);
+    }
+
+    /// the number of times added
+    uint32_t getCount() const {
+        return n.load(std::memory_order_relaxed);
+    }
+    /// the smallest time added
+    double getMin() const {
+        return mn.load(std::memory_order_relaxed);
+    }
+    /// the largest time added
+    double getMax() const {
+        return mx.load(std::memory_order_relaxed);
+    }
+    /// the mean time
+    double getMean() const {
+        uint32_t c = getCount();
+        return c ? sum.load(std::memory_order_relaxed)/c : 0;
+    }
+    /// the number of times in a bin (LOOPHISTBINS is the overflow bin)
+    uint32_t getBin(int i) const {
+        return bins[i].load(std::memory_order_relaxed);
+    }
+    /// the width of each bin in seconds
+    double getBinWidth() const {
+        return binWidth;
+    }
+
+    /// the time which a fraction p of the times added are no more
+    /// than, to the resolution of the bins (the top of the bin it
+    /// falls in, but no more than the largest time)
+    double getPercentile(double p) const {
+        uint32_t c = getCount();
+        if(!c)return 0;
+        uint32_t need = (uint32_t)(p*c+0.5);
+        uint32_t total=0;
+        for(int i=0;i<LOOPHISTBINS;i++){
+            total += getBin(i);
+            if(total>=need && total){
+                double t = (i+1)*binWidth;
+                return t<getMax() ? t : getMax();
+            }
+        }
+        return getMax();
+    }
+
+    /// print a one line summary, in milliseconds
+    void printSummary(FILE *f,const char *name) const {
+        fprintf(f,"%-8s n %-7u min %8.3f mean %8.3f p99 %8.3f max %8.3f ms\n",
+                name,getCount(),getMin()*1e3,getMean()*1e3,
+                getPercentile(0.99)*1e3,getMax()*1e3);
+    }
+
+    /// print the bins which have anything in them
+    void print(FILE *f) const {
+        for(int i=0;i<=LOOPHISTBINS;i++){
+            uint32_t b = getBin(i);
+            if(!b)continue;
+            if(i==LOOPHISTBINS)
+                fprintf(f,"      >%8.3f ms: %u\n",i*binWidth*1e3,b);
+            else
+                fprintf(f,"%7.3f-%7.3f ms: %u\n",i*binWidth*1e3,
+                        (i+1)*binWidth*1e3,b);
+        }
+    }
+};
+
+/// runs a loop at a fixed period: call start(), and then wait() after
+/// each iteration's work. Deadlines are absolute, so the period doesn't
+/// drift; if the work overruns a deadline, the ticks it has missed are
+/// counted and skipped rather than run late one after another. The
+/// loop keeps histograms of the time between wakeups, the time spent
+/// working, and how late each wakeup was. On the virtual clock, waiting
+/// moves the clock on to the deadline instead of sleeping.
+
+class PeriodicLoop {
+    /// the period in seconds
+    double period;
+    /// the time the first tick was due
+    double startTime;
+    /// the number of the tick we're waiting for
+    uint64_t tick;
+    /// when we last woke up
+    double lastWake;
+
+    LoopHistogram periods; //!< times between wakeups
+    LoopHistogram work; //!< times between waking and calling wait()
+    LoopHistogram latency; //!< how late each wakeup was
+    /// the number of times the work overran the next deadline
+    std::atomic<uint32_t> overruns;
+    /// the number of ticks skipped because of overruns
+    std::atomic<uint32_t> missed;
+    /// the clock we run on
+    Clock *clock;
+
+public:
+    PeriodicLoop(){
+        clock = getDefaultClock();
+        setPeriod(0.01);
+    }
+
+    /// run on a clock other than the default one; call start()
+    /// afterwards. If the clock is virtual, the loop moves it on.
+    void setClock(Clock *c){
+        clock = c;
+    }
+
+    /// get the clock we run on
+    Clock *getClock() const {
+        return clock;
+    }
+
+    /// set the period in seconds, clearing the statistics. Call
+    /// start() afterwards.
+    void setPeriod(double p){
+        period = p;
+        periods.setRange(p*2);
+        work.setRange(p);
+        latency.setRange(p/4);
+        clearStats();
+    }
+
+    /// get the period in seconds
+    double getPeriod() const {
+        return period;
+    }
+
+    /// clear the statistics - this can be done while the loop runs
+    void clearStats(){
+        periods.clear();
+        work.clear();
+        latency.clear();
+        overruns.store(0);
+        missed.store(0);
+    }
+
+    /// start the loop, the first tick being now
+    void start(){
+        startTime = lastWake = clock->now();
+        tick = 0;
+    }
+
+    /// wait for the next tick, recording how long the work since the
+    /// last one took. Returns the number of ticks which were missed
+    /// because the work overran.
+    int wait(){
+        double now = clock->now();
+        work.add(now-lastWake);
+
+        tick++;
+        double deadline = startTime+tick*period;
+        int skipped = 0;
+        if(deadline<=now){
+            // skip to the first deadline still to come
+            skipped = (int)((now-deadline)/period)+1;
+            tick += skipped;
+            deadline = startTime+tick*period;
+            overruns.store(overruns.load()+1);
+            missed.store(missed.load()+skipped);
+        }
+
+        if(clock->isVirtual()){
+            // the loop's own thread moves the time on
+            clock->advanceTo(deadline);
+        } else {
+            timespec ts;
+            ts.tv_sec = (time_t)deadline;
+            ts.tv_nsec = (long)((deadline-ts.tv_sec)*1e9);
+            if(ts.tv_nsec>=1000000000L){
+                ts.tv_sec++;
+                ts.tv_nsec-=1000000000L;
+            }
+            while(clock_nanosleep(CLOCK_MONOTONIC,TIMER_ABSTIME,&ts,NULL)==EINTR){}
+        }
+
+        now = clock->now();
+        latency.add(now-deadline);
+        periods.add(now-lastWake);
+        lastWake = now;
+        return skipped;
+    }
+
+    /// the histogram of times between wakeups
+    const LoopHistogram &getPeriods() const {
+        return periods;
+    }
+    /// the histogram of the times spent working
+    const LoopHistogram &getWork() const {
+        return work;
+    }
+    /// the histogram of how late each wakeup was
+    const LoopHistogram &getLatency() const {
+        return latency;
+    }
+    /// the number of times the work overran the next deadline
+    uint32_t getOverruns() const {
+        return overruns.load();
+    }
+    /// the number of ticks skipped because of overruns
+    uint32_t getMissed() const {
+        return missed.load();
+    }
+
+    /// print a summary of the statistics
+    void printStats(FILE *f) const {
+        fprintf(f,"period %.3f ms, %u overruns, %u ticks missed\n",
+                period*1e3,getOverruns(),getMissed());
+        periods.printSummary(f,"period");
+        work.printSummary(f,"work");
+        latency.printSummary(f,"latency");
+    }
+
+    /// make the calling thread a real-time thread. Returns NULL on
+    /// success, or a description of what failed.
+    /// @param priority SCHED_FIFO priority (1-99), or 0 for normal
+    /// scheduling
+    /// @param cpu the CPU to run on, or -1 for any
+    /// @param lockMemory if true, lock all the process's memory so
+    /// that it can't be paged out; if false, unlock it
+    static const char *makeRealtime(int priority,int cpu,bool lockMemory){
+        sched_param sp;
+        memset(&sp,0,sizeof(sp));
+        sp.sched_priority = priority;
+        if(pthread_setschedparam(pthread_self(),
+                                 priority ? SCHED_FIFO : SCHED_OTHER,&sp))
+            return "cannot set scheduling policy (needs CAP_SYS_NICE)";
+
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        if(cpu<0){
+            for(int i=0;i<CPU_SETSIZE;i++)
+                CPU_SET(i,&cpus);
+        } else
+            CPU_SET(cpu,&cpus);
+        if(pthread_setaffinity_np(pthread_self(),sizeof(cpus),&cpus) && cpu>=0)
+            return "cannot set CPU affinity";
+
+        if(lockMemory){
+            if(mlockall(MCL_CURRENT|MCL_FUTURE))
+                return "cannot lock memory (needs CAP_IPC_LOCK)";
+        } else
+            munlockall();
+        return NULL;
+    }
+};
+
+#endif /* __RTLOOP_H */
@@ -10,25 +10,98 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <math.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <sys/ioctl.h>
 #include "rover.h"
 
 #include "motorsim.h"
 
-float RoverSimulator::simCurrentFactor=0.07;
+std::atomic<float> RoverSimulator::simCurrentFactor(0.07f);
+
+// the simulated motors, with speeds, currents and so on in the units
+// the slaves use: see motorsim.h. Full duty runs a drive wheel at
+// a little over 1300 encoder ticks per second, a steer motor at about
+// 90 degrees per second and a lift motor at about 60.
+
+static const MotorPhysics drivePhysics = {
+    12.0f, // supply
+    2.0f, // resistance
+    0.012f, // torqueConst
+    1.0e-5f, // inertia
+    0, // viscous, set from the sim current factor
+    0.002f, // coulomb
+    75.0f, // gearRatio
+    0, // limit
+    27.0f // countsPerAmp
+};
+static const MotorPhysics steerPhysics = {
+    12.0f, 3.0f, 0.01f, 2.0e-6f, 1.0e-6f, 0.001f, 600.0f, 120.0f, 27.0f
+};
+static const MotorPhysics liftPhysics = {
+    12.0f, 3.0f, 0.01f, 4.0e-6f, 2.0e-6f, 0.002f, 900.0f, 120.0f, 27.0f
+};
+
+/// encoder ticks per drive wheel turn
+static const float driveTicksPerTurn = 1200;
+
+/// the viscous load on a drive motor is the sim current factor times this
+static const float driveLoadScale = 8.8e-4f;
 
-// motor simulation smoothing factors, which describe how required becomes
-// actual. They're different for each motor to ensure that motors take
+// the inertia of each motor is scaled by these, so that motors take
 // different times to perform different activities.
 
-float driveSmoothing[] = {0.11f,0.09f,0.10f,
-                        0.12f,0.112f,0.08f};
-float liftSmoothing[] = {0.09f,0.11f,0.12f,
-                        0.08f,0.12f,0.12f};
-float steerSmoothing[] = {0.11f,0.09f,0.10f,
-                        0.12f,0.112f,0.08f};
-    
+static const float driveInertia[] = {1.0f,1.2f,1.1f,
+                        0.9f,0.98f,1.35f};
+static const float liftInertia[] = {1.2f,1.0f,0.9f,
+                        1.35f,0.9f,0.9f};
+static const float steerInertia[] = {1.0f,1.2f,1.1f,
+                        0.9f,0.98f,1.35f};
 
+static const char wheelToDevice_ds[]={1,2,4,5,7,8};
+static const char wheelToDevice_ll[]={3,3,6,6,9,9};
+
+/// the registers a simulated motor's controller is set up from and
+/// reports in, or -1 where there's no such register
+struct SimMotorRegs {
+    int req,pGain,iGain,dGain,iCap,iDecay,deadZone,calibMin,calibMax;
+    int actual,error,errorIntegral,errorDeriv,control,interval,current;
+};
 
+static const SimMotorRegs driveRegs = {
+    REGDS_DRIVE_REQSPEED,REGDS_DRIVE_PGAIN,REGDS_DRIVE_IGAIN,
+    REGDS_DRIVE_DGAIN,REGDS_DRIVE_INTEGRALCAP,REGDS_DRIVE_INTEGRALDECAY,
+    REGDS_DRIVE_DEADZONE,-1,-1,
+    REGDS_DRIVE_ACTUALSPEED,REGDS_DRIVE_ERROR,REGDS_DRIVE_ERRORINTEGRAL,
+    REGDS_DRIVE_ERRORDERIV,REGDS_DRIVE_CONTROL,REGDS_DRIVE_INTERVALCTRL,
+    REGDS_DRIVE_CURRENT
+};
+static const SimMotorRegs steerRegs = {
+    REGDS_STEER_REQPOS,REGDS_STEER_PGAIN,REGDS_STEER_IGAIN,
+    REGDS_STEER_DGAIN,REGDS_STEER_INTEGRALCAP,REGDS_STEER_INTEGRALDECAY,
+    REGDS_STEER_DEADZONE,REGDS_STEER_CALIBMIN,REGDS_STEER_CALIBMAX,
+    REGDS_STEER_ACTUALPOS,REGDS_STEER_ERROR,REGDS_STEER_ERRORINTEGRAL,
+    REGDS_STEER_ERRORDERIV,REGDS_STEER_CONTROL,REGDS_STEER_INTERVALCTRL,
+    REGDS_STEER_CURRENT
+};
+static const SimMotorRegs liftRegs[] = {
+    {
+        REGLL_ONE_REQPOS,REGLL_ONE_PGAIN,REGLL_ONE_IGAIN,
+        REGLL_ONE_DGAIN,REGLL_ONE_INTEGRALCAP,REGLL_ONE_INTEGRALDECAY,
+        REGLL_ONE_DEADZONE,REGLL_ONE_CALIBMIN,REGLL_ONE_CALIBMAX,
+        REGLL_ONE_ACTUALPOS,REGLL_ONE_ERROR,REGLL_ONE_ERRORINTEGRAL,
+        REGLL_ONE_ERRORDERIV,REGLL_ONE_CONTROL,REGLL_ONE_INTERVALCTRL,
+        REGLL_ONE_CURRENT
+    },{
+        REGLL_TWO_REQPOS,REGLL_TWO_PGAIN,REGLL_TWO_IGAIN,
+        REGLL_TWO_DGAIN,REGLL_TWO_INTEGRALCAP,REGLL_TWO_INTEGRALDECAY,
+        REGLL_TWO_DEADZONE,REGLL_TWO_CALIBMIN,REGLL_TWO_CALIBMAX,
+        REGLL_TWO_ACTUALPOS,REGLL_TWO_ERROR,REGLL_TWO_ERRORINTEGRAL,
+        REGLL_TWO_ERRORDERIV,REGLL_TWO_CONTROL,REGLL_TWO_INTERVALCTRL,
+        REGLL_TWO_CURRENT
+    }
+};
 
 /// a cyclic buffer of bytes - we use this class to simulate
 /// incoming and outgoing data.
@@ -77,8 +150,35 @@ public:
     }
 };
 
-static CyclicBuf in(1024); // system -> simulator
-static CyclicBuf out(1024); // simulator -> system
+/// writes the simulator's replies, either raw or as frames
+/// once framing has been switched on
+
+class SimReplyWriter final : public FrameWriter {
+    CyclicBuf *out; //!< where the replies go
+protected:
+    virtual void emit(uint8_t c){
+        out->write((char)c);
+    }
+public:
+    /// true if replies are framed
+    bool framed;
+    
+    SimReplyWriter(CyclicBuf *o){
+        out = o;
+        framed = false;
+    }
+    
+    void write(uint8_t c){
+        if(framed)
+            put(c);
+        else
+            out->write((char)c);
+    }
+    void write(const uint8_t *p,int n){
+        while(n--)
+            write(*p++);
+    }
+};
 
 
 int RoverSimulator::read(char *buf,int ct){
@@ -86,15 +186,15 @@ int RoverSimulator::read(char *buf,int ct){
     // copying out the out buffer
     
     int read=0;
-    while(out.hasData() && read<ct){
-        buf[read++] = out.read();
+    while(out->hasData() && read<ct){
+        buf[read++] = out->read();
     }
     return read;
 }
 
 int RoverSimulator::write(const char *s,int ct){
     for(int i=0;i<ct;i++)
-        in.write(s[i]);
+        in->write(s[i]);
     
     // process the simulator
     //    update();
@@ -109,30 +209,7 @@ int RoverSimulator::write(const char *s,int ct){
 /////////// from code in the master firmware.
 
 
-static int readSets[16][32]; // should be loads of space
-static int readSetCts[16];
-static uint16_t regs[16][64]; // register values! Eek!
-
-static timespec lastTime;
-
-static inline double time_diff(timespec start, timespec end)
-{
-    timespec temp;
-    if ((end.tv_nsec-start.tv_nsec)<0) {
-        temp.tv_sec = end.tv_sec-start.tv_sec-1;
-        temp.tv_nsec = 1000000000+end.tv_nsec-start.tv_nsec;
-    } else {
-        temp.tv_sec = end.tv_sec-start.tv_sec;
-        temp.tv_nsec = end.tv_nsec-start.tv_nsec;
-    }
-    
-    double t = temp.tv_sec;
-    double ns = temp.tv_nsec;
-    t += ns*1e-9;
-    return t;
-}
-
-const Register *getReg(int dev,int regN){
+static const Register *getReg(int dev,int regN){
     const Register *r;
     switch(dev){
     case 0:
@@ -150,38 +227,53 @@ const Register *getReg(int dev,int regN){
     return r+regN;
 }
 
-inline void setr(int d,int n,float v){
+inline void RoverSimulator::setr(int d,int n,float v){
     const Register *r = getReg(d,n);
     regs[d][n] = r->map(v);
 }
 
-inline float getr(int d,int n){
+inline float RoverSimulator::getr(int d,int n){
     const Register *r = getReg(d,n);
     return r->unmap(regs[d][n]);
 }
 
 
-
-static double odo[10];//fake odometry readings; 10 of them even though it wastes space, it simplifies the code.
-
-RoverSimulator::RoverSimulator(){
+RoverSimulator::RoverSimulator() : frameReader(cmdBuf,sizeof(cmdBuf)) {
     timeSoFar = 0;
+    unknownCmds = 0;
+    allStoppedTime.store(0);
+    slaveMillis = 0;
+    cmdCt = 0;
+    newFraming = -1;
+    in = new CyclicBuf(4096);
+    out = new CyclicBuf(4096);
+    reply = new SimReplyWriter(out);
     
-    clock_gettime(CLOCK_MONOTONIC,&lastTime);
+    clock = getDefaultClock();
+    lastTime = clock->now();
     // default is zero for everything
-    memset(regs,0,16*64*sizeof(uint8_t));
+    memset(regs,0,sizeof(regs));
+    memset(readSets,0,sizeof(readSets));
+    memset(readSetCts,0,sizeof(readSetCts));
+    memset(dsException,0,sizeof(dsException));
+    memset(llException,0,sizeof(llException));
     
     /// initialise the motors
     for(int i=0;i<6;i++){
-        drive[i] = new MotorSim(driveSmoothing[i]);
-        lift[i] = new MotorSim(liftSmoothing[i]);
-        steer[i] = new MotorSim(steerSmoothing[i]);
+        MotorPhysics p = drivePhysics;
+        p.inertia *= driveInertia[i];
+        drive[i] = new SpeedMotorSim(p,driveTicksPerTurn);
+        p = liftPhysics;
+        p.inertia *= liftInertia[i];
+        lift[i] = new PositionMotorSim(p);
+        p = steerPhysics;
+        p.inertia *= steerInertia[i];
+        steer[i] = new PositionMotorSim(p);
     }
     
     // set the defaults
     int i;
     for(int d=0;d<10;d++){
-        odo[d]=0; // reset odometry
         switch(d){
         case 0://master
             setr(d,REGMASTER_TEMPAMBIENT,13);
@@ -242,70 +334,221 @@ RoverSimulator::~RoverSimulator(){
         delete steer[i];
         delete lift[i];
     }
+    delete reply;
+    delete in;
+    delete out;
+}
+
+
+/// apply a block of writes to a device, returning a pointer to the
+/// byte after the block
+uint8_t *RoverSimulator::applywrites(int id,uint8_t *p){
+    
+    int writes = *p++;
+    for(int i=0;i<writes;i++){
+        int r = *p++;
+        uint16_t v = *p++;
+        if(getReg(id,r)->getSize() == 2){
+            v |= *p++ << 8;
+        }
+        // a write to a slave's exception register raises an
+        // exception, and the slave keeps its own data there
+        if(r == REG_EXCEPTIONDATA && id){
+            raiseRemoteException(id);
+            continue;
+        }
+        regs[id][r]=v;
+        
+        // put special cases down here
+        if(r == REG_RESET){
+            if(v & RESET_ODO){
+                for(int i=0;i<6;i++){
+                    if(wheelToDevice_ds[i]==id)
+                        drive[i]->resetOdometry();
+                }
+            }
+            if(v & RESET_EXCEPTIONS){
+                regs[id][REG_STATUS] &= ~ST_EXCEPTION;
+                allStoppedTime.store(0);
+            }
+        }
+        
+    }
+    return p;
 }
 
+void RoverSimulator::raiseRemoteException(int id){
+    // as on a slave, nothing changes if there's an exception already
+    if(regs[id][REG_STATUS] & ST_EXCEPTION)
+        return;
+    regs[id][REG_STATUS] |= ST_EXCEPTION;
+    // no motor (5) and EX_REMOTESLAVE (3) from the slave's state.h
+    regs[id][REG_EXCEPTIONDATA] = (5<<8)|3;
+    for(int d=1;d<=9;d++){
+        if(!(regs[d][REG_STATUS] & ST_EXCEPTION))
+            return;
+    }
+    allStoppedTime.store(getRealMonotonicTime());
+}
 
-static void doread(int id,uint8_t *p){
+void RoverSimulator::doread(int id,uint8_t *p){
     uint8_t buf[128];
     int ct=0;
     
     int set = *p++; // get the read set index
         
-    for(int i=0;i<readSetCts[set];i++){ // for each read
+    for(int i=0;i<readSetCts[id][set];i++){ // for each read
         uint16_t v;
-        int r = readSets[set][i];
+        int r = readSets[id][set][i];
         const Register *reg = getReg(id,r);
         v = regs[id][r]; // get value
         buf[ct++]=v & 0xff; // store the bottom byte in the buffer
         if(reg->getSize()==2) // if the value is 16-bit
             buf[ct++]=v>>8; // store the top byte
     }
-    out.write((char *)buf,ct); // write the buffer
+    reply->write(buf,ct); // write the buffer
     
 }
-static void dowrite(int id,uint8_t *p){
-    
-    int writes = *p++;
-    for(int i=0;i<writes;i++){
-        int r = *p++;
-        uint16_t v = *p++;
-        if(getReg(id,r)->getSize() == 2){
-            v |= *p++ << 8;
-        }
-        regs[id][r]=v;
-        
-        // put special cases down here
-        if(r == REG_RESET){
-            if(v & RESET_ODO)
-                odo[id]=0;
+void RoverSimulator::dowrite(int id,uint8_t *p){
+    applywrites(id,p);
+    reply->write(0);
+}
+void RoverSimulator::dowriteread(int id,uint8_t *p){
+    // the read set comes first, then the writes; the response is
+    // the write status followed by the read.
+    uint8_t set = *p++;
+    applywrites(id,p);
+    reply->write(0);
+    doread(id,&set);
+}
+void RoverSimulator::domultiread(uint8_t *p,int ct){
+    // each byte is a device ID in the top four bits and a read
+    // set in the bottom four; the responses are just concatenated.
+    for(int i=0;i<ct;i++){
+        uint8_t set = p[i]&0xf;
+        doread(p[i]>>4,&set);
+    }
+}
+void RoverSimulator::domultiwrite(uint8_t *p,int ct){
+    // each device ID is followed by a block of writes as for the
+    // write command; there's one status byte for all of them.
+    uint8_t *end = p+ct;
+    while(p<end){
+        int id = *p++;
+        p = applywrites(id,p);
+    }
+    reply->write(0);
+}
+bool RoverSimulator::readSetPoolFull(){
+    int used=0,bytes=0;
+    for(int id=0;id<=9;id++){
+        for(int s=0;s<READSETS;s++){
+            int ct = readSetCts[id][s];
+            if(!ct)continue;
+            // count each set only the first time we see it
+            bool seen=false;
+            for(int j=0;j<id*READSETS+s && !seen;j++){
+                int id2=j/READSETS,s2=j%READSETS;
+                seen = readSetCts[id2][s2]==ct &&
+                      !memcmp(readSets[id2][s2],readSets[id][s],ct*sizeof(int));
+            }
+            if(!seen){
+                used++;
+                bytes+=ct;
+            }
         }
-        
     }
-    char qqq=0;
-    out.write(&qqq,1);
+    return used>READSETENTRIES || bytes>READSETAREA;
 }
-static void doreadset(uint8_t *p,int ct){
+
+void RoverSimulator::doreadset(int id,uint8_t *p,int ct){
     int set = *p++;
     ct--;
-    readSetCts[set]=ct;
+    // as on the master, a set which can't be stored is left empty
+    readSetCts[id][set]=0;
+    if(set>=READSETS || ct>READSETSIZE){
+        reply->write(READSET_FAILED);
+        return;
+    }
     for(int i=0;i<ct;i++){
-        readSets[set][i]=*p++;
+        readSets[id][set][i]=*p++;
+    }
+    readSetCts[id][set]=ct;
+    if(readSetPoolFull()){
+        readSetCts[id][set]=0;
+        reply->write(READSET_POOLFULL);
+        return;
+    }
+    reply->write(ct);
+}
+
+void RoverSimulator::doframing(uint8_t *p,int ct){
+    // the reply is the version we've switched to, or zero
+    // if we've switched off or don't know the version.
+    uint8_t v = ct ? *p : 0;
+    if(v==FRAME_VERSION){
+        reply->write(v);
+        newFraming=1;
+    } else {
+        reply->write(0);
+        newFraming=0;
     }
-    out.write(ct);
 }
 
 
-static void processCmd(int ct,uint8_t *p){
+void RoverSimulator::doestop(){
+    // the master tells every slave at once with an I2C general call
+    for(int d=1;d<=9;d++)
+        raiseRemoteException(d);
+    reply->write(0);
+}
+
+void RoverSimulator::doping(){
+    // a slave in an exception is unhealthy; unlike the real master we
+    // are ready as soon as we start
+    uint8_t health=0;
+    for(int d=1;d<=9;d++){
+        if(regs[d][REG_STATUS] & ST_EXCEPTION)
+            health |= PING_EXCEPTION;
+    }
+    reply->write(PING_MAGIC);
+    reply->write(PING_VERSION);
+    reply->write(health);
+}
+
+void RoverSimulator::processCmd(int ct,uint8_t *p){
     int id = *p>>4; // address/id: 0 for master, 1-9 for slaves
+    // the master ignores commands it doesn't know, though if framed
+    // it still sends an empty reply
+    if(unknownCmds & (1<<(*p&0xf)))
+        return;
     switch(*p++&0xf){// get command and increment ptr
-    case 2: // write command
+    case CMD_WRITE: // write command
         dowrite(id,p);
         break;
-    case 3: // read command
+    case CMD_READ: // read command
         doread(id,p);
         break;
-    case 4:// readset command
-        doreadset(p,ct);
+    case CMD_SETREADSET: // readset command
+        doreadset(id,p,ct);
+        break;
+    case CMD_MULTIREAD: // multiple read command
+        domultiread(p,ct);
+        break;
+    case CMD_WRITEREAD: // write then read command
+        dowriteread(id,p);
+        break;
+    case CMD_FRAMING: // framing command
+        doframing(p,ct);
+        break;
+    case CMD_PING: // ping command
+        doping();
+        break;
+    case CMD_MULTIWRITE: // multiple write command
+        domultiwrite(p,ct);
+        break;
+    case CMD_ESTOP: // emergency stop command
+        doestop();
         break;
     default:
         printf("Unknown command in simulator\n");
@@ -314,83 +557,320 @@ static void processCmd(int ct,uint8_t *p){
     }
 }
 
-static const char wheelToDevice_ds[]={1,2,4,5,7,8};
-static const char wheelToDevice_ll[]={3,3,6,6,9,9};
+/// set a simulated motor's controller up from its slave's registers
+void RoverSimulator::loadMotor(int d,const SimMotorRegs &r,MotorSim *m){
+    m->pid.required = getr(d,r.req);
+    m->pid.pGain = getr(d,r.pGain);
+    m->pid.iGain = getr(d,r.iGain);
+    m->pid.dGain = getr(d,r.dGain);
+    m->pid.integralCap = getr(d,r.iCap);
+    m->pid.integralDecay = getr(d,r.iDecay);
+    m->pid.deadZone = getr(d,r.deadZone);
+}
 
-void RoverSimulator::simMotors(double t){
-    
+/// write a simulated motor's state to its slave's registers, as the
+/// slave does in its main loop
+void RoverSimulator::storeMotor(int d,const SimMotorRegs &r,MotorSim *m){
+    setr(d,r.actual,m->getActual());
+    setr(d,r.error,m->pid.error);
+    setr(d,r.errorIntegral,m->pid.errorIntegral);
+    setr(d,r.errorDeriv,m->pid.errorDerivative);
+    setr(d,r.control,m->control);
+    setr(d,r.interval,m->pid.milliInterval);
+    setr(d,r.current,m->getSimCurrent());
+}
+
+void RoverSimulator::loadMotors(){
+    float load = getSimCurrentFactor()*driveLoadScale;
     for(int i=0;i<6;i++){
-        drive[i]->required = getr(wheelToDevice_ds[i],REGDS_DRIVE_REQSPEED);
-        steer[i]->required = getr(wheelToDevice_ds[i],REGDS_STEER_REQPOS);
-        
-        lift[i]->required = getr(wheelToDevice_ll[i],
-                                 (i%2)?REGLL_TWO_REQPOS:REGLL_ONE_REQPOS);
+        int ds = wheelToDevice_ds[i];
+        int ll = wheelToDevice_ll[i];
+        const SimMotorRegs &lr = liftRegs[i%2];
         
-        drive[i]->update();
-        lift[i]->update();
-        steer[i]->update();
-        
-        setr(wheelToDevice_ds[i],REGDS_DRIVE_ACTUALSPEED,drive[i]->getActual());
-        setr(wheelToDevice_ds[i],REGDS_DRIVE_CURRENT,drive[i]->getSimCurrent());
-        setr(wheelToDevice_ds[i],REGDS_STEER_ACTUALPOS,steer[i]->getActual());
-        
-        setr(wheelToDevice_ll[i],(i%2)?REGLL_TWO_ACTUALPOS:REGLL_ONE_ACTUALPOS,
-             lift[i]->getActual());
-        
-        setr(wheelToDevice_ll[i],(i%2)?REGLL_TWO_CURRENT:REGLL_ONE_CURRENT,0);
+        loadMotor(ds,driveRegs,drive[i]);
+        loadMotor(ds,steerRegs,steer[i]);
+        loadMotor(ll,lr,lift[i]);
+        steer[i]->calibMin = getr(ds,steerRegs.calibMin);
+        steer[i]->calibMax = getr(ds,steerRegs.calibMax);
+        lift[i]->calibMin = getr(ll,lr.calibMin);
+        lift[i]->calibMax = getr(ll,lr.calibMax);
+        drive[i]->setViscous(load*driveInertia[i]);
         
+        dsException[i] = (regs[ds][REG_STATUS] & ST_EXCEPTION)!=0;
+        llException[i] = (regs[ll][REG_STATUS] & ST_EXCEPTION)!=0;
+    }
+}
+
+void RoverSimulator::stepMotors(){
+    // a slave in an exception stops its motors, which coast
+    for(int i=0;i<6;i++){
+        drive[i]->update(dsException[i]);
+        steer[i]->update(dsException[i]);
+        lift[i]->update(llException[i]);
+    }
+}
+
+void RoverSimulator::storeMotors(){
+    for(int i=0;i<6;i++){
+        int ds = wheelToDevice_ds[i];
+        int ll = wheelToDevice_ll[i];
+        storeMotor(ds,driveRegs,drive[i]);
+        storeMotor(ds,steerRegs,steer[i]);
+        storeMotor(ll,liftRegs[i%2],lift[i]);
+        regs[ds][REGDS_DRIVE_ODO] = drive[i]->getOdometry();
     }
 }
 
 
 void RoverSimulator::simulate(double t){
     
-    // add the time to the time accumulator, and if it's over,
-    // run a simulator tick.
+    // the slaves' millisecond timers, which wrap like the real ones
+    slaveMillis = fmod(slaveMillis+t*1000,65536);
+    for(int d=1;d<=9;d++)
+        regs[d][REG_TIMER] = (uint16_t)slaveMillis;
     
+    // add the time to the time accumulator, and run as many fixed
+    // steps of the motors as fit into it. If we've been away a long
+    // time, don't try to catch up with more than a second - unless
+    // the clock is virtual, when it's all meant to be simulated.
     timeSoFar += t;
-    if(timeSoFar>SIMTICKLENGTH){
-        timeSoFar-=SIMTICKLENGTH;
-        simMotors(t);
-    
-        // get values of temperature - we're not using it right now.
-        setr(0,REGMASTER_TEMP1,15);
-        setr(0,REGMASTER_TEMP2,15);
-        setr(0,REGMASTER_TEMP4,15);
-        setr(0,REGMASTER_TEMP5,15);
-        setr(0,REGMASTER_TEMP7,15);
-        setr(0,REGMASTER_TEMP8,15);
-    
-        // odometry
-        for(int i=0;i<6;i++){
-            odo[i]+=drive[i]->getActual();
-            setr(wheelToDevice_ds[i],REGDS_DRIVE_ODO,odo[i]);
-        }
+    if(timeSoFar>1 && !clock->isVirtual())
+        timeSoFar=1;
+    // the registers only change between ticks
+    loadMotors();
+    while(timeSoFar>=SIMSTEP){
+        timeSoFar-=SIMSTEP;
+        stepMotors();
     }
+    storeMotors();
+    
+    // get values of temperature - we're not using it right now.
+    setr(0,REGMASTER_TEMP1,15);
+    setr(0,REGMASTER_TEMP2,15);
+    setr(0,REGMASTER_TEMP4,15);
+    setr(0,REGMASTER_TEMP5,15);
+    setr(0,REGMASTER_TEMP7,15);
+    setr(0,REGMASTER_TEMP8,15);
 }
 
-                       
-                       
-static uint8_t buf[256]; // command buffer
-static int ct; // command buffer count
 
 void RoverSimulator::update(){
-    struct timespec a;
-        
-    clock_gettime(CLOCK_MONOTONIC,&a);
-    double t = time_diff(lastTime,a);
-    lastTime=a;
+    tick();
+    // there's no need to hold anything up on the virtual clock
+    if(!clock->isVirtual())
+        usleep(5000);
+}
+
+void RoverSimulator::tick(){
+    double now = clock->now();
+    double t = now-lastTime;
+    lastTime=now;
     simulate(t);
-    usleep(5000);
+}
+
+void RoverSimulator::reset(){
+    while(in->hasData())in->read();
+    while(out->hasData())out->read();
+    reply->framed=false;
+    newFraming=-1;
+    frameReader.reset();
+    cmdCt=0;
+    // like the master, we forget the read sets when reset
+    memset(readSetCts,0,sizeof(readSetCts));
 }
 
 void RoverSimulator::poll(){
-    while(in.hasData()){
-        buf[ct++] = in.read();
-        if(buf[0]==ct){
-            processCmd(ct-2,buf+1);
-            ct=0;
+    while(in->hasData()){
+        uint8_t c = in->read();
+        if(reply->framed){
+            // bad frames are ignored, and the PC will time out
+            if(frameReader.feed(c)>0 && frameReader.getLength()){
+                reply->begin(frameReader.getSeq());
+                processCmd(frameReader.getLength()-1,
+                           frameReader.getMessage());
+                reply->end();
+            }
+        } else {
+            cmdBuf[cmdCt++] = c;
+            if(cmdBuf[0]==cmdCt){
+                processCmd(cmdCt-2,cmdBuf+1);
+                cmdCt=0;
+            }
+        }
+        if(newFraming>=0){
+            reply->framed = newFraming!=0;
+            newFraming=-1;
+            frameReader.reset();
+            cmdCt=0;
         }
     }
         
 }
+
+
+PtyLink::PtyLink(Simulator *s){
+    sim = s;
+    fd = -1;
+    running.store(false);
+    baudRate.store(0);
+}
+
+PtyLink::~PtyLink(){
+    stop();
+}
+
+const char *PtyLink::start(){
+    if(fd>=0)return devName;
+    fd = posix_openpt(O_RDWR|O_NOCTTY);
+    if(fd<0)return NULL;
+    int pkt=1;
+    if(grantpt(fd)<0 || unlockpt(fd)<0 ||
+       // packet mode tells us when the other end flushes its input
+       ioctl(fd,TIOCPKT,&pkt)<0){
+        close(fd);
+        fd=-1;
+        return NULL;
+    }
+    strncpy(devName,ptsname(fd),sizeof(devName)-1);
+    devName[sizeof(devName)-1]=0;
+    inCt=outCt=0;
+    inBusyUntil=outBusyUntil=0;
+    running.store(true);
+    if(pthread_create(&thread,NULL,threadFunc,this)){
+        close(fd);
+        fd=-1;
+        return NULL;
+    }
+    return devName;
+}
+
+void PtyLink::stop(){
+    if(fd<0)return;
+    running.store(false);
+    pthread_join(thread,NULL);
+    close(fd);
+    fd=-1;
+}
+
+void *PtyLink::threadFunc(void *p){
+    ((PtyLink *)p)->run();
+    return NULL;
+}
+
+void PtyLink::writeAll(const char *s,int ct){
+    while(ct>0){
+        int n = ::write(fd,s,ct);
+        if(n<0){
+            if(errno==EINTR || errno==EAGAIN)continue;
+            return; // the other end has gone
+        }
+        s+=n;
+        ct-=n;
+    }
+}
+
+void PtyLink::receive(double now){
+    // in packet mode, the first byte says whether this is
+    // data or a change in the other end's state
+    char buf[1025];
+    int space = sizeof(inBuf)-inCt;
+    if(space>1024)space=1024;
+    int n = ::read(fd,buf,space+1);
+    if(n<=0)return;
+    if(buf[0]!=TIOCPKT_DATA){
+        if(buf[0] & TIOCPKT_FLUSHREAD){
+            // treat this as a reset
+            sim->reset();
+            inCt=outCt=0;
+            writeAll("Ready\n",6);
+        }
+        return;
+    }
+    int b = baudRate.load();
+    double byteTime = b ? 10.0/b : 0;
+    if(inBusyUntil<now)inBusyUntil=now;
+    for(int i=1;i<n;i++){
+        inBusyUntil += byteTime;
+        inReadyTime[inCt]=inBusyUntil;
+        inBuf[inCt++]=buf[i];
+    }
+}
+
+void PtyLink::deliver(double now){
+    int n=0;
+    while(n<inCt && inReadyTime[n]<=now)
+        n++;
+    if(!n)return;
+    sim->write((const char *)inBuf,n);
+    inCt-=n;
+    memmove(inBuf,inBuf+n,inCt);
+    memmove(inReadyTime,inReadyTime+n,inCt*sizeof(double));
+}
+
+double PtyLink::send(double now){
+    // if the line was idle, it can start sending now; if not, we
+    // carry on from where it got to, which may be in the past if we
+    // slept for longer than a byte takes.
+    if(!outCt && outBusyUntil<now)
+        outBusyUntil=now;
+    outCt += sim->read((char *)outBuf+outCt,sizeof(outBuf)-outCt);
+    if(!outCt)return 1;
+    int b = baudRate.load();
+    if(!b){
+        writeAll((const char *)outBuf,outCt);
+        outCt=0;
+        return 1;
+    }
+    // send what would have gone by now, at least a byte at a time
+    double byteTime = 10.0/b;
+    if(outBusyUntil-now>byteTime)
+        return outBusyUntil-now-byteTime;
+    int n = (int)((now-outBusyUntil)/byteTime)+1;
+    if(n>outCt)n=outCt;
+    writeAll((const char *)outBuf,n);
+    outBusyUntil += n*byteTime;
+    outCt-=n;
+    memmove(outBuf,outBuf+n,outCt);
+    return outCt ? byteTime : 1;
+}
+
+/// how often the link thread ticks the simulator
+#define PTYTICKINTERVAL 0.01
+
+void PtyLink::run(){
+    double lastTick = getRealMonotonicTime();
+    double wait = 0;
+    
+    while(running.load()){
+        // wait for data, or until we need to deliver or send
+        // paced bytes, or tick the simulator
+        double now = getRealMonotonicTime();
+        if(inCt && inReadyTime[0]-now<wait)
+            wait = inReadyTime[0]-now;
+        if(lastTick+PTYTICKINTERVAL-now<wait)
+            wait = lastTick+PTYTICKINTERVAL-now;
+        int ms = wait>0 ? (int)(wait*1000.0+0.999) : 0;
+        if(ms>5)ms=5; // so we notice being stopped
+        
+        pollfd p;
+        p.fd = fd;
+        // only read when there is room for it
+        p.events = inCt<(int)sizeof(inBuf) ? POLLIN : 0;
+        int rv = poll(&p,1,ms);
+        now = getRealMonotonicTime();
+        if(rv>0 && (p.revents & POLLIN))
+            receive(now);
+        else if(rv>0 && (p.revents & POLLHUP)){
+            // nothing has the other end open
+            usleep(5000);
+        }
+        
+        deliver(now);
+        wait = send(now);
+        
+        if(now-lastTick>=PTYTICKINTERVAL){
+            lastTick=now;
+            sim->tick();
+        }
+    }
+}
@@ -10,65 +10,250 @@
 #define __SIM_H
 
 
-/// run a simulator tick every 0.1 seconds
-#define SIMTICKLENGTH 0.1f
-
-
-
 
 /// the rover simulator is an implementation of the simulator interface.
+/// Time passes for it on its clock (the default one unless it's given
+/// another), so on a virtual clock (see timing.h) it runs only as time
+/// is moved on, with no pause in update(), and simulates all of it
+/// however much there is.
 class RoverSimulator : public Simulator {
 public:
     RoverSimulator();
     ~RoverSimulator();
     
-    /// set the factor by which the motor speed is multiplied to
-    /// generate a current value. The default is 0.07.
+    /// set the factor which sets the load on the simulated drive
+    /// motors (their viscous friction), and so the current they
+    /// draw at a given speed. The default is 0.07. This is
+    /// shared by all simulators.
     static void setSimCurrentFactor(float t){
-        simCurrentFactor = t;
+        simCurrentFactor.store(t,std::memory_order_relaxed);
     }
     
-    /// get the factor by which the motor speed is multiplied to
-    /// generate a current value. The default is 0.07.
+    /// get the factor which sets the load on the simulated drive
+    /// motors. The default is 0.07.
     static float getSimCurrentFactor(){
-        return simCurrentFactor;
+        return simCurrentFactor.load(std::memory_order_relaxed);
     }
     /// returns how many chars read, ct is max amount
     virtual int read(char *buf,int ct);
     /// return -ve on error (which should be never in a simulator)
     virtual int write(const char *s,int ct);
     
-    /// run the sim
+    /// run the sim, pausing briefly
     virtual void update();
     
+    /// run the sim without pausing
+    virtual void tick();
+    
+    /// go back to unframed messages and discard any partial command,
+    /// as the master does when reset. Register values are kept.
+    virtual void reset();
+    
     /// process pending commands
     virtual void poll();
     
+    /// run on a clock other than the default one, such as the
+    /// rover's; Rover::setClock() does this for its own simulator
+    void setClock(Clock *c){
+        clock = c;
+        lastTime = clock->now();
+    }
+    
+    /// get the clock we run on
+    Clock *getClock(){
+        return clock;
+    }
+    
+    /// the system's monotonic time (see getRealMonotonicTime()) at which
+    /// every slave was found to be in an exception, or zero if one
+    /// isn't - for measuring how long an emergency stop takes
+    double getAllStoppedTime(){
+        return allStoppedTime.load();
+    }
+    
+    /// make the simulated master ignore a command (CMD_ESTOP, say)
+    /// as firmware which predates it does, or know it again, so that
+    /// the library's fallbacks for older masters can be tried
+    void setCommandKnown(int cmd,bool known){
+        if(known)
+            unknownCmds &= ~(1<<cmd);
+        else
+            unknownCmds |= 1<<cmd;
+    }
+    
     
 private:    
     
-    static float simCurrentFactor;
+    static std::atomic<float> simCurrentFactor;
     
     /// the simulated drive motors
-    class MotorSim *drive[6];
+    class SpeedMotorSim *drive[6];
     /// the simulated steer motors
-    class MotorSim *steer[6];
+    class PositionMotorSim *steer[6];
     /// the simulated lift motors
-    class MotorSim *lift[6];
+    class PositionMotorSim *lift[6];
+    /// whether each wheel's drive/steer board is in an exception
+    bool dsException[6];
+    /// whether each wheel's lift board is in an exception
+    bool llException[6];
+    
+    /// a bit for each command we ignore, as an older master would
+    uint16_t unknownCmds;
+    /// see getAllStoppedTime()
+    std::atomic<double> allStoppedTime;
+    
+    /// the time not yet simulated, less than a step
+    double timeSoFar;
+    /// the clock time passes on for us
+    Clock *clock;
+    /// when tick() was last called, on our clock
+    double lastTime;
+    
+    // Everything the simulated master and slaves hold is in the
+    // simulator object, so that any number of simulators can run
+    // at once.
+    
+    class CyclicBuf *in; //!< bytes from the system to the simulator
+    class CyclicBuf *out; //!< bytes from the simulator to the system
+    /// writes replies to out, framed or not
+    class SimReplyWriter *reply;
+    
+    /// read sets for each device, indexed by device and then set
+    int readSets[16][16][32]; // should be loads of space
+    /// the number of registers in each read set
+    int readSetCts[16][16];
+    /// register values for each device, as sent over the wire
+    uint16_t regs[16][64];
+    /// the slaves' millisecond timers, which we keep together
+    double slaveMillis;
     
-    /// the time accumulator
-    float timeSoFar;
+    uint8_t cmdBuf[256]; //!< unframed command buffer
+    int cmdCt; //!< bytes in cmdBuf
+    /// decodes frames into cmdBuf
+    FrameReader frameReader;
+    /// framing to switch to after the reply: -1 for no change,
+    /// otherwise 0 or 1.
+    int newFraming;
+    
+    /// set a register on a device from a float
+    void setr(int d,int n,float v);
+    /// get a register on a device as a float
+    float getr(int d,int n);
+    
+    // the commands, much as the master does them
+    
+    /// apply a block of writes to a device, returning a pointer to the
+    /// byte after the block
+    uint8_t *applywrites(int id,uint8_t *p);
+    void doread(int id,uint8_t *p);
+    void dowrite(int id,uint8_t *p);
+    void dowriteread(int id,uint8_t *p);
+    void domultiread(uint8_t *p,int ct);
+    void domultiwrite(uint8_t *p,int ct);
+    void doreadset(int id,uint8_t *p,int ct);
+    /// true if the different non-empty read sets held wouldn't fit
+    /// into the master's pool: too many of them, or too many registers
+    /// between them
+    bool readSetPoolFull();
+    void doframing(uint8_t *p,int ct);
+    void doping();
+    void doestop();
+    /// put a slave into an exception, as another slave's
+    /// exception (or an emergency stop) does
+    void raiseRemoteException(int id);
+    /// process a complete command
+    void processCmd(int ct,uint8_t *p);
     
     /// simulate the rover, where t is a time interval. This is
-    /// added to an accumulator, and when it goes over a simtick,
-    /// we run the simulation.
+    /// added to an accumulator, and the motors are run in fixed
+    /// steps of SIMSTEP until it's used up.
     void simulate(double t);
-    /// simulate the motors for a single simtick
-    void simMotors(double t);
+    /// set the motors up from the registers
+    void loadMotors();
+    /// run the motors for a single step
+    void stepMotors();
+    /// write the motors' state to the registers
+    void storeMotors();
+    /// set a motor's controller up from its registers on a device
+    void loadMotor(int d,const struct SimMotorRegs &r,class MotorSim *m);
+    /// write a motor's state to its registers on a device
+    void storeMotor(int d,const struct SimMotorRegs &r,class MotorSim *m);
     
 };
 
 
 
 
+/// connects a simulator to a pseudo-terminal, so that it can be
+/// reached through a serial device (and so through the real termios,
+/// poll and read code in SerialComms) instead of being plugged in
+/// below SerialComms. Any program can connect to the device, so
+/// Rover::init() can be given its name unmodified. A thread moves
+/// bytes between the terminal and the simulator, ticking the simulator
+/// as it goes, and can pace the bytes at a baud rate to give realistic
+/// timings. Like the real master being reset, it resets the simulator
+/// and sends "Ready" when the other end sets up the port and flushes
+/// its input.
+
+class PtyLink {
+    Simulator *sim; //!< the simulator being served
+    int fd; //!< master side of the pseudo-terminal
+    char devName[64]; //!< name of the slave side
+    pthread_t thread; //!< the thread serving the simulator
+    std::atomic<bool> running; //!< cleared to stop the thread
+    std::atomic<int> baudRate; //!< rate to pace bytes at, or 0 for no pacing
+    
+    /// bytes from the other end waiting to be passed to the simulator
+    /// once they've had time to arrive
+    uint8_t inBuf[4096];
+    int inCt; //!< bytes in inBuf
+    double inReadyTime[4096]; //!< when each byte in inBuf has arrived
+    double inBusyUntil; //!< when the last byte received has arrived
+    
+    /// bytes from the simulator waiting to be sent
+    uint8_t outBuf[4096];
+    int outCt; //!< bytes in outBuf
+    double outBusyUntil; //!< when the last byte sent will have gone
+    
+    static void *threadFunc(void *p);
+    /// the thread's main loop
+    void run();
+    /// write all of a block to the terminal
+    void writeAll(const char *s,int ct);
+    /// handle data or a state change from the other end
+    void receive(double now);
+    /// pass bytes which have arrived to the simulator
+    void deliver(double now);
+    /// send what we can of the simulator's output, returning how
+    /// long to wait before sending more
+    double send(double now);
+    
+public:
+    /// create a link for a simulator, which should not be connected
+    /// to anything else
+    PtyLink(Simulator *s);
+    ~PtyLink();
+    
+    /// create the pseudo-terminal and start serving the simulator on
+    /// it, returning the device name or NULL on failure.
+    const char *start();
+    
+    /// stop serving and close the pseudo-terminal
+    void stop();
+    
+    /// the name of the device to connect to, or NULL if not started
+    const char *getDeviceName(){
+        return fd>=0 ? devName : NULL;
+    }
+    
+    /// pace bytes in both directions as if they were going over a
+    /// serial line at this baud rate (with 10 bits per byte), or
+    /// not at all if zero (the default). The rate the other end
+    /// sets on the terminal makes no difference.
+    void setBaudRate(int b){
+        baudRate.store(b);
+    }
+};
+
+
 #endif /* __SIM_H */
@@ -14,20 +14,68 @@
 #include "regconfig.h"
 #include "regs.h"
 #include "regsauto.h"
+#include "regtypes.h"
+#include "framing.h"
+#include "commands.h"
+#include "timing.h"
 
 #include <stdint.h>
+#include <functional>
+#include <atomic>
 #include "roverexcept.h"
 
-#define CMD_WRITE 2 //!< register changes
-#define CMD_READ 3  //!< read registers in read set
-#define CMD_SETREADSET 4  //!< change the read set
-
-#define READSET_DRIVESTEER 0
-#define READSET_LIFT	1
-#define READSET_MASTER  2
+/// classes of data, each of which Rover::update() reads at its own
+/// rate. Each board uses the read set with the same index as the
+/// class for its registers of that class.
+#define DATA_ACTUAL 0 //!< status, exceptions, actual speeds and positions
+#define DATA_CURRENT 1 //!< motor currents
+#define DATA_PID 2 //!< PID internals and slave timing
+#define DATA_TEMP 3 //!< temperatures (on the master)
+/// number of data classes
+#define DATACLASSES 4
+/// a mask of all the data classes
+#define DATA_ALL ((1<<DATACLASSES)-1)
 
+/// the first read set not used for a data class
 #define READSET_SPARE 4
 
+/// the most (device,read set) pairs which can go into a single
+/// multiple read
+#define MAXMULTIREAD 32
+
+/// the most devices which can be written in a single multiple write
+#define MAXMULTIWRITE 16
+
+/// the largest reply we can get - a multiple read of the largest
+/// read sets
+#define MAXREPLYSIZE (MAXMULTIREAD*READSETSIZE*2)
+
+/// the most commands which can be outstanding in pipelined mode
+#define MAXWINDOW 16
+
+/// how many bytes of pipelined commands we allow to be awaiting
+/// processing by the master at once, so we don't overflow the 64
+/// byte serial receive buffer on the Arduino.
+#define MAXBYTESINFLIGHT 60
+
+/// the most register writes which can be waiting in a block - enough
+/// to fill a write/read command with 2-byte writes
+#define MAXBLOCKWRITES 80
+
+/// largest message which can be sent in a frame, limited by the
+/// size of the master's receive buffer
+#define MAXFRAMEMSG (256-FRAME_OVERHEAD)
+
+/// how long we wait for the master to acknowledge an emergency stop,
+/// in microseconds - it replies as soon as it has told the slaves
+#define ESTOPTIMEOUT 100000
+
+/// the most bytes an emergency stop command can take when framed, with
+/// every byte escaped. Pipelined commands leave this much room in the
+/// master's receive buffer, so that the stop can always be written
+/// straight away.
+#define MAXESTOPFRAME (2*(1+FRAME_OVERHEAD)+2)
+
 ///an exception thrown when a slave communication generates
 ///an error - typically due to a protocol failure.
 class SlaveException : public RoverException {
@@ -40,14 +88,36 @@ public:
     }
 };
 
+/// thrown instead of sending a command when an emergency stop has been
+/// asked for (see SlaveProtocol::requestStop()), so that whatever is
+/// talking to the rover gives up and lets the stop go out
+class StopRequestedException : public SlaveException {
+public:
+    StopRequestedException() : SlaveException("abandoned for an emergency stop"){}
+};
 
 
+/// a function called when the reply to a pipelined command arrives,
+/// given the reply data and its size, and the monotonic times at which
+/// the command was written and its reply read. It must not send any
+/// commands. If the reply is lost (after a timeout, say) the handler is
+/// called with a null pointer. If it throws, the replies to the rest of
+/// the window are read and handled before the exception is passed on.
+typedef std::function<void(const uint8_t *reply,int size,
+                           double sent,double received)> ReplyHandler;
 
 /// encapsulates the low-level comms protocol by preceding blocks
 /// with a byte giving their length so that the Arduino knows how
 /// much to read, and with the command code and device ID.
 /// This object should, in turn, be wrapped by a SlaveDevice
 /// (or a number of them)
+/// 
+/// Normally each command is sent and its reply awaited before anything
+/// else happens. Commands sent with sendPipelined() instead are sent
+/// without waiting, up to a window of outstanding commands; their
+/// replies arrive in order and are passed to handlers when we next
+/// need to wait for the master (when the window is full, in sync(), or
+/// before a normal send()).
 
 class SlaveProtocol {
     /// the buffer for commands. The count is in the first byte.
@@ -56,6 +126,74 @@ class SlaveProtocol {
     /// the buffer count is also kept here
     uint8_t ct;
     
+    /// true once the master has agreed to framed messages
+    std::atomic<bool> framed;
+    /// true once the master has answered a ping or agreed to framing,
+    /// which arrived in the same firmware as the emergency stop
+    std::atomic<bool> estopKnown;
+    /// set while an emergency stop is waiting to be sent
+    std::atomic<bool> stopRequested;
+    /// true if requestStop() has written the emergency stop command,
+    /// whose reply emergencyStop() must read
+    bool stopSent;
+    /// sequence number of that command, if framed
+    uint8_t stopSeq;
+    /// held while writing to the comms, so that requestStop() can
+    /// write the emergency stop from another thread
+    pthread_mutex_t writeMutex;
+    /// sequence number of the last frame sent
+    uint8_t seq;
+    /// sequence number of the frame whose reply we are reading
+    uint8_t replySeq;
+    /// number of bad or stale frames received and discarded
+    int badFrames;
+    /// time on our clock at which the last command was written
+    double sendTime;
+    /// the clock the send and receive times are on
+    Clock *clock;
+    
+    /// encodes a frame into a buffer, so that it can be written
+    /// in one go
+    struct BufferFrameWriter : public FrameWriter {
+        /// the encoded frame - every byte might be escaped, and
+        /// there are two delimiters
+        uint8_t buf[2*(MAXFRAMEMSG+FRAME_OVERHEAD)+2];
+        /// bytes in the buffer
+        int ct;
+    protected:
+        virtual void emit(uint8_t c){
+            buf[ct++]=c;
+        }
+    } txFrame;
+    
+    /// buffer for incoming frames
+    uint8_t rxFrameBuf[MAXREPLYSIZE+FRAME_OVERHEAD];
+    /// decodes incoming frames into rxFrameBuf
+    FrameReader rxFrame;
+    
+    /// a pipelined command which has been sent but whose
+    /// reply has not yet been read
+    struct PendingReply {
+        int size; //!< size of the reply
+        int sent; //!< size of the command
+        double sentAt; //!< monotonic time the command was written
+        uint8_t seq; //!< sequence number of the command, if framed
+        ReplyHandler handler; //!< called with the reply
+    };
+    
+    /// circular queue of outstanding commands, oldest first
+    PendingReply pending[MAXWINDOW];
+    /// index of the oldest outstanding command
+    int pendHead;
+    /// number of outstanding commands
+    int pendCt;
+    /// the maximum number of outstanding commands
+    int window;
+    /// bytes of outstanding commands
+    int bytesInFlight;
+    /// buffer the replies to pipelined commands are read into
+    uint8_t replyBuf[MAXREPLYSIZE];
+    
     /// internal - asserts that we are actually inside a block
     /// (since starting a block will add size and command, count will
     /// be non-zero)
@@ -63,20 +201,279 @@ class SlaveProtocol {
         if(!ct)throw SlaveException("adding command data while not in a block");
     }
     
+    /// throw away the block being built and throw if an emergency stop
+    /// has been asked for, so that it can go out at once
+    void checkStop(){
+        if(stopRequested.load(std::memory_order_relaxed)){
+            ct=0;
+            throw StopRequestedException();
+        }
+    }
+    
+    /// write the block to the comms, returning the number of
+    /// bytes sent. If an emergency stop has been asked for, the block
+    /// is thrown away instead: requestStop() may have written the stop
+    /// already, and its reply must be the next one.
+    int writeBlock(){
+        int rv,n;
+        pthread_mutex_lock(&writeMutex);
+        if(stopRequested.load()){
+            pthread_mutex_unlock(&writeMutex);
+            ct=0;
+            throw StopRequestedException();
+        }
+        sendTime = clock->now();
+        if(framed){
+            // the count byte is redundant in a frame
+            if(ct-1>MAXFRAMEMSG){
+                pthread_mutex_unlock(&writeMutex);
+                ct=0;
+                throw SlaveException("message too long for frame");
+            }
+            replySeq = ++seq;
+            n = encodeFrame(seq,buf+1,ct-1);
+            rv = comms->write((const char *)txFrame.buf,n);
+        } else {
+            buf[0]=ct;
+            n=ct;
+            rv = comms->write((const char *)buf,ct);
+            //            dump("Write",buf,ct);
+        }
+        pthread_mutex_unlock(&writeMutex);
+        ct=0;
+        if(rv<0)
+            throw SlaveException("cannot write block: %d",rv);
+        return n;
+    }
+    
+    /// encode a frame into txFrame, returning its size
+    int encodeFrame(uint8_t s,const uint8_t *msg,int len){
+        txFrame.ct=0;
+        txFrame.begin(s);
+        txFrame.put(msg,len);
+        txFrame.end();
+        return txFrame.ct;
+    }
+    
+    /// read a frame containing the reply to the command with
+    /// the sequence number replySeq, skipping bad frames and
+    /// replies to earlier commands
+    void readFrame(uint8_t *ptr,int size){
+        timespec deadline = comms->getDeadline();
+        for(;;){
+            const uint8_t *p;
+            int n = comms->peek(&p,deadline);
+            if(n<0){
+                rxFrame.reset();
+                if(comms->getStatus()&SerialComms::TIMEOUT){
+                    // the next frame will resynchronise us, so
+                    // there's no need to reconnect
+                    comms->clearTimeout();
+                    throw SlaveException("time out in read");
+                } else {
+                    throw SlaveException("error in read");
+                }
+            }
+            // decode straight out of the comms buffer
+            for(int i=0;i<n;i++){
+                int r = rxFrame.feed(p[i]);
+                if(r<0){
+                    badFrames++;
+                    comms->notifyMessage("bad frame discarded");
+                } else if(r>0){
+                    if(rxFrame.getSeq()!=replySeq){
+                        badFrames++;
+                        comms->notifyMessage("stale frame %d discarded",
+                                             rxFrame.getSeq());
+                        continue;
+                    }
+                    // leave anything after the frame for next time
+                    comms->consume(i+1);
+                    if(rxFrame.getLength()!=size)
+                        throw SlaveException("bad reply length %d, expected %d",
+                                             rxFrame.getLength(),size);
+                    memcpy(ptr,rxFrame.getMessage(),size);
+                    return;
+                }
+            }
+            comms->consume(n);
+        }
+    }
+    
+    /// read the reply to the oldest outstanding command and pass
+    /// it to its handler
+    void completeOne(){
+        PendingReply &r = pending[pendHead];
+        ReplyHandler h = r.handler;
+        int size = r.size;
+        double sentAt = r.sentAt;
+        pendHead = (pendHead+1)%MAXWINDOW;
+        pendCt--;
+        bytesInFlight -= r.sent;
+        replySeq = r.seq;
+        try {
+            readBlock(replyBuf,size);
+        } catch(SlaveException &e){
+            // we've lost track of the replies, so forget them all,
+            // telling their handlers they won't arrive
+            if(h)h(NULL,0,sentAt,0);
+            while(pendCt){
+                PendingReply &q = pending[pendHead];
+                if(q.handler)q.handler(NULL,0,q.sentAt,0);
+                pendHead = (pendHead+1)%MAXWINDOW;
+                pendCt--;
+            }
+            bytesInFlight=0;
+            throw;
+        }
+        if(!h)return;
+        double received = clock->now();
+        try {
+            h(replyBuf,size,sentAt,received);
+        } catch(...){
+            // read the rest of the window before passing the exception
+            // on, so that later replies aren't left pending until the
+            // next call. Any exceptions their handlers throw are lost.
+            while(pendCt){
+                try {
+                    completeOne();
+                } catch(...){}
+            }
+            throw;
+        }
+    }
+    
 public:
     
     /// the comms system 
     SerialComms *comms;
     
     /// constructor - we still need to call init() after this
-    SlaveProtocol(){
+    SlaveProtocol() : rxFrame(rxFrameBuf,sizeof(rxFrameBuf)) {
         comms = NULL;
         ct=0;
+        framed=false;
+        estopKnown=false;
+        stopRequested.store(false);
+        stopSent=false;
+        pthread_mutex_init(&writeMutex,NULL);
+        seq=replySeq=0;
+        badFrames=0;
+        sendTime=0;
+        clock=getDefaultClock();
+        pendHead=pendCt=0;
+        bytesInFlight=0;
+        window=1;
+    }
+    
+    ~SlaveProtocol(){
+        pthread_mutex_destroy(&writeMutex);
     }
     
     /// initialise the protocol, telling it which comms we're using
     void init(SerialComms *c){
         comms = c;
+        pendCt=0;
+        bytesInFlight=0;
+        framed=false;
+        estopKnown=false;
+        stopSent=false;
+        rxFrame.reset();
+    }
+    
+    /// ask the master to switch to framed messages, returning true
+    /// if it did. Older firmware doesn't know the command and won't
+    /// reply, so after the timeout we carry on unframed.
+    bool startFraming(){
+        if(framed)return true;
+        uint8_t v;
+        start(0,CMD_FRAMING);
+        addByte(FRAME_VERSION);
+        send();
+        try {
+            readBlock(&v,1);
+        } catch(SlaveException &e){
+            comms->clearTimeout();
+            return false;
+        }
+        if(v!=FRAME_VERSION)
+            return false;
+        framed=true;
+        estopKnown=true;
+        rxFrame.reset();
+        return true;
+    }
+    
+    /// ask the master to switch back to unframed messages
+    void stopFraming(){
+        if(!framed)return;
+        uint8_t v;
+        start(0,CMD_FRAMING);
+        addByte(0);
+        send();
+        readBlock(&v,1);
+        framed=false;
+    }
+    
+    /// check the master is running and replying, returning true and
+    /// its health flags (PING_EXCEPTION etc.) if it is. It may still be
+    /// framed from an earlier connection, so we try unframed and then
+    /// framed - an unframed message is ignored by a framed master,
+    /// which resynchronises at the start of the next frame. If we know
+    /// it isn't framed, tryFramed can be false.
+    bool ping(uint8_t *health,bool tryFramed=true){
+        for(int f=0;f<(tryFramed?2:1);f++){
+            uint8_t r[3];
+            framed = f!=0;
+            rxFrame.reset();
+            start(0,CMD_PING);
+            send();
+            try {
+                readBlock(r,3);
+            } catch(SlaveException &e){
+                comms->clearTimeout();
+                continue;
+            }
+            if(r[0]==PING_MAGIC){
+                *health = r[2];
+                estopKnown=true;
+                return true;
+            }
+        }
+        framed=false;
+        return false;
+    }
+    
+    /// true if messages are being framed
+    bool isFramed(){
+        return framed;
+    }
+    
+    /// true if the master is known to have the emergency stop
+    /// command, because it has answered a ping or agreed to framing
+    /// since init()
+    bool knowsEStop(){
+        return estopKnown;
+    }
+    
+    /// the number of bad or stale frames which have been discarded
+    int getBadFrameCount(){
+        return badFrames;
+    }
+    
+    /// set the number of pipelined commands which can be awaiting
+    /// replies at once. Outstanding replies are read first.
+    void setWindow(int n){
+        if(n<1 || n>MAXWINDOW)
+            throw SlaveException("bad pipeline window: %d",n);
+        sync();
+        window=n;
+    }
+    
+    /// get the number of pipelined commands which can be awaiting
+    /// replies at once
+    int getWindow(){
+        return window;
     }
     
     /// start a new command, putting the slave ID into the top four bits
@@ -92,7 +489,7 @@ public:
     /// add a block of memory to the block to be sent
     void add(uint8_t *ptr,int size){
         assertInBlock();
-        if(size+*buf > 255)
+        if(size+ct > 255)
             throw SlaveException("message too long");
         
         memcpy(buf+ct,ptr,size);
@@ -107,24 +504,193 @@ public:
         buf[ct++]=b;
     }
     
-    /// send the block if there is any block to be sent
+    /// send the block if there is any block to be sent. The caller
+    /// will read the reply, so any pipelined replies are read first.
     void send(){
         assertInBlock();
         if(ct>1){
-            buf[0]=ct;
-            int rv = comms->write((const char *)buf,ct);
-            //            dump("Write",buf,ct);
-            ct=0;
-            if(rv<0)
-                throw SlaveException("cannot write block: %d",rv);
+            checkStop();
+            sync();
+            writeBlock();
+        }
+    }
+    
+    /// send the block without waiting for the reply, which will be
+    /// of the given size and will be passed to the handler once it
+    /// arrives. If the window is full, we wait for the oldest
+    /// outstanding reply first.
+    void sendPipelined(int replySize,ReplyHandler h){
+        assertInBlock();
+        if(replySize>MAXREPLYSIZE)
+            throw SlaveException("reply too long");
+        checkStop();
+        while(pendCt && (pendCt>=window ||
+                         bytesInFlight+ct > MAXBYTESINFLIGHT-MAXESTOPFRAME)){
+            completeOne();
+            checkStop();
+        }
+        
+        PendingReply &r = pending[(pendHead+pendCt)%MAXWINDOW];
+        r.size = replySize;
+        r.handler = h;
+        r.sent = writeBlock();
+        r.sentAt = sendTime;
+        r.seq = replySeq;
+        bytesInFlight += r.sent;
+        pendCt++;
+    }
+    
+    /// wait for the replies to all outstanding pipelined commands,
+    /// passing them to their handlers
+    void sync(){
+        while(pendCt){
+            checkStop();
+            completeOne();
+        }
+    }
+    
+    /// ask for an emergency stop, from a thread which doesn't have the
+    /// rover to itself: until clearStopRequest(), every command which
+    /// would be sent and every wait for a pipelined reply throws
+    /// StopRequestedException instead, so whoever is talking to the
+    /// rover abandons what it is doing at the next command. If the
+    /// master is known to have the emergency stop command it is
+    /// written straight away, without waiting for the reply to the
+    /// command in progress; pipelined commands always leave room for
+    /// it in the master's receive buffer. The in-process simulator
+    /// can't be written to from two threads, so with that the stop
+    /// waits for emergencyStop(). The same thread must then call
+    /// emergencyStop(), once it has the rover to itself, which reads
+    /// the replies.
+    void requestStop(){
+        pthread_mutex_lock(&writeMutex);
+        stopRequested.store(true);
+        if(!stopSent && estopKnown && comms && comms->isReady() &&
+           !comms->isSim()){
+            uint8_t cmd[2] = {2,CMD_ESTOP};
+            int rv;
+            if(framed){
+                stopSeq = ++seq;
+                int n = encodeFrame(stopSeq,cmd+1,1);
+                rv = comms->write((const char *)txFrame.buf,n);
+            } else
+                rv = comms->write((const char *)cmd,2);
+            stopSent = rv>=0;
+        }
+        pthread_mutex_unlock(&writeMutex);
+    }
+    
+    /// let commands be sent again after requestStop(); the thread
+    /// which will send the stop does this, once it has the rover to
+    /// itself
+    void clearStopRequest(){
+        stopRequested.store(false);
+    }
+    
+private:
+    /// read a pipelined reply during an emergency stop, reporting
+    /// any error rather than throwing it. A timeout is cleared so
+    /// that the stop can still be sent.
+    void completeForStop(){
+        try {
+            completeOne();
+        } catch(SlaveException &e){
+            comms->clearTimeout();
+            comms->notifyMessage("pipelined reply during emergency stop: %s",
+                                 e.what());
         }
     }
     
+public:
+    
+    /// tell the master to stop every motor at once: it writes the
+    /// exception register of all the slaves with a single I2C general
+    /// call, which each takes as an exception on another slave, so
+    /// that its motors stop until its exceptions are reset. The
+    /// command may already have been written by requestStop();
+    /// otherwise it is sent before the replies to any pipelined
+    /// commands are read, so it doesn't wait behind them in the
+    /// window - unless the window's bytes are at MAXBYTESINFLIGHT,
+    /// when just enough replies are read first to make room for it in
+    /// the master's receive buffer. The pipelined replies are then
+    /// read before ours; an error in one is reported as a message,
+    /// since it mustn't stop us finding out whether the stop worked.
+    /// We only wait ESTOPTIMEOUT for our own reply, so that a master
+    /// without the command is soon noticed.
+    void emergencyStop(){
+        uint8_t status;
+        uint8_t seq;
+        clearStopRequest();
+        if(stopSent){
+            stopSent=false;
+            seq = stopSeq;
+        } else {
+            start(0,CMD_ESTOP);
+            while(pendCt && bytesInFlight+ct > MAXBYTESINFLIGHT)
+                completeForStop();
+            writeBlock();
+            seq = replySeq;
+        }
+        while(pendCt)
+            completeForStop();
+        replySeq = seq;
+        timeval t = comms->getTimeout();
+        comms->setTimeout(0,ESTOPTIMEOUT);
+        try {
+            readBlock(&status,1);
+        } catch(SlaveException &e){
+            comms->setTimeout(t.tv_sec,t.tv_usec);
+            throw;
+        }
+        comms->setTimeout(t.tv_sec,t.tv_usec);
+        if(status)
+            throw SlaveException("error in emergency stop: %d",status);
+    }
+    
+    /// get back in step with the master after a failed exchange,
+    /// throwing away anything it has sent which we haven't read
+    void resync(){
+        stopSent=false;
+        comms->clearTimeout();
+        comms->discardInput();
+        rxFrame.reset();
+    }
+    
+    /// time commands and replies on a clock other than the default
+    /// one (see Rover::setClock())
+    void setClock(Clock *c){
+        clock = c;
+    }
+    
+    /// get the clock commands and replies are timed on
+    Clock *getClock(){
+        return clock;
+    }
+    
+    /// get the monotonic time at which the last command was written,
+    /// after any wait for pipelined replies to make room for it - the
+    /// start of its round trip
+    double getSendTime(){
+        return sendTime;
+    }
+    
+    /// return the number of pipelined commands awaiting replies
+    int getPendingCount(){
+        return pendCt;
+    }
+    
     /// read a block of known length - will keep reading until the
-    /// correct number of bytes has been read.
+    /// correct number of bytes has been read. If framing is on,
+    /// this must be the whole of a reply.
     void readBlock(uint8_t *ptr,int size){
+        if(framed){
+            readFrame(ptr,size);
+            return;
+        }
+        timespec deadline = comms->getDeadline();
         while(size){
-            int rv = comms->read((char *)ptr,size);            
+            const uint8_t *p;
+            int rv = comms->peek(&p,deadline);
             if(rv<0){
                 if(comms->getStatus()&SerialComms::TIMEOUT){
                     throw SlaveException("time out in read");
@@ -132,6 +698,9 @@ public:
                     throw SlaveException("error in read");
                 }
             }
+            if(rv>size)rv=size;
+            memcpy(ptr,p,rv);
+            comms->consume(rv);
             //            dump("Partial read",ptr,rv);
             ptr+=rv;
             size-=rv;
@@ -164,15 +733,161 @@ class SlaveDevice {
     /// register values - these are from the read set, so if the read
     /// set is 2,3,4 then regVals[0-2] will be values from registers 2,3,4
     uint16_t regVals[64];
+    
+    /// register values indexed by register number, from the last
+    /// read of any set which included them
+    uint16_t values[64];
+    
+    /// a register write waiting to be sent
+    struct PendingWrite {
+        uint8_t reg; //!< register number
+        uint16_t val; //!< raw value
+    };
+    /// writes in the current block (or held), in the order they
+    /// were first made
+    PendingWrite writes[MAXBLOCKWRITES];
+    /// number of writes in the block
+    int writeCt;
+    
+    /// the last value written to each register, so we can skip
+    /// writes which wouldn't change anything
+    uint16_t shadow[64];
+    /// bit n is set if shadow[n] is known to be the slave's value
+    uint64_t shadowValid;
+    /// bit n is set if the slave can change register n itself (such
+    /// as a required speed, which is zeroed in an exception), so
+    /// writes to it are never skipped
+    uint64_t volatileRegs;
+    /// number of writes skipped because of the shadow
+    int suppressedWrites;
     /// how many registers in the table
     int regCt;
     
-    static uint8_t readSet[READSETS][READSETSIZE];
-    static uint8_t readSetCt[READSETS];
+    /// this device's read sets - each device has its own
+    uint8_t readSet[READSETS][READSETSIZE];
+    /// the number of registers in each read set
+    uint8_t readSetCt[READSETS];
+    /// the size in bytes of the reply to a read of each read set
+    uint8_t readSetSize[READSETS];
+    /// the decoder for each read set, if any, which is given the
+    /// reply instead of it being copied into the register values
+    std::function<void(const uint8_t *)> decoders[READSETS];
+    /// the last reply to each read set with a decoder, kept as it
+    /// came so the register values can be unpacked only if asked for
+    uint8_t rawReplies[READSETS][READSETSIZE*2];
+    /// bit n is set if rawReplies[n] hasn't been unpacked yet
+    uint8_t rawSets;
+    /// the order in which the raw replies arrived, so that they are
+    /// unpacked in it when two sets share a register
+    uint32_t rawOrder[READSETS];
+    /// counts replies kept raw, for rawOrder
+    uint32_t rawCount;
+    /// bit n is set if the master is known to have read set n as
+    /// we have it, so it needn't be sent again
+    uint8_t readSetsSent;
+    
+    /// when the last read of each set was sent, and when its reply
+    /// arrived, in monotonic seconds (zero if never read)
+    double readSent[READSETS];
+    double readReceived[READSETS]; //!< see readSent
     
     /// the set we have just read with readSet()
     int curSet;
     
+    /// if true, write blocks are held rather than sent, and go
+    /// out with the next read
+    bool deferring;
+    /// true if there is a held block of writes in the buffer
+    bool writesHeld;
+    
+    /// is a register one of the common block (reset, debug LEDs
+    /// and so on) which act as commands? These are never skipped or
+    /// combined.
+    static bool isCommandReg(int r){
+        return r<=REG_DEBUG;
+    }
+    
+    /// encode the writes in the block into the buffer, with the
+    /// count in the first byte, returning the count. Writes which
+    /// wouldn't change the register are skipped. The shadow is
+    /// updated as if the writes succeeded, and must be invalidated
+    /// if they don't.
+    int encodeWrites(){
+        bool hardReset=false;
+        buf[0]=0;
+        ct=1;
+        for(int i=0;i<writeCt;i++){
+            int r = writes[i].reg;
+            uint16_t v = writes[i].val;
+            uint64_t bit = ((uint64_t)1)<<r;
+            if(isCommandReg(r)){
+                if(r==REG_RESET && (v & RESET_HARD))
+                    hardReset=true;
+            } else {
+                if((shadowValid & bit) && !(volatileRegs & bit) &&
+                   shadow[r]==v){
+                    suppressedWrites++;
+                    continue;
+                }
+                shadow[r]=v;
+                shadowValid |= bit;
+            }
+            buf[0]++;
+            buf[ct++]=r;
+            buf[ct++]=v&0xff;
+            if(regs[r].getSize() == 2) // extra byte if reqd.
+                buf[ct++]=v>>8;
+        }
+        writeCt=0;
+        // the slave will reboot with default values
+        if(hardReset)
+            shadowValid=0;
+        return buf[0];
+    }
+    
+    /// send the writes in the block and wait for the response
+    void flushWrites(){
+        uint8_t readbuf[8];
+        writesHeld=false;
+        if(!encodeWrites())
+            return; // nothing would change
+        p->start(devID,CMD_WRITE); // start the command
+        // add the writes to the main output buffer
+        p->add(buf,ct);
+        try {
+            // send
+            p->send();
+            // and wait for a response - just one byte
+            p->readBlock(readbuf,1);
+        } catch(SlaveException &e){
+            invalidateShadow();
+            throw;
+        }
+        if(readbuf[0]){
+            invalidateShadow();
+            throw SlaveException("error in reg write: %d",readbuf[0]);
+        }
+    }
+    
+    /// start a read command for a read set - if there are held writes,
+    /// this is a write/read command which carries them, and the
+    /// response will have a status byte before the read set data;
+    /// we return true if so.
+    bool startRead(int set){
+        if(writesHeld){
+            writesHeld=false;
+            if(encodeWrites()){
+                p->start(devID,CMD_WRITEREAD);
+                p->addByte(set);
+                p->add(buf,ct);
+                return true;
+            }
+        }
+        p->start(devID,CMD_READ);
+        p->addByte(set);
+        return false;
+    }
+    
 public:
     
     int getAddr(){
@@ -183,8 +898,19 @@ public:
     SlaveDevice(){
         p = NULL;
         ct=0;
+        writeCt=0;
+        shadowValid=0;
+        volatileRegs=0;
+        suppressedWrites=0;
+        deferring=writesHeld=false;
+        readSetsSent=0;
+        rawSets=0;
+        rawCount=0;
+        for(int i=0;i<READSETS;i++)
+            readSetCt[i]=readSetSize[i]=0;
+        memset(values,0,sizeof(values));
         for(int i=0;i<READSETS;i++)
-            readSetCt[i]=0;
+            readSent[i]=readReceived[i]=0;
     }
     
     /// connect, setting up a status listener,
@@ -197,6 +923,10 @@ public:
         printf("    initialising device %d\n",id);
         devID = id;
         regs = table;
+        writeCt=0;
+        writesHeld=false;
+        invalidateShadow();
+        readSetsSent=0; // the master may have been reset
         for(int i=0;;i++){
             if(regs[i].sizeAndFlags==32){
                 regCt=i;
@@ -213,42 +943,103 @@ public:
     
     void startWrites(){
         if(!isConnected())return;
-        p->start(devID,CMD_WRITE); // start the command
-        buf[0]=0; // the number of writes is set to zero
-        ct=1; // one byte in the buffer so far (the number of writes)
+        if(writesHeld)return; // add to the held block
+        writeCt=0;
     }
     
     /// end a block, adding the buffer to the protocol output buffer 
     /// and sending it. We then wait for a response byte, which should
-    /// be zero.
+    /// be zero. If we are deferring writes, the block is held
+    /// instead, and sent along with the next read. Writes which
+    /// wouldn't change anything are dropped, and if that's all of
+    /// them nothing is sent.
     
     void endWrites(){
         if(!isConnected())return;
-        uint8_t readbuf[8];
-        // add the writes to the main output buffer
+        if(deferring){
+            writesHeld = writeCt!=0;
+            return;
+        }
+        flushWrites();
+    }
+    
+    /// end a block as endWrites() does, but send it pipelined without
+    /// waiting for the response. An error will be thrown when the
+    /// response is eventually read.
+    
+    void endWritesPipelined(){
+        if(!isConnected())return;
+        if(deferring){
+            writesHeld = writeCt!=0;
+            return;
+        }
+        if(!encodeWrites())
+            return;
+        p->start(devID,CMD_WRITE);
         p->add(buf,ct);
-        // send
+        try {
+            p->sendPipelined(1,[this](const uint8_t *reply,int,double,double){
+                if(!reply || reply[0])
+                    invalidateShadow();
+                if(reply && reply[0])
+                    throw SlaveException("error in reg write on %d: %d",devID,reply[0]);
+            });
+        } catch(SlaveException &e){
+            invalidateShadow(); // the writes may not have gone
+            throw;
+        }
+    }
+    
+    /// write a single register straight away in its own write
+    /// command, and wait for the response, leaving any block of
+    /// writes being built or held alone. This is for command
+    /// registers (such as REG_EXCEPTIONDATA) in an emergency, and
+    /// doesn't use the shadow.
+    void writeIntNow(uint8_t reg,uint16_t val){
+        if(!isConnected())return;
+        if(reg>=regCt)
+            throw SlaveException("%d is not a sensible register",reg);
+        uint8_t w[4],status;
+        int n=0;
+        w[n++]=1; // one write
+        w[n++]=reg;
+        w[n++]=val&0xff;
+        if(regs[reg].getSize()==2)
+            w[n++]=val>>8;
+        shadowValid &= ~(((uint64_t)1)<<reg);
+        p->start(devID,CMD_WRITE);
+        p->add(w,n);
         p->send();
-        // and wait for a response - just one byte
-        p->readBlock(readbuf,1);
-        if(readbuf[0])
-            throw SlaveException("error in reg write: %d",readbuf[0]);
+        p->readBlock(&status,1);
+        if(status)
+            throw SlaveException("error in reg write on %d: %d",devID,status);
     }
     
     /// add a register write to the buffer - must be between startWrites()
     /// and endWrites(). This is for 'unmapped' registers, which are
-    /// raw 16-bit integer values.
+    /// raw 16-bit integer values. A second write to a register in the
+    /// same block replaces the first, unless it's a command register.
     void writeInt(uint8_t reg,uint16_t val){
         if(!isConnected())return;
-        if(ct<256){
-            buf[0]++;
-            buf[ct++]=reg;
-            buf[ct++]=val&0xff;
-            if(regs[reg].getSize() == 2) // extra byte if reqd.
-                buf[ct++]=val>>8;
-        } else {
-            throw SlaveException("too many writes in one block");            
+        if(reg>=regCt)
+            throw SlaveException("%d is not a sensible register",reg);
+        if(!isCommandReg(reg)){
+            for(int i=0;i<writeCt;i++){
+                if(writes[i].reg==reg){
+                    writes[i].val=val;
+                    return;
+                }
+            }
         }
+        if(writeCt==MAXBLOCKWRITES){
+            if(!writesHeld)
+                throw SlaveException("too many writes in one block");
+            // no room for any more held writes, so send them now
+            flushWrites();
+        }
+        writes[writeCt].reg=reg;
+        writes[writeCt].val=val;
+        writeCt++;
     }
     
     /// add a register write to the buffer - must be between startWrites()
@@ -268,6 +1059,67 @@ public:
         writeInt(r,i);
     }
     
+    /// add a write of a mapped register to the buffer, using its
+    /// compile-time descriptor (e.g. RegDS<REGDS_DRIVE_REQSPEED>)
+    /// rather than looking it up in the register table. The
+    /// descriptor must be for this device's table.
+    template <class R> void write(float v){
+        static_assert(R::writable,"register is not writable");
+        static_assert(R::mapped(),"register is unmapped, use writeInt<>()");
+        if(!isConnected())return;
+        if(v<R::minval() || v>R::maxval())
+            throw SlaveException("%f out of range for register %d",v,R::reg);
+        // done in the same order as Register::map(), so that the
+        // result is exactly the same
+        constexpr float steps = R::steps();
+        constexpr float range = R::range();
+        writeInt(R::reg,(uint16_t)((v-R::minval())*steps/range));
+    }
+    
+    /// add a write of an unmapped register to the buffer, using its
+    /// compile-time descriptor.
+    template <class R> void writeInt(uint16_t v){
+        static_assert(R::writable,"register is not writable");
+        static_assert(!R::mapped(),"register is mapped, use write<>()");
+        writeInt(R::reg,v);
+    }
+    
+    /// set whether blocks of writes are held rather than sent by
+    /// endWrites(), to go out with the next read of this device in a
+    /// single write/read command. Turning this off sends any held
+    /// writes.
+    void setDeferWrites(bool f){
+        deferring=f;
+        if(!f && writesHeld && isConnected())
+            flushWrites();
+    }
+    
+    /// are there held writes waiting for the next read?
+    bool hasHeldWrites(){
+        return writesHeld;
+    }
+    
+    /// mark a register as one the slave can change itself, such as
+    /// a required value which is reset in an exception, so that
+    /// writes to it are never skipped because of the shadow.
+    void setVolatile(int r){
+        volatileRegs |= ((uint64_t)1)<<r;
+    }
+    
+    /// forget what we think the slave's registers contain, so that
+    /// the next write to each is sent. This is done on init, on errors
+    /// and on hard resets, but should also be done if the slave may
+    /// have been reset some other way.
+    void invalidateShadow(){
+        shadowValid=0;
+    }
+    
+    /// the number of writes which have been skipped because they
+    /// wouldn't have changed anything
+    int getSuppressedWriteCount(){
+        return suppressedWrites;
+    }
+    
     /// send a write command to reset this slave's exceptions
     void resetExceptions(){
         if(!isConnected())return;
@@ -279,75 +1131,246 @@ public:
     /// Set a read set. This consists of the set number, and alist of
     /// registers which the device should send when we request a read for that set.
     /// The list is terminated with -1.
-    /// Note that the read set will change for ALL devices,
-    /// not just this one!
+    /// Each device has its own read sets, so this doesn't change
+    /// the read set on any other device.
     void setReadSet(int set, int first,...){
         va_list ptr;
         va_start(ptr,first);
         
-        if(!isConnected())return;
-        readSetCt[set]=0; // clear our copy of the read set
-        p->start(devID,CMD_SETREADSET); // start the command
-        p->addByte(set); // add the set index
-        p->addByte(first); // add the first item to the command 
-        readSet[set][readSetCt[set]++]=first; // and our copy
-        
+        uint8_t r[READSETSIZE];
+        int n=0;
+        r[n++]=first;
         for(;;){ // for remaining items
-            int n = va_arg(ptr,int); // get next item
-            if(n<0)break; // if it's -ve, break
-            if(readSetCt[set]==READSETSIZE)
+            int v = va_arg(ptr,int); // get next item
+            if(v<0)break; // if it's -ve, break
+            if(n==READSETSIZE){
+                va_end(ptr);
                 throw SlaveException("read set too large");
-            p->addByte((uint8_t)n); // add item to command
-            readSet[set][readSetCt[set]++]=(uint8_t)n; // and our copy
+            }
+            r[n++]=(uint8_t)v;
         }
+        va_end(ptr);
+        setReadSet(set,r,n);
+    }
+    
+    /// Set a read set from an array of register numbers. If the master
+    /// already has this read set for this device, nothing is sent.
+    /// The master holds the different read sets of all its devices
+    /// in READSETAREA bytes, a byte per register, and at most
+    /// READSETENTRIES of them; past that this throws.
+    void setReadSet(int set,const uint8_t *r,int n){
+        if(!isConnected())return;
+        if(set<0 || set>=READSETS)
+            throw SlaveException("%d is not a sensible read set",set);
+        if(n>READSETSIZE)
+            throw SlaveException("read set too large");
+        
+        if((readSetsSent & (1<<set)) && readSetCt[set]==n &&
+           !memcmp(readSet[set],r,n))
+            return; // the master has it already
+        
+        readSetsSent &= ~(1<<set);
+        if(rawSets & (1<<set))
+            unpackRaw(); // while we still know the old layout
+        memcpy(readSet[set],r,n); // our copy
+        readSetCt[set]=n;
+        readSetSize[set]=0;
+        for(int i=0;i<n;i++)
+            readSetSize[set]+=regs[r[i]].getSize();
+        // any decoder was for the old set
+        decoders[set]=nullptr;
+        p->start(devID,CMD_SETREADSET); // start the command
+        p->addByte(set); // add the set index
+        p->add(readSet[set],n); // and the registers
         p->send(); // send command
         // and wait for a response - just one byte
         uint8_t readbuf[8];
         p->readBlock(readbuf,1);
-        if(readbuf[0]!=readSetCt[set]) // should be the count
-            throw SlaveException("error in read set: %d, should be %d",readbuf[0],readSetCt[set]);
+        if(readbuf[0]==READSET_POOLFULL)
+            throw SlaveException("no room for read set %d on device %d: the "
+                                 "master's read set pool (%d registers in at "
+                                 "most %d sets) is full",
+                                 set,devID,READSETAREA,READSETENTRIES);
+        if(readbuf[0]!=n) // should be the count
+            throw SlaveException("error in read set: %d, should be %d",readbuf[0],n);
+        readSetsSent |= 1<<set;
+    }
+    
+    /// forget which read sets the master has, so the next
+    /// setReadSet() on each is sent even if it hasn't changed -
+    /// call this if the master may have been reset.
+    void invalidateReadSets(){
+        readSetsSent=0;
     }
     
     
     
     
+    /// get the size of the response to a read of a given read set
+    int getReadSetSize(int set){
+        return readSetSize[set];
+    }
+    
+    /// attach a decoder to a read set, which is given the reply to
+    /// each read of the set. The reply is then only copied, and its
+    /// values are unpacked into the registers the first time
+    /// getRegInt(), getValueInt() and so on are called after it.
+    /// Do this after setReadSet(), which removes the decoder if the
+    /// set changes. See readsets.h for how the board data classes
+    /// do this.
+    void setReadSetDecoder(int set,std::function<void(const uint8_t *)> d){
+        if(set<0 || set>=READSETS)
+            throw SlaveException("%d is not a sensible read set",set);
+        decoders[set]=d;
+    }
+    
     /// request a read of the current read set and await the response block.
     void readRegs(int set){
-        curSet = set;
-        
         /// calculate the size of the response
-        int size=0;
-        for(int i=0;i<readSetCt[set];i++){
-            size+=regs[readSet[set][i]].getSize();
-        }
+        int size=getReadSetSize(set);
         
-        // start the command
-        p->start(devID,CMD_READ);
-        // send the read set
-        p->addByte(set);
+        if(writesHeld){
+            // send the writes with the read, and get their status
+            // before the data
+            if(startRead(set)){
+                try {
+                    p->send();
+                    p->readBlock(buf,size+1);
+                } catch(SlaveException &e){
+                    invalidateShadow();
+                    throw;
+                }
+                if(buf[0]){
+                    invalidateShadow();
+                    throw SlaveException("error in reg write: %d",buf[0]);
+                }
+                stampRead(set,p->getSendTime(),p->getClock()->now());
+                decodeRegs(set,buf+1);
+                return;
+            }
+        } else {
+            // start the command, with the read set
+            startRead(set);
+        }
         // send
         p->send();
         // await the response
         p->readBlock(buf,size);
         
-        // copy values into register holding area
-        
-        uint8_t *ptr = buf;
-        
+        stampRead(set,p->getSendTime(),p->getClock()->now());
+        decodeRegs(set,buf);
+    }    
+    
+    /// request a read of a read set as a pipelined command, so we don't
+    /// wait for the response. When it arrives the values are decoded
+    /// and the function (if any) is called, from within which
+    /// getRegInt() and getRegFloat() will return them.
+    void readRegsPipelined(int set,std::function<void(SlaveDevice *)> done){
+        int size=getReadSetSize(set);
+        bool status = startRead(set); // is there a write status first?
+        try {
+            p->sendPipelined(size+(status?1:0),
+                             [this,set,done,status](const uint8_t *reply,int,
+                                                    double sent,double received){
+                if(!reply){ // lost
+                    if(status)invalidateShadow();
+                    return;
+                }
+                if(status){
+                    if(*reply){
+                        invalidateShadow();
+                        throw SlaveException("error in reg write on %d: %d",devID,*reply);
+                    }
+                    reply++;
+                }
+                stampRead(set,sent,received);
+                decodeRegs(set,reply);
+                if(done)done(this);
+            });
+        } catch(SlaveException &e){
+            if(status)invalidateShadow(); // the writes may not have gone
+            throw;
+        }
+    }
+    
+    /// copy the values in a read set response block into the register
+    /// holding area, from where getRegInt(), getValueInt() and so on
+    /// fetch them. If the set has a decoder the block is passed to it
+    /// and just kept, to be unpacked if the values are asked for.
+    /// Returns a pointer to just after the data used.
+    const uint8_t *decodeRegs(int set,const uint8_t *ptr){
+        curSet = set;
+        if(decoders[set]){
+            decoders[set](ptr);
+            memcpy(rawReplies[set],ptr,readSetSize[set]);
+            rawOrder[set]=++rawCount;
+            rawSets |= 1<<set;
+            return ptr+readSetSize[set];
+        }
+        // older replies first, so they don't overwrite this one
+        if(rawSets)
+            unpackRaw();
+        return unpackRegs(set,ptr,true);
+    }
+    
+    /// copy the values in a read set response block into the register
+    /// values, and into the read set values if it's the current set.
+    /// Returns a pointer to just after the data used.
+    const uint8_t *unpackRegs(int set,const uint8_t *ptr,bool current){
         for(int i=0;i<readSetCt[set];i++){
             uint16_t v=0;
             v=*ptr++;
             if(regs[readSet[set][i]].getSize()==2)
                 v+=*ptr++ << 8;
             //            printf("%x: Reg %d = %x\n",(ptr-buf),readSet[i],v);
-            regVals[i]=v;
+            if(current)
+                regVals[i]=v;
+            values[readSet[set][i]]=v;
         }
-    }    
+        return ptr;
+    }
+    
+    /// unpack the raw replies kept for sets with decoders, oldest first
+    void unpackRaw(){
+        while(rawSets){
+            int oldest=-1;
+            for(int i=0;i<READSETS;i++){
+                if((rawSets & (1<<i)) &&
+                   (oldest<0 || rawOrder[i]<rawOrder[oldest]))
+                    oldest=i;
+            }
+            rawSets &= ~(1<<oldest);
+            unpackRegs(oldest,rawReplies[oldest],oldest==curSet);
+        }
+    }
+    
+    /// record the times of a read of a set: when the request was
+    /// sent and when its reply arrived. The read functions do this
+    /// themselves.
+    void stampRead(int set,double sent,double received){
+        readSent[set]=sent;
+        readReceived[set]=received;
+    }
+    
+    /// get the monotonic time at which the reply to the last read of
+    /// a set arrived, or zero if it has never been read
+    double getReadTime(int set){
+        return readReceived[set];
+    }
+    
+    /// get the time between writing the last read of a set to the
+    /// master and reading its reply, in seconds - not counting any
+    /// wait for room in the pipeline window before it was written
+    double getReadLatency(int set){
+        return readReceived[set]-readSent[set];
+    }
     
     /// after calling readRegs, this can be used to get register values;
     /// the index is the read set index, so if the read set is 2,3,4 then
     /// getRegInt(0..2) will get values for registers 2,3 and 4.
     uint16_t getRegInt(int n){
+        if(rawSets)
+            unpackRaw();
         return regVals[n];
     }
     
@@ -358,16 +1381,205 @@ public:
         return regs[readSet[curSet][n]].unmap(getRegInt(n));
     }
     
+    /// get the raw value of a register from the last read of any
+    /// read set which included it - unlike getRegInt(), this takes
+    /// the register number and works after reading several sets.
+    uint16_t getValueInt(int r){
+        if(rawSets)
+            unpackRaw();
+        return values[r];
+    }
+    
+    /// get the value of a register from the last read of any read
+    /// set which included it, mapped to a float.
+    float getValueFloat(int r){
+        return regs[r].unmap(getValueInt(r));
+    }
+    
+    
     
+    /// get the value of a register from the last read of any read
+    /// set which included it, mapped to a float using its compile-time
+    /// descriptor (e.g. RegDS<REGDS_DRIVE_ACTUALSPEED>) - just a
+    /// multiply and an add. The descriptor must be for this device's
+    /// table.
+    template <class R> float read(){
+        constexpr float scale = R::scale();
+        constexpr float offset = R::offset();
+        return getValueInt(R::reg)*scale+offset;
+    }
+    
+    /// get the raw value of an unmapped register from the last read
+    /// of any read set which included it, using its compile-time
+    /// descriptor.
+    template <class R> uint16_t readInt(){
+        static_assert(!R::mapped(),"register is mapped, use read<>()");
+        return getValueInt(R::reg);
+    }
     
     /// are we connected?
     bool isConnected(){
         return p && p->comms && p->comms->isReady();
     }
     
+    /// add the writes in the current block (and any held writes) to
+    /// a multiple write command being built, as the device ID followed
+    /// by the writes in the form used by the write command. Returns
+    /// false, adding nothing, if none of them would change anything.
+    bool addToMultiWrite(){
+        writesHeld=false;
+        if(!encodeWrites())
+            return false;
+        p->addByte(devID);
+        p->add(buf,ct);
+        return true;
+    }
+    
+};
+
+/// builds up a list of (device, read set) pairs and reads them all
+/// with a single CMD_MULTIREAD exchange, rather than one exchange per
+/// device. The responses come back concatenated in the order the
+/// reads were added. After read(), each device's values can be
+/// fetched with getRegInt() and getRegFloat() as if readRegs() had
+/// been called on it. Devices which have held writes (see
+/// SlaveDevice::setDeferWrites()) are instead read with a pipelined
+/// write/read command, so that their writes go out too.
+
+class MultiRead {
+    /// the protocol we send the command over
+    SlaveProtocol *p;
+    /// the devices to read, in order
+    SlaveDevice *devs[MAXMULTIREAD];
+    /// the read set to read on each device
+    uint8_t sets[MAXMULTIREAD];
+    /// how many reads have been added
+    int ct;
+    /// response buffer - big enough for the largest read set on
+    /// every device
+    uint8_t buf[MAXMULTIREAD*READSETSIZE*2];
+    
+public:
+    MultiRead(SlaveProtocol *_p){
+        p = _p;
+        ct=0;
+    }
+    
+    /// remove all reads from the list
+    void clear(){
+        ct=0;
+    }
+    
+    /// add a read of a given read set on a device
+    void add(SlaveDevice *d,int set){
+        if(d->hasHeldWrites()){
+            d->readRegsPipelined(set,NULL);
+            return;
+        }
+        if(ct==MAXMULTIREAD)
+            throw SlaveException("too many reads in multiple read");
+        devs[ct]=d;
+        sets[ct++]=set;
+    }
+    
+    /// send the command and await the concatenated response, then
+    /// hand each part of it to the appropriate device.
+    void read(){
+        if(!ct){
+            p->sync(); // just read any write/read replies
+            return;
+        }
+        int size=0;
+        
+        // the command goes to the master, and each pair is packed
+        // into a byte in the same way as the command byte: device ID
+        // in the top four bits, read set in the bottom four.
+        p->start(0,CMD_MULTIREAD);
+        for(int i=0;i<ct;i++){
+            p->addByte((devs[i]->getAddr()<<4)|sets[i]);
+            size += devs[i]->getReadSetSize(sets[i]);
+        }
+        p->send();
+        p->readBlock(buf,size);
+        double sent = p->getSendTime();
+        double received = p->getClock()->now();
+        
+        const uint8_t *ptr = buf;
+        for(int i=0;i<ct;i++){
+            devs[i]->stampRead(sets[i],sent,received);
+            ptr = devs[i]->decodeRegs(sets[i],ptr);
+        }
+    }
 };
 
 
+/// sends writes to several devices in a single exchange: the master
+/// does them one after another and sends a single status byte back.
+/// Call add() for each device, make the writes, and then call send()
+/// instead of endWrites().
+
+class MultiWrite {
+    /// the protocol we send the command over
+    SlaveProtocol *p;
+    /// the devices to write, in order
+    SlaveDevice *devs[MAXMULTIWRITE];
+    /// how many devices have been added
+    int ct;
+    
+    /// forget what we think all the devices contain, after an error
+    void invalidateShadows(){
+        for(int i=0;i<ct;i++)
+            devs[i]->invalidateShadow();
+    }
+    
+public:
+    MultiWrite(SlaveProtocol *_p){
+        p = _p;
+        ct=0;
+    }
+    
+    /// add a device, starting a block of writes on it. Adding a
+    /// device which is already in the list does nothing, so all the
+    /// motors on a device can add it.
+    void add(SlaveDevice *d){
+        if(!d->isConnected())return;
+        for(int i=0;i<ct;i++){
+            if(devs[i]==d)return;
+        }
+        if(ct==MAXMULTIWRITE)
+            throw SlaveException("too many devices in multiple write");
+        d->startWrites();
+        devs[ct++]=d;
+    }
+    
+    /// send the writes on all the devices and await the status,
+    /// clearing the list.
+    void send(){
+        uint8_t status;
+        int n=0;
+        p->start(0,CMD_MULTIWRITE);
+        for(int i=0;i<ct;i++){
+            if(devs[i]->addToMultiWrite())
+                n++;
+        }
+        if(n){
+            try {
+                p->send();
+                p->readBlock(&status,1);
+            } catch(SlaveException &e){
+                invalidateShadows();
+                ct=0;
+                throw;
+            }
+            if(status){
+                invalidateShadows();
+                ct=0;
+                throw SlaveException("error in multiple write: %d",status);
+            }
+        }
+        ct=0;
+    }
+};
 
 
 #endif /* __SLAVE_H */
@@ -0,0 +1,136 @@
+/**
+ * \file
+ * Consistent copies of the rover's state, published by update() so
+ * that other threads can read them without locking the rover.
+ */
+
+#ifndef __SNAPSHOT_H
+#define __SNAPSHOT_H
+
+#include <stdint.h>
+#include <string.h>
+#include <sched.h>
+#include <atomic>
+#include <type_traits>
+
+#include "motordata.h"
+
+/// a sequence lock holding a value of plain data type T. One thread
+/// writes new values; any number of threads read them without ever
+/// blocking the writer. A reader copies the value and then checks the
+/// sequence number hasn't changed while it did so, trying again if it
+/// has. The value is kept as atomic words, so a reader which overlaps
+/// a write gets a torn copy it then throws away, never undefined
+/// behaviour.
+
+template <class T> class SeqLock {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "SeqLock needs a plain data type");
+
+    /// number of words the value takes up
+    static const int WORDS = (sizeof(T)+sizeof(uint32_t)-1)/sizeof(uint32_t);
+
+    /// odd while a write is in progress; goes up by two each write
+    std::atomic<uint32_t> seq;
+    /// the value
+    std::atomic<uint32_t> words[WORDS];
+
+public:
+    SeqLock() : seq(0) {
+        for(int i=0;i<WORDS;i++)
+            words[i].store(0,std::memory_order_relaxed);
+    }
+
+    /// publish a new value - only one thread may do this
+    void write(const T &v){
+        uint32_t buf[WORDS];
+        buf[WORDS-1]=0; // any padding at the end
+        memcpy(buf,&v,sizeof(T));
+
+        uint32_t s = seq.load(std::memory_order_relaxed);
+        seq.store(s+1,std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        for(int i=0;i<WORDS;i++)
+            words[i].store(buf[i],std::memory_order_relaxed);
+        seq.store(s+2,std::memory_order_release);
+    }
+
+    /// try to copy the value, returning false (and leaving v
+    /// undefined) if it was being written at the time
+    bool tryRead(T &v) const {
+        uint32_t buf[WORDS];
+        uint32_t s = seq.load(std::memory_order_acquire);
+        if(s&1)return false;
+        for(int i=0;i<WORDS;i++)
+            buf[i]=words[i].load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if(seq.load(std::memory_order_relaxed)!=s)
+            return false;
+        memcpy(&v,buf,sizeof(T));
+        return true;
+    }
+
+    /// copy the value, trying until we get a consistent copy
+    void read(T &v) const {
+        while(!tryRead(v))
+            sched_yield();
+    }
+
+    /// the number of values which have been written
+    uint32_t getWriteCount() const {
+        return seq.load(std::memory_order_acquire)/2;
+    }
+};
+
+/// a complete copy of the rover's state after an update(). Motor
+/// data arrays are indexed by wheel number minus one.
+
+struct RoverSnapshot {
+    /// number of updates done before this one was taken
+    uint32_t sweep;
+
+    /// the motor data, as a structure of arrays
+    RoverTelemetry telemetry;
+    
+    /// get the data for a drive motor, which is a view of this
+    /// snapshot's telemetry so is only good while the snapshot is
+    /// @param w wheel number 1-6
+    DriveMotorData getDriveData(int w) const {
+        return DriveMotorData(&telemetry,w-1);
+    }
+    
+    /// get the data for a steer motor (see getDriveData())
+    /// @param w wheel number 1-6
+    SteerMotorData getSteerData(int w) const {
+        return SteerMotorData(&telemetry,w-1);
+    }
+    
+    /// get the data for a lift motor (see getDriveData())
+    /// @param w wheel number 1-6
+    LiftMotorData getLiftData(int w) const {
+        return LiftMotorData(&telemetry,w-1);
+    }
+
+    /// required values sent to each motor, indexed by type
+    /// (DRIVE, STEER, LIFT) and then wheel
+    float required[3][6];
+
+    /// chassis values from each wheel pair
+    float chassis[3];
+
+    /// the status register of each slave, indexed by I2C address
+    /// minus one
+    int status[9];
+
+    /// temperatures, as in MasterData
+    float temps[10];
+    /// when the temperatures were read
+    SampleTime tempSample;
+
+    int exceptionType; //!< first exception reported to the master
+    int exceptionSlave; //!< slave which reported it
+    int exceptionMotor; //!< motor (0/1) on that slave
+};
+
+
+#endif /* __SNAPSHOT_H */
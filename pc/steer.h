@@ -20,20 +20,23 @@ class SteerMotor : public Motor{
 
 public:
     /// constructor, specifying the slave we're talking to
-    SteerMotor(SlaveDevice *s) : Motor(s){}
+    SteerMotor(SlaveDevice *s) : Motor(s){
+        // the slave sets this to the actual position in an exception
+        s->setVolatile(REGDS_STEER_REQPOS);
+    }
     
     virtual void sendParams(){
         slave->startWrites();
-        slave->writeFloat(REGDS_STEER_PGAIN,params.pGain);
-        slave->writeFloat(REGDS_STEER_IGAIN,params.iGain);
-        slave->writeFloat(REGDS_STEER_DGAIN,params.dGain);
-        slave->writeFloat(REGDS_STEER_INTEGRALCAP,params.iCap);
-        slave->writeFloat(REGDS_STEER_INTEGRALDECAY,params.iDecay);
-        slave->writeFloat(REGDS_STEER_OVERCURRENTTHRESH,params.overCurrentThresh);
-        slave->writeFloat(REGDS_STEER_CALIBMIN,params.calibMin);
-        slave->writeFloat(REGDS_STEER_CALIBMAX,params.calibMax);
-        slave->writeFloat(REGDS_STEER_STALLCHECK,params.stallCheck);
-        slave->writeFloat(REGDS_STEER_DEADZONE,params.deadZone);
+        slave->write<RegDS<REGDS_STEER_PGAIN>>(params.pGain);
+        slave->write<RegDS<REGDS_STEER_IGAIN>>(params.iGain);
+        slave->write<RegDS<REGDS_STEER_DGAIN>>(params.dGain);
+        slave->write<RegDS<REGDS_STEER_INTEGRALCAP>>(params.iCap);
+        slave->write<RegDS<REGDS_STEER_INTEGRALDECAY>>(params.iDecay);
+        slave->write<RegDS<REGDS_STEER_OVERCURRENTTHRESH>>(params.overCurrentThresh);
+        slave->write<RegDS<REGDS_STEER_CALIBMIN>>(params.calibMin);
+        slave->write<RegDS<REGDS_STEER_CALIBMAX>>(params.calibMax);
+        slave->write<RegDS<REGDS_STEER_STALLCHECK>>(params.stallCheck);
+        slave->write<RegDS<REGDS_STEER_DEADZONE>>(params.deadZone);
         slave->endWrites();
     }
         
@@ -49,14 +52,15 @@ public:
     }
     
     
-    /// send a new position request
-    virtual void setRequired(float pos){
+    /// check a position request is within the calibrated range
+    virtual void checkRequired(float pos){
         if(pos>(params.calibMax-10) || pos<(params.calibMin+10))
             throw ConstraintException("required position out of range");
-        
-        slave->startWrites();
-        slave->writeFloat(REGDS_STEER_REQPOS,pos);
-        slave->endWrites();
+    }
+    
+    /// add a new position request to the current block of writes
+    virtual void writeRequired(float pos){
+        slave->write<RegDS<REGDS_STEER_REQPOS>>(pos);
         required = pos;
     }
 };
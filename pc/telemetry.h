@@ -0,0 +1,61 @@
+/**
+ * \file
+ * The motor telemetry of the whole rover, kept as a structure of
+ * arrays so that anything which works on all 18 motors at once can
+ * run through them in order rather than chasing a pointer to each
+ * motor's data.
+ */
+
+#ifndef __TELEMETRY_H
+#define __TELEMETRY_H
+
+#include <stdint.h>
+#include <string.h>
+
+static const int DRIVE = 0; //!< value for getMotor() etc.
+static const int STEER = 1; //!< value for getMotor() etc.
+static const int LIFT = 2; //!< value for getMotor() etc.
+
+/// The telemetry of every motor. Each array is indexed by motor
+/// type (DRIVE, STEER, LIFT) and then wheel number minus one, so the
+/// 18 values of a field are contiguous, and each array starts on a
+/// 16 byte boundary for SIMD. The read set decoders write into this
+/// directly, and the motor data blocks (MotorData) are views of it;
+/// a rover has one, and board data objects which don't belong to a
+/// rover have their own.
+
+struct RoverTelemetry {
+    alignas(16) float actual[3][6]; //!< actual speed or position
+    alignas(16) float current[3][6]; //!< motor current
+    alignas(16) float error[3][6]; //!< PID error
+    alignas(16) float errorIntegral[3][6]; //!< PID error integral
+    alignas(16) float errorDeriv[3][6]; //!< PID error derivative
+    alignas(16) float control[3][6]; //!< PID control output
+    alignas(16) float intervalCtrl[3][6]; //!< time between control runs
+    /// exception type of each motor, or zero if none
+    alignas(16) int exceptionType[3][6];
+    /// monotonic time at which each actual value arrived
+    alignas(16) double received[3][6];
+    /// seconds between sending the read of each actual value and
+    /// getting the reply
+    alignas(16) float latency[3][6];
+    /// the slave's millisecond timer when each actual value was
+    /// read, or -1 if it never has been
+    alignas(16) int slaveTimer[3][6];
+    /// drive motor odometry, indexed by wheel number minus one
+    alignas(16) uint32_t odometer[6];
+
+    RoverTelemetry(){
+        clear();
+    }
+
+    /// zero everything, with no slave timer
+    void clear(){
+        memset(this,0,sizeof(*this));
+        for(int t=0;t<3;t++)
+            for(int w=0;w<6;w++)
+                slaveTimer[t][w] = -1;
+    }
+};
+
+#endif /* __TELEMETRY_H */
@@ -0,0 +1,176 @@
+/**
+ * \file
+ * The host clock used to timestamp the data read from the rover, which
+ * can be a virtual clock for simulations, and the record of when each
+ * block of data was read.
+ */
+
+#ifndef __TIMING_H
+#define __TIMING_H
+
+#include <time.h>
+#include <math.h>
+#include <stdint.h>
+#include <atomic>
+
+/// the time the virtual clock starts at, in nanoseconds; well after
+/// zero, like the system's monotonic clock, since a time of zero
+/// means "never"
+#define VIRTUALCLOCKSTART 1000000000000LL
+
+/// the system's monotonic time in seconds, whether or not the
+/// virtual clock is on - for things which must keep real time, such
+/// as pacing a serial link.
+inline double getRealMonotonicTime(){
+    timespec t;
+    clock_gettime(CLOCK_MONOTONIC,&t);
+    return t.tv_sec+t.tv_nsec*1e-9;
+}
+
+/// A clock for timestamps and waits. It reads the system's monotonic
+/// clock unless it is made virtual, when it gives its own time, which
+/// only moves when it is advanced: by sleepFor(), by a PeriodicLoop
+/// waiting for its next tick, or by advance(). With the in-process
+/// simulator on the same clock, this lets a simulation run as fast as
+/// the machine allows and give the same results every time.
+/// The time is kept in whole nanoseconds so that it advances exactly.
+/// Each Rover, RoverSimulator and PeriodicLoop uses the default clock
+/// (see getDefaultClock()) unless given another with setClock(), so
+/// that rovers in one process can each have their own virtual time.
+
+class Clock {
+    std::atomic<bool> virt; //!< is the virtual time in use?
+    std::atomic<int64_t> nanos; //!< the virtual time in nanoseconds
+    
+public:
+    Clock() : virt(false),nanos(VIRTUALCLOCKSTART) {}
+    
+    /// switch the virtual time on or off. This should be done before
+    /// anything using the clock starts, since times from the system
+    /// clock and the virtual one can't be compared.
+    void setVirtual(bool on){
+        virt.store(on);
+    }
+    
+    /// is the virtual time in use?
+    bool isVirtual() const {
+        return virt.load(std::memory_order_relaxed);
+    }
+    
+    /// move the virtual time on to a time in seconds, if it isn't
+    /// already past it
+    void advanceTo(double t){
+        int64_t target = llround(t*1e9);
+        int64_t cur = nanos.load();
+        while(cur<target && !nanos.compare_exchange_weak(cur,target)){}
+    }
+    
+    /// move the virtual time on by some seconds
+    void advance(double secs){
+        if(secs>0)
+            nanos.fetch_add(llround(secs*1e9));
+    }
+    
+    /// the time in seconds, from some arbitrary point
+    double now() const {
+        if(isVirtual())
+            return nanos.load()*1e-9;
+        return getRealMonotonicTime();
+    }
+    
+    /// wait for some seconds, or move the virtual time on by that
+    /// much if it's in use. Like usleep(), this returns early if a
+    /// signal arrives.
+    void sleepFor(double secs){
+        if(secs<=0)return;
+        if(isVirtual()){
+            advance(secs);
+            return;
+        }
+        timespec ts;
+        ts.tv_sec = (time_t)secs;
+        ts.tv_nsec = (long)((secs-ts.tv_sec)*1e9);
+        nanosleep(&ts,NULL);
+    }
+};
+
+/// the default clock, used by everything not given its own; the
+/// functions below work on it
+inline Clock *getDefaultClock(){
+    static Clock c;
+    return &c;
+}
+
+/// switch the default clock's virtual time on or off. This should be
+/// done before the rover is initialised, since times from the two
+/// clocks can't be compared.
+inline void setVirtualClock(bool on){
+    getDefaultClock()->setVirtual(on);
+}
+
+/// is the default clock virtual?
+inline bool isVirtualClock(){
+    return getDefaultClock()->isVirtual();
+}
+
+/// move the default clock's virtual time on to a time in seconds, if
+/// it isn't already past it
+inline void advanceVirtualClockTo(double t){
+    getDefaultClock()->advanceTo(t);
+}
+
+/// move the default clock's virtual time on by some seconds
+inline void advanceVirtualClock(double secs){
+    getDefaultClock()->advance(secs);
+}
+
+/// monotonic time in seconds on the default clock, from some
+/// arbitrary point - this is the clock all the timestamps use unless
+/// they are given another.
+inline double getMonotonicTime(){
+    return getDefaultClock()->now();
+}
+
+/// wait for some seconds on the default clock, or move it on by that
+/// much if it's virtual (see Clock::sleepFor())
+inline void sleepFor(double secs){
+    getDefaultClock()->sleepFor(secs);
+}
+
+/// when a block of data was read, and how long it took
+
+struct SampleTime {
+    /// the monotonic time at which the reply arrived, or zero
+    /// if the data has never been read
+    double received;
+    /// seconds between sending the request and getting the reply
+    float latency;
+    /// the slave's millisecond timer (REG_TIMER, which wraps
+    /// every 65.536s) when the data was read, or -1 if it
+    /// wasn't read with the data
+    int slaveTimer;
+
+    SampleTime(){
+        received=0;
+        latency=0;
+        slaveTimer=-1;
+    }
+
+    /// has the data been read?
+    bool isValid() const {
+        return received>0;
+    }
+
+    /// how old the data was at a given monotonic time, in seconds;
+    /// data which has never been read is infinitely old.
+    double getAge(double now) const {
+        return isValid() ? now-received : HUGE_VAL;
+    }
+
+    /// how old the data is now
+    double getAge() const {
+        return getAge(getMonotonicTime());
+    }
+};
+
+#endif /* __TIMING_H */
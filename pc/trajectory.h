@@ -0,0 +1,277 @@
+/**
+ * \file
+ * Trajectories of required values: timed points for any of the
+ * motors, which the rover sends as they come due rather than the
+ * user setting each value at the right moment.
+ */
+
+#ifndef __TRAJECTORY_H
+#define __TRAJECTORY_H
+
+#include <stdint.h>
+#include "timing.h"
+
+/// how many points each motor's trajectory can hold at once - points
+/// which have been passed are dropped, so more can be added as a
+/// trajectory runs
+#define TRAJECTORYSIZE 256
+
+/// ways of getting from one point of a trajectory to the next
+#define TRAJ_STEP 0 //!< stay at the previous value until the point is reached
+#define TRAJ_LINEAR 1 //!< move in a straight line
+#define TRAJ_SPLINE 2 //!< move along a cubic spline through the neighbouring points
+
+/// a point on a trajectory
+
+struct TrajectoryPoint {
+    /// the time at which the motor should reach the value, in seconds
+    /// from the start of the trajectory
+    double t;
+    /// the required value
+    float v;
+    /// how to get here from the previous point (TRAJ_LINEAR etc.)
+    int interp;
+};
+
+/// the trajectory of a single motor, as a ring buffer of points in
+/// time order
+
+class TrajectoryTrack {
+    TrajectoryPoint pts[TRAJECTORYSIZE]; //!< the points
+    int head; //!< index of the oldest point
+    int ct; //!< number of points
+    /// the number of points (from the oldest) which have been reached
+    int reached;
+
+    /// get the nth oldest point
+    const TrajectoryPoint &get(int n) const {
+        return pts[(head+n)%TRAJECTORYSIZE];
+    }
+
+    /// the value between points n-1 and n at time t
+    float interpolate(int n,double t) const {
+        const TrajectoryPoint &p1 = get(n-1);
+        const TrajectoryPoint &p2 = get(n);
+        double dt = p2.t-p1.t;
+        double s = (t-p1.t)/dt;
+        switch(p2.interp){
+        case TRAJ_STEP:
+            return p1.v;
+        case TRAJ_LINEAR:
+            return p1.v+(p2.v-p1.v)*s;
+        default:{
+            // cubic Hermite with Catmull-Rom tangents; the motor
+            // starts and ends at rest at the ends of the trajectory
+            double m1=0,m2=0;
+            if(n>=2){
+                const TrajectoryPoint &p0 = get(n-2);
+                m1 = (p2.v-p0.v)/(p2.t-p0.t);
+            }
+            if(n+1<ct){
+                const TrajectoryPoint &p3 = get(n+1);
+                m2 = (p3.v-p1.v)/(p3.t-p1.t);
+            }
+            double s2=s*s,s3=s2*s;
+            return (float)((2*s3-3*s2+1)*p1.v + (s3-2*s2+s)*dt*m1 +
+                           (-2*s3+3*s2)*p2.v + (s3-s2)*dt*m2);
+        }
+        }
+    }
+
+public:
+    TrajectoryTrack(){
+        clear();
+    }
+
+    /// remove all the points
+    void clear(){
+        head=ct=reached=0;
+    }
+
+    /// the number of points held
+    int size() const {
+        return ct;
+    }
+
+    /// add a point, which must come after the last one. Returns false
+    /// if it doesn't or there's no room.
+    bool add(double t,float v,int interp){
+        if(ct==TRAJECTORYSIZE)return false;
+        if(ct && t<=get(ct-1).t)return false;
+        TrajectoryPoint &p = pts[(head+ct)%TRAJECTORYSIZE];
+        p.t=t;
+        p.v=v;
+        p.interp=interp;
+        ct++;
+        return true;
+    }
+
+    /// note the points which have been reached by time t, calling a
+    /// function with how late we were for each, and drop the ones we
+    /// no longer need.
+    template <class F> void reach(double t,F late){
+        while(reached<ct && get(reached).t<=t){
+            late(t-get(reached).t);
+            reached++;
+        }
+        // a spline segment needs the two points before it
+        while(reached>2){
+            head = (head+1)%TRAJECTORYSIZE;
+            ct--;
+            reached--;
+        }
+    }
+
+    /// get the value at time t (since the start), returning false if
+    /// there is none because the first point hasn't been reached. After
+    /// the last point, the last value is held.
+    bool evaluate(double t,float &v) const {
+        if(!reached)return false;
+        if(reached==ct)
+            v = get(ct-1).v;
+        else
+            v = interpolate(reached,t);
+        return true;
+    }
+
+    /// have all the points been reached?
+    bool isFinished() const {
+        return reached==ct;
+    }
+};
+
+/// trajectories for all the motors on the rover. Add points to any
+/// of them and start(); then Rover::streamTrajectory() (which the
+/// acquisition thread calls on each update) sends the values due,
+/// for all the motors in a single exchange.
+
+class TrajectoryQueue {
+    /// the tracks, indexed by wheel (0-5) and motor type
+    TrajectoryTrack tracks[6][3];
+    /// the monotonic time at which the trajectory started
+    double startTime;
+    /// true if the trajectory is running
+    bool running;
+
+    /// the number of points reached
+    uint32_t reachedCt;
+    /// the number of points reached later than the tolerance
+    uint32_t misses;
+    /// the latest a point has been reached, in seconds
+    double maxLateness;
+    /// how late a point can be reached without being a miss
+    double tolerance;
+    /// the clock start() takes the time from by default
+    Clock *clock;
+
+public:
+    TrajectoryQueue(){
+        clock=getDefaultClock();
+        running=false;
+        tolerance=0.02;
+        clear();
+    }
+
+    /// add a point to the trajectory of a motor. If the trajectory is
+    /// running, the point can be added as long as it's not yet due.
+    /// Returns false if the point is not after the motor's last point
+    /// or there is no room.
+    /// @param w wheel number 1-6
+    /// @param type motor type (DRIVE, STEER or LIFT)
+    /// @param t when the value is required, in seconds from the start
+    /// @param v the required value
+    /// @param interp how to get there from the previous point
+    bool add(int w,int type,double t,float v,int interp=TRAJ_LINEAR){
+        return tracks[w-1][type].add(t,v,interp);
+    }
+
+    /// remove all the points and stop, clearing the statistics
+    void clear(){
+        for(int w=0;w<6;w++)
+            for(int t=0;t<3;t++)
+                tracks[w][t].clear();
+        running=false;
+        reachedCt=misses=0;
+        maxLateness=0;
+    }
+
+    /// start the trajectory, with time zero now
+    void start(){
+        start(clock->now());
+    }
+
+    /// start the trajectory, with time zero at the given monotonic time
+    void start(double now){
+        startTime=now;
+        running=true;
+    }
+
+    /// take the time start() uses from a clock other than the
+    /// default one (Rover::setClock() does this)
+    void setClock(Clock *c){
+        clock=c;
+    }
+
+    /// stop the trajectory, leaving the motors where they are
+    void stop(){
+        running=false;
+    }
+
+    /// is the trajectory running?
+    bool isRunning() const {
+        return running;
+    }
+
+    /// have all the points been reached?
+    bool isFinished() const {
+        for(int w=0;w<6;w++)
+            for(int t=0;t<3;t++)
+                if(!tracks[w][t].isFinished())return false;
+        return true;
+    }
+
+    /// get the values due at a monotonic time, noting how late we are
+    /// for any points reached. Fills in v (indexed by motor type and
+    /// wheel minus one) and returns a mask with bit type*6+wheel-1
+    /// set for each motor which has a value.
+    int evaluate(double now,float v[3][6]){
+        double t = now-startTime;
+        int mask=0;
+        for(int w=0;w<6;w++){
+            for(int ty=0;ty<3;ty++){
+                TrajectoryTrack &tr = tracks[w][ty];
+                tr.reach(t,[this](double late){
+                    reachedCt++;
+                    if(late>maxLateness)maxLateness=late;
+                    if(late>tolerance)misses++;
+                });
+                if(tr.evaluate(t,v[ty][w]))
+                    mask |= 1<<(ty*6+w);
+            }
+        }
+        return mask;
+    }
+
+    /// set how late (in seconds) a point can be reached before it
+    /// counts as a miss; the default is 0.02.
+    void setTolerance(double t){
+        tolerance=t;
+    }
+
+    /// the number of points reached since the queue was cleared
+    uint32_t getReachedCount() const {
+        return reachedCt;
+    }
+
+    /// the number of points reached later than the tolerance
+    uint32_t getMissCount() const {
+        return misses;
+    }
+
+    /// the latest any point has been reached, in seconds
+    double getMaxLateness() const {
+        return maxLateness;
+    }
+};
+
+#endif /* __TRAJECTORY_H */
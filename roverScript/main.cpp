@@ -44,6 +44,21 @@ pthread_t thread;
 /// delay time for monitoring, and also the update tick.
 unsigned long updateTickLength = 10000L;
 
+/// if the real-time loop is on, the update thread runs at fixed
+/// deadlines with this timer instead of sleeping for the update tick
+PeriodicLoop rtLoop;
+/// the real-time loop's period in seconds, or 0 if it's off
+double rtPeriod = 0;
+/// SCHED_FIFO priority of the update thread in the real-time loop, or 0
+int rtPriority = 0;
+/// the CPU the update thread runs on in the real-time loop, or -1
+int rtCPU = -1;
+/// whether memory is locked in the real-time loop
+bool rtLockMemory = false;
+/// set when the settings above change, so the update thread (which
+/// must apply them to itself) picks them up
+std::atomic<bool> rtChanged(false);
+
 
 /// if I make these a subclasses Exception and throw them, C++
 /// seems to only catch them as "Exception" - not their actual classes.
@@ -52,25 +67,8 @@ unsigned long updateTickLength = 10000L;
 class SigIntException{};
 class SigQuitException{};
 
-/// program start time
-timespec progstart;
-
-double time_diff(timespec start, timespec end)
-{
-    timespec temp;
-    if ((end.tv_nsec-start.tv_nsec)<0) {
-        temp.tv_sec = end.tv_sec-start.tv_sec-1;
-        temp.tv_nsec = 1000000000+end.tv_nsec-start.tv_nsec;
-    } else {
-        temp.tv_sec = end.tv_sec-start.tv_sec;
-        temp.tv_nsec = end.tv_nsec-start.tv_nsec;
-    }
-    
-    double t = temp.tv_sec;
-    double ns = temp.tv_nsec;
-    t += ns*1e-9;
-    return t;
-}
+/// program start time, on the monotonic (or virtual) clock
+double progstart;
 
 // these define which wheels are actually wired into the
 // system.
@@ -140,18 +138,32 @@ void emergencyStop(){
     ang.run->stop();
     if(!r->isValid())return;
     autoUDP=false;
-    printf("EMERGENCY STOP\n");
     
-    updateString.clear();
-    usleep(180000L); // wait for any data
+    // stop the motors first, with a single command to the master;
+    // they stay stopped until the exceptions are reset
+    try {
+        r->emergencyStop();
+        printf("EMERGENCY STOP (reset to clear)\n");
+    } catch(RoverException &e){
+        printf("EMERGENCY STOP failed: %s\n",e.what());
+    }
     
+    updateString.clear();
+    sleepFor(0.18); // wait for any data
     
-    int i,t;
+    // now zero the gains and required values, so nothing moves when
+    // the exceptions are reset. Don't hold any writes, they need to
+    // go out now.
     try {
-        // these must run as much as possible, so I'll
-        // catch the exceptions individually
-        for(i=MINWHEEL;i<=MAXWHEEL;i++){
-            for(t=0;t<3;t++){// each motor type
+        r->setDeferWrites(false);
+    } catch(RoverException &e){
+        printf("error sending held writes: %s\n",e.what());
+    }
+    // these must run as much as possible, so I'll
+    // catch the exceptions individually
+    for(int i=MINWHEEL;i<=MAXWHEEL;i++){
+        for(int t=0;t<3;t++){// each motor type
+            try {
                 // get and reset parameter block
                 MotorParams *p = r->getMotor(i,t)->getParams();
                 p->reset();
@@ -161,12 +173,12 @@ void emergencyStop(){
                 // send the modified block
                 r->getMotor(i,t)->sendParams();
                 r->getMotor(i,t)->setRequired(0);
+            } catch(RoverException &e){
+                printf("error in resetting %s wheel %d: %s\n",
+                       r->getMotorTypeName(t), i, e.what());
             }
-        } 
-    }catch(SlaveException e){
-        printf("error in resetting %s wheel: %s\n",
-               r->getMotorTypeName(t), e.what());
-    }
+        }
+    } 
     autoUDP=true;
 }
 
@@ -304,8 +316,8 @@ void udpwrite(const char *s,...){
     va_end(args);
 }
 
-/// send a standard block of UDP data, and
-/// process any incoming messages
+/// process any incoming UDP messages, and send the special
+/// properties - must be called with the mutex held.
 void handleUDP() {
     udpServer.poll(); // check for incoming
     
@@ -314,64 +326,138 @@ void handleUDP() {
     /// the first place, for confirmation.
     extern void sendUDPProperties();
     sendUDPProperties();
-    
+}
+
+/// send a standard block of UDP data from a snapshot of the rover,
+/// which doesn't need the mutex.
+void sendUDPData(const RoverSnapshot &snap){
     // get elapsed time
-    struct timespec t;
-    clock_gettime(CLOCK_MONOTONIC,&t);
-    double diff=time_diff(progstart,t);
+    double diff=getMonotonicTime()-progstart;
     
     udpwrite("ptime=%f",diff);
     
     for(int w=1;w<=6;w++){
-        DriveMotorData *d = r->getDriveData(w);
-        DriveMotor *dm = r->getDrive(w);
-        SteerMotorData *s = r->getSteerData(w);
-        LiftMotorData *l = r->getLiftData(w);
+        DriveMotorData d = snap.getDriveData(w);
+        SteerMotorData s = snap.getSteerData(w);
+        LiftMotorData l = snap.getLiftData(w);
         
         udpwrite("actual%d=%f req%d=%f current%d=%f lift%d=%f steer%d=%f liftcurrent%d=%f odo%d=%d",
-                 w,d->actual,
-                 w,dm->getRequired(),
-                 w,d->current,
-                 w,l->actual,
-                 w,s->actual,
-                 w,l->current,
-                 w,d->odometer
+                 w,d.actual(),
+                 w,snap.required[DRIVE][w-1],
+                 w,d.current(),
+                 w,l.actual(),
+                 w,s.actual(),
+                 w,l.current(),
+                 w,d.odometer()
                  );
     }
     
-    MasterData *m = r->getMasterData();
-    
     for(int i=1;i<10;i++){
-        udpwrite("temp%d=%f",i,m->temps[i] - m->temps[0]);
+        udpwrite("temp%d=%f",i,snap.temps[i] - snap.temps[0]);
     }
 }
 
 char threadRunning=1;
 char threadDead=0;
+
+/// the work of one tick of the update thread: run the update string,
+/// and if the rover is up, stream the trajectory and update it. Must
+/// be called with the mutex held. Returns true if the rover was updated,
+/// in which case sendUpdate() should be called once the mutex is released.
+
+bool updateTick(){
+    if(updateString.val){
+        ang.feed(updateString.val);
+        fflush(stdout);
+    }
+    if(!autoUDP)
+        return false;
+    try {
+        r->streamTrajectory();
+    } catch(RoverException &e){
+        printf("trajectory: %s\n",e.what());
+    }
+    r->update();
+    handleUDP();
+    return true;
+}
+
+/// send the data from the snapshot update() published, so the REPL
+/// isn't kept waiting while we send it
+void sendUpdate(){
+    RoverSnapshot snap;
+    r->getSnapshot(snap);
+    sendUDPData(snap);
+}
+
+/// the length of the update thread's tick in seconds
+double getUpdateTickSecs(){
+    return rtPeriod>0 ? rtPeriod : updateTickLength*1e-6;
+}
+
 // set up a thread used for periodic updates - this is 
 // locked out during processing of user input. Also,
 // UDP data is sent here and regular updates done if a given
-// flag is set
+// flag is set. On the virtual clock it does nothing, and the
+// main loop does its work instead (see runVirtualTick()).
 
 void *updateThreadFunc(void *d){
+    bool rt = false;
     
     while(threadRunning){
-        usleep(updateTickLength);
-        if(updateString.val){
-            pthread_mutex_lock(&mutex);
-            ang.feed(updateString.val);
-            fflush(stdout);
-            pthread_mutex_unlock(&mutex);
+        if(isVirtualClock()){
+            usleep(updateTickLength);
+            continue;
         }
-        if(autoUDP){
-            pthread_mutex_lock(&mutex);
-            r->update();
-            handleUDP();
-            pthread_mutex_unlock(&mutex);
+        if(rtChanged.exchange(false)){
+            // the real-time settings apply to this thread, so they
+            // must be made here
+            rt = rtPeriod>0;
+            const char *err = rt ?
+                  PeriodicLoop::makeRealtime(rtPriority,rtCPU,rtLockMemory) :
+                  PeriodicLoop::makeRealtime(0,-1,false);
+            if(err)
+                printf("real-time loop: %s\n",err);
+            if(rt){
+                rtLoop.setPeriod(rtPeriod);
+                rtLoop.start();
+            }
         }
+        // a fixed period if we're in real-time mode, otherwise the
+        // tick is a sleep after however long the work took
+        if(rt)
+            rtLoop.wait();
+        else
+            usleep(updateTickLength);
+        pthread_mutex_lock(&mutex);
+        bool updated = updateTick();
+        pthread_mutex_unlock(&mutex);
+        if(updated)
+            sendUpdate();
     }
     threadDead=1;
 }
+
+/// when the update thread last ran a tick on the virtual clock
+double lastVirtualTick;
+
+/// on the virtual clock, run the update thread's tick from the main
+/// loop, with the mutex held, if a tick's worth of time has passed
+/// since the last one. The update thread would have been waiting for
+/// the mutex while the line ran, so it would run one tick once the line
+/// was done; doing it here makes sure it runs at the same point every
+/// time. Returns true if the rover was updated.
+
+bool runVirtualTick(){
+    if(!isVirtualClock())
+        return false;
+    double now = getMonotonicTime();
+    if(now-lastVirtualTick < getUpdateTickSecs())
+        return false;
+    lastVirtualTick = now;
+    return updateTick();
+}
+
 void initThreads(){
     pthread_mutex_init(&mutex,NULL);
     pthread_create(&thread,NULL,updateThreadFunc,NULL);
@@ -421,6 +507,9 @@ int main(int argc,char *argv[]){
     setsigs(false);
     
     bool sim = false;
+    bool ptySim = false;
+    bool ioThread = false;
+    int baud = DEFAULTBAUD;
     for(int ii=1;ii<argc;ii++){
         // should put proper opt parsing here..
         if(*argv[ii]=='-'){
@@ -434,6 +523,29 @@ int main(int argc,char *argv[]){
             case 'h':
                 hostName = argv[ii]+2;
                 break;
+            case 'p':
+                // simulator behind a pseudo-terminal, so the real
+                // serial code is used
+                ptySim = true;
+                break;
+            case 'b':
+                baud = atoi(argv[ii]+2);
+                break;
+            case 'f':
+                // don't reset a master which is already running
+                r->setFastConnect(true);
+                break;
+            case 'c':
+                // the simulator, on a virtual clock which only moves
+                // when the script delays
+                sim = true;
+                setVirtualClock(true);
+                break;
+            case 't':
+                // serial I/O in its own thread, so the port isn't
+                // waited on with the mutex held unless we need a reply
+                ioThread = true;
+                break;
                 
             default:break;
             }
@@ -457,17 +569,30 @@ int main(int argc,char *argv[]){
             if(i>=MINWHEEL && i<=MAXWHEEL)
                 mask |= (1<<((i-1)/2));
         }
+        const char *port = "/dev/ttyACM0";
+        if(ptySim){
+            PtyLink *link = new PtyLink(new RoverSimulator());
+            link->setBaudRate(baud); // as slow as the real thing
+            port = link->start();
+            if(!port)
+                printf("Cannot create pseudo-terminal\n");
+            else
+                printf("Simulator on %s\n",port);
+        }
         if(sim)
             r->init(NULL,mask); // NO PORT to run in simulation mode
-        else
-            r->init("/dev/ttyACM0",mask);
+        else if(port){
+            r->init(port,mask,baud);
+            if(ioThread && !r->comms.startIOThread())
+                printf("Cannot start I/O thread\n");
+        }
     } catch(SlaveException &e){
         printf("Error in init: %s\n",e.what());
     }
     
     initThreads();
     r->calibrate(); 
-    clock_gettime(CLOCK_MONOTONIC,&progstart);
+    progstart = lastVirtualTick = getMonotonicTime();
     
     udpServer.start(UDPSERVER_PORT);
     
@@ -492,10 +617,12 @@ int main(int argc,char *argv[]){
         fputs("*\n",stdout);fflush(stdout);
         fgets(buf,256,stdin);
 #endif
+        bool updated = false;
         try {
             pthread_mutex_lock(&mutex);
             ang.feed(line);
             exceptonsig();
+            updated = runVirtualTick();
         } catch(SigIntException &e){
             printf("interrupt signal\n");
             showAngortError();
@@ -517,6 +644,8 @@ int main(int argc,char *argv[]){
             showAngortError();
         }
         pthread_mutex_unlock(&mutex);
+        if(updated)
+            sendUpdate();
     }
     
     threadRunning=0;
@@ -27,6 +27,26 @@ extern void emergencyStop();
     r->setLegCollisionChecks(a->popInt()?true:false);
 }
 
+%word deferwrites (bool --) hold motor writes until the next update, which sends them with the reads
+{
+    r->setDeferWrites(a->popInt()?true:false);
+}
+
+%word alldrive (speed --) set the required speed on all wheels in one exchange
+{
+    r->setRequiredAll(DRIVE,a->popval()->toFloat());
+}
+
+%word allsteer (pos --) set the steer position on all wheels in one exchange
+{
+    r->setRequiredAll(STEER,a->popval()->toFloat());
+}
+
+%word alllift (pos --) set the lift position on all wheels in one exchange
+{
+    r->setRequiredAll(LIFT,a->popval()->toFloat());
+}
+
 %word exceptions (--) list all exceptions
 {
     static const char * const names[]={"",
@@ -35,8 +55,8 @@ extern void emergencyStop();
     
     r->update();
     for(int i=1;i<=6;i++){
-        MotorData *d = r->getMotorData(i,DRIVE);
-        int e = d->exceptionType;
+        MotorData d = r->getMotorData(i,DRIVE);
+        int e = d.exceptionType();
         const char *n = names[e];
         
         printf("Drive %d : %d (%s)\n",i,e,n);
@@ -59,6 +79,7 @@ extern void emergencyStop();
 
 %word temps (--) show all temperatures
 {
+    r->requestRead(DATA_TEMP);
     r->update();
     printf("Amb: %f\n",r->getMasterData()->temps[0]);
     for(int i=1;i<10;i++){
@@ -85,18 +106,18 @@ extern void emergencyStop();
 
 %word dcurrent (wheel -- cur) get drive motor current
 {
-    MotorData *d = r->getMotorData(a->popval()->toInt(),DRIVE);
-    Types::tFloat->set(a->pushval(),d->current);
+    MotorData d = r->getMotorData(a->popval()->toInt(),DRIVE);
+    Types::tFloat->set(a->pushval(),d.current());
 }
 %word lcurrent (wheel -- cur) get lift motor current
 {
-    MotorData *d = r->getMotorData(a->popval()->toInt(),LIFT);
-    Types::tFloat->set(a->pushval(),d->current);
+    MotorData d = r->getMotorData(a->popval()->toInt(),LIFT);
+    Types::tFloat->set(a->pushval(),d.current());
 }
 %word scurrent (wheel -- cur) get steer motor current
 {
-    MotorData *d = r->getMotorData(a->popval()->toInt(),STEER);
-    Types::tFloat->set(a->pushval(),d->current);
+    MotorData d = r->getMotorData(a->popval()->toInt(),STEER);
+    Types::tFloat->set(a->pushval(),d.current());
 }
 
 %word update (--) update the rover sensor data (takes time)
@@ -104,9 +125,26 @@ extern void emergencyStop();
     r->update();
 }
 
+%word readperiod (secs class --) set how often update reads a class of data (0=actual 1=current 2=pid 3=temp) in seconds, 0 for always and -1 for never
+{
+    int c = a->popInt();
+    float secs = a->popval()->toFloat();
+    if(c<0 || c>=DATACLASSES)
+        throw Exception(EX_ROVER,"no such data class");
+    r->setReadPeriod(c,secs);
+}
+
+%word dataage (class -- secs) how old the oldest data of a class is, in seconds
+{
+    int c = a->popInt();
+    if(c<0 || c>=DATACLASSES)
+        throw Exception(EX_ROVER,"no such data class");
+    Types::tFloat->set(a->pushval(),(float)r->getDataAge(c));
+}
+
 void getactual(Runtime *a,int wheel,int type){
-    MotorData *p = r->getMotorData(wheel,type);
-    Types::tFloat->set(a->pushval(),p->actual);
+    MotorData p = r->getMotorData(wheel,type);
+    Types::tFloat->set(a->pushval(),p.actual());
 }
 
 %word dactual (wheel --) get actual drive speed
@@ -135,7 +173,112 @@ void getactual(Runtime *a,int wheel,int type){
 %word odo (wheel --) get odometry for a wheel
 {
     int wheel = a->popval()->toInt();
-    DriveMotorData *p = r->getDriveData(wheel);
-    Types::tFloat->set(a->pushval(),p->odometer);
+    DriveMotorData p = r->getDriveData(wheel);
+    Types::tFloat->set(a->pushval(),p.odometer());
+}
+
+
+/// pop the wheel, motor type and field of a history word, in
+/// that order on the stack (field on top), checking them
+static SampleRing *pophistory(Runtime *a){
+    int f = a->popInt();
+    int t = a->popInt();
+    int w = a->popInt();
+    if(w<1 || w>6 || t<0 || t>2 || f<0 || f>=HISTFIELDS)
+        throw Exception(EX_ROVER,"no such history");
+    return r->getHistory()->get(w,t,f);
+}
+
+/// get statistics for the history of a field over a window,
+/// popping the window and the history from the stack
+static void histstats(Runtime *a,HistoryStats &s){
+    float secs = a->popval()->toFloat();
+    SampleRing *ring = pophistory(a);
+    ring->getStats(getMonotonicTime()-secs,s);
+    if(!s.n)
+        s.min=s.max=s.mean=s.variance=0;
+}
+
+%word histcount (wheel type field secs -- n) number of samples of a motor field (0=actual 1=current 2=error 3=control) in the last secs seconds
+{
+    HistoryStats s;
+    histstats(a,s);
+    Types::tInteger->set(a->pushval(),s.n);
+}
+
+%word histmin (wheel type field secs -- v) smallest value of a motor field in the last secs seconds
+{
+    HistoryStats s;
+    histstats(a,s);
+    Types::tFloat->set(a->pushval(),s.min);
 }
 
+%word histmax (wheel type field secs -- v) largest value of a motor field in the last secs seconds
+{
+    HistoryStats s;
+    histstats(a,s);
+    Types::tFloat->set(a->pushval(),s.max);
+}
+
+%word histmean (wheel type field secs -- v) mean value of a motor field over the last secs seconds
+{
+    HistoryStats s;
+    histstats(a,s);
+    Types::tFloat->set(a->pushval(),s.mean);
+}
+
+%word histvar (wheel type field secs -- v) variance of a motor field over the last secs seconds
+{
+    HistoryStats s;
+    histstats(a,s);
+    Types::tFloat->set(a->pushval(),s.variance);
+}
+
+%word histlast (wheel type field n -- v) the nth newest value of a motor field (0 is the newest)
+{
+    int n = a->popInt();
+    SampleRing *ring = pophistory(a);
+    if(n<0 || n>=ring->size())
+        throw Exception(EX_ROVER,"not that much history");
+    Types::tFloat->set(a->pushval(),ring->getValue(n));
+}
+
+%word traj (wheel type time value interp --) add a point to a motor's trajectory (interp 0=step 1=linear 2=spline)
+{
+    int interp = a->popInt();
+    float v = a->popval()->toFloat();
+    double t = a->popval()->toFloat();
+    int type = a->popInt();
+    int w = a->popInt();
+    if(w<1 || w>6 || type<0 || type>2 || interp<TRAJ_STEP || interp>TRAJ_SPLINE)
+        throw Exception(EX_ROVER,"bad trajectory point");
+    if(!r->getTrajectory()->add(w,type,t,v,interp))
+        throw Exception(EX_ROVER,"trajectory point out of order, or trajectory full");
+}
+
+%word trajstart (--) start the trajectory, which the update thread sends as it comes due
+{
+    r->getTrajectory()->start();
+}
+
+%word trajstop (--) stop the trajectory, leaving the motors where they are
+{
+    r->getTrajectory()->stop();
+}
+
+%word trajclear (--) stop the trajectory and remove all its points
+{
+    r->getTrajectory()->clear();
+}
+
+%word trajrunning (-- bool) is the trajectory running?
+{
+    Types::tInteger->set(a->pushval(),r->getTrajectory()->isRunning()?1:0);
+}
+
+%word trajstats (--) show how many trajectory points were reached late
+{
+    TrajectoryQueue *q = r->getTrajectory();
+    printf("%u points reached, %u late, latest %.3f ms\n",
+           q->getReachedCount(),q->getMissCount(),q->getMaxLateness()*1e3);
+}
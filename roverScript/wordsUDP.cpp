@@ -9,6 +9,7 @@
 #include "roverexceptions.h"
 extern void udpwrite(const char *s,...);
 extern void handleUDP();
+extern void sendUDPData(const RoverSnapshot &snap);
 
 /// head of a linked list of UDP properties
 static class UDPProperty *headUDPPropList=NULL;
@@ -75,6 +76,9 @@ void sendUDPProperties(){
 %word handleudp (--) send and receive queued UDP data
 {
     handleUDP();
+    RoverSnapshot snap;
+    Rover::getInstance()->getSnapshot(snap);
+    sendUDPData(snap);
 }
 
 
@@ -10,28 +10,29 @@
 
 extern void setsigs(bool allowInterrupt);
 extern Rover *r;
-extern struct timespec progstart;
-extern double time_diff(timespec start, timespec end);
+extern double progstart;
 extern unsigned long updateTickLength;
+extern PeriodicLoop rtLoop;
+extern double rtPeriod;
+extern int rtPriority;
+extern int rtCPU;
+extern bool rtLockMemory;
+extern std::atomic<bool> rtChanged;
 
 %name util
 
-%word delay (n --) delay for n microseconds
+%word delay (n --) delay for n seconds, or move the virtual clock on by n seconds
 {
     float t = a->popval()->toFloat();
-    t *= 1.0e6;
     setsigs(true); // make sure we can interrupt during the delay
-    usleep((useconds_t)t);
+    sleepFor(t);
     setsigs(false);
 }    
 
 
-%word time (--time) get time since start of program in seconds
+%word time (--time) get time since start of program in seconds, on the virtual clock if it's in use
 {
-    struct timespec t;
-    
-    clock_gettime(CLOCK_MONOTONIC,&t);
-    double diff=time_diff(progstart,t);
+    double diff=getMonotonicTime()-progstart;
     Types::tFloat->set(a->pushval(),diff);
 }
 
@@ -42,6 +43,53 @@ extern unsigned long updateTickLength;
     updateTickLength = t;
 }
 
+%word rtloop (secs --) run the update thread at a fixed period in seconds with absolute deadlines, or go back to the update tick if 0
+{
+    rtPeriod = a->popval()->toFloat();
+    rtChanged.store(true);
+}
+
+%word rtpriority (prio --) SCHED_FIFO priority (1-99) of the update thread in the real-time loop, 0 for normal scheduling
+{
+    rtPriority = a->popInt();
+    if(rtPriority<0 || rtPriority>99)
+        throw Exception(EX_ROVER,"bad real-time priority");
+    rtChanged.store(true);
+}
+
+%word rtcpu (cpu --) CPU to run the update thread on in the real-time loop, -1 for any
+{
+    rtCPU = a->popInt();
+    rtChanged.store(true);
+}
+
+%word rtmlock (bool --) lock the program's memory in the real-time loop
+{
+    rtLockMemory = a->popInt()?true:false;
+    rtChanged.store(true);
+}
+
+%word rtstats (--) show the real-time loop's period, work time and wakeup latency statistics
+{
+    rtLoop.printStats(stdout);
+}
+
+%word rthist (n --) show a real-time loop histogram (0=period 1=work 2=latency)
+{
+    switch(a->popInt()){
+    case 0:rtLoop.getPeriods().print(stdout);break;
+    case 1:rtLoop.getWork().print(stdout);break;
+    case 2:rtLoop.getLatency().print(stdout);break;
+    default:
+        throw Exception(EX_ROVER,"no such histogram");
+    }
+}
+
+%word rtreset (--) clear the real-time loop's statistics
+{
+    rtLoop.clearStats();
+}
+
 %word panic (string --) throw a ScriptException and leave the program
 {
     char buf[256];